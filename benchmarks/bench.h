@@ -0,0 +1,42 @@
+#ifndef _BENCH_H_INCLUDED_
+#define _BENCH_H_INCLUDED_
+
+#include <chrono>
+#include <cstdio>
+
+// scene and reference image directories of the repository, set by the build
+#ifndef BENCH_SCENE_DIR
+#define BENCH_SCENE_DIR "scenes"
+#endif
+#ifndef BENCH_REFERENCE_DIR
+#define BENCH_REFERENCE_DIR "benchmarks/references"
+#endif
+// set for the renders that train a profile guided build
+#ifndef BENCH_PROFILE
+#define BENCH_PROFILE 0
+#endif
+
+// keep the compiler from optimizing away a value that is never used
+template <class T>
+inline void DoNotOptimize( T const &value ) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// run fn for the given number of iterations after a short warmup and return nanoseconds per call
+template <class F>
+double TimeNs( long iterations, F &&fn ) {
+    long warmup = iterations / 10 + 1;
+    for (long i = 0; i < warmup; i++) fn(i);
+
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < iterations; i++) fn(i);
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+}
+
+// print one benchmark result line
+inline void Report( char const *name, double nsPerOp, char const *extra = "" ) {
+    fprintf(stdout, "%-44s %10.2f ns/op  %s\n", name, nsPerOp, extra);
+}
+
+#endif
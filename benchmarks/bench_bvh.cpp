@@ -0,0 +1,104 @@
+// BVH traversal speed with the mesh faces in file order and reordered so that the faces
+// of each leaf are consecutive, for the OBJ files shipped with the repository or given
+// on the command line
+
+#include "bench.h"
+#include "benchrays.h"
+#include "intersect.h"
+#include "objcache.h"
+#include "cyTriMesh.h"
+#include "cyBVH.h"
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+static char const *defaultFiles[] = {
+    "utah_teapot_res12.obj",
+    "ufo/ufo_body_hr.obj",
+    "ufo/ufo_dome_hr.obj",
+    "ufo/ufo_rim_hr.obj",
+};
+
+// closest hit distance, the same traversal as TriObj
+static bool trace( cy::BVH const &bvh, cy::TriMesh const &mesh, Ray const &ray, unsigned int nodeID, float &z ) {
+    if (!RayBox(ray, bvh.GetNodeBounds(nodeID))) return false;
+
+    bool foundHit = false;
+    if (!bvh.IsLeafNode(nodeID)) {
+        if (trace(bvh, mesh, ray, bvh.GetFirstChildNode(nodeID), z)) foundHit = true;
+        if (trace(bvh, mesh, ray, bvh.GetSecondChildNode(nodeID), z)) foundHit = true;
+    }
+    else {
+        unsigned int const *elements = bvh.GetNodeElements(nodeID);
+        for (unsigned int i = 0; i < bvh.GetNodeElementCount(nodeID); i++) {
+            cy::TriMesh::TriFace const &f = mesh.F(elements[i]);
+            TriangleHit hit;
+            if (RayTriangle(ray, mesh.V(f.v[0]), mesh.V(f.v[1]), mesh.V(f.v[2]), HIT_FRONT_AND_BACK, z, hit)) {
+                z = hit.t;
+                foundHit = true;
+            }
+        }
+    }
+    return foundHit;
+}
+
+int main( int argc, char **argv )
+{
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; i++) files.push_back(argv[i]);
+    if (files.empty()) {
+        for (char const *f : defaultFiles) files.push_back(std::string(BENCH_SCENE_DIR "/") + f);
+    }
+
+    // the tree must be built here, not taken from the cache
+    SetObjLoadHooks(false);
+    const int numRays = 200000;
+
+    for (std::string const &file : files) {
+        cy::TriMesh fileOrder;
+        if (!fileOrder.LoadFromFileObj(file.c_str(), false)) {
+            fprintf(stderr, "Cannot open %s\n", file.c_str());
+            continue;
+        }
+        fileOrder.ComputeBoundingBox();
+        cy::TriMesh leafOrder;
+        leafOrder = fileOrder;
+
+        cy::BVHTriMesh bvhFileOrder, bvhLeafOrder;
+        bvhFileOrder.SetMesh(&fileOrder, 4);
+        bvhLeafOrder.SetMesh(&leafOrder, 4);
+        bvhLeafOrder.ReorderFaces(&leafOrder);
+
+        std::string name = file.substr(file.find_last_of('/') + 1);
+        fprintf(stdout, "%s: %u triangles, %u nodes of %zu bytes, node array %s 64 byte aligned\n",
+                name.c_str(), fileOrder.NF(), bvhLeafOrder.GetNumNodes(), cy::BVH::NodeSize(),
+                uintptr_t(bvhLeafOrder.GetNodeData()) % 64 == 0 ? "is" : "is not");
+
+        std::vector<Ray> rays = RandomRays(Box(fileOrder.GetBoundMin(), fileOrder.GetBoundMax()), numRays);
+
+        // both orders must find the same hits
+        int mismatches = 0;
+        for (Ray const &r : rays) {
+            float za = BIGFLOAT, zb = BIGFLOAT;
+            trace(bvhFileOrder, fileOrder, r, bvhFileOrder.GetRootNodeID(), za);
+            trace(bvhLeafOrder, leafOrder, r, bvhLeafOrder.GetRootNodeID(), zb);
+            if (za != zb) mismatches++;
+        }
+        if (mismatches) fprintf(stdout, "  %d rays hit differently\n", mismatches);
+
+        char extra[64];
+        snprintf(extra, sizeof(extra), "%d rays", numRays);
+        double ns = TimeNs(numRays, [&](long i) {
+            float z = BIGFLOAT;
+            DoNotOptimize(trace(bvhFileOrder, fileOrder, rays[i], bvhFileOrder.GetRootNodeID(), z));
+        });
+        Report(("file order " + name).c_str(), ns, extra);
+        ns = TimeNs(numRays, [&](long i) {
+            float z = BIGFLOAT;
+            DoNotOptimize(trace(bvhLeafOrder, leafOrder, rays[i], bvhLeafOrder.GetRootNodeID(), z));
+        });
+        Report(("leaf order " + name).c_str(), ns, extra);
+    }
+    return 0;
+}
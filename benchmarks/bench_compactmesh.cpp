@@ -0,0 +1,77 @@
+// memory and ray tracing speed of meshes stored as TriMesh arrays and as compact
+// quantized meshes, for the OBJ files shipped with the repository or given on the command line
+
+#include "bench.h"
+#include "benchrays.h"
+#include "objects.h"
+#include "compactmesh.h"
+#include "objcache.h"
+
+#include <vector>
+#include <string>
+#include <cmath>
+
+static char const *defaultFiles[] = {
+    "utah_teapot_res12.obj",
+    "ufo/ufo_body_hr.obj",
+    "ufo/ufo_dome_hr.obj",
+    "ufo/ufo_rim_hr.obj",
+};
+
+int main( int argc, char **argv )
+{
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; i++) files.push_back(argv[i]);
+    if (files.empty()) {
+        for (char const *f : defaultFiles) files.push_back(std::string(BENCH_SCENE_DIR "/") + f);
+    }
+
+    const int numRays = 200000;
+    // lets TriMeshBytes find the tree of each mesh
+    SetObjLoadHooks(false);
+
+    for (std::string const &file : files) {
+        TriObj mesh;
+        if (!mesh.Load(file.c_str())) {
+            fprintf(stderr, "Cannot open %s\n", file.c_str());
+            continue;
+        }
+        CompactMesh compact;
+        compact.Build(mesh);
+
+        std::string name = file.substr(file.find_last_of('/') + 1);
+        fprintf(stdout, "%s: %u triangles, TriMesh %.2f MB (%u vertices), compact %.2f MB (%u vertices)\n",
+                name.c_str(), mesh.NF(), TriMeshBytes(mesh) / (1024.0 * 1024.0), mesh.NV(),
+                compact.MemoryBytes() / (1024.0 * 1024.0), compact.NV());
+
+        // the same hits within the quantization error, except where nearly coincident
+        // surfaces swap order
+        Box box = mesh.GetBoundBox();
+        float tolerance = 1e-3f * (box.pmax - box.pmin).Length();
+        int hitsMesh = 0, hitsCompact = 0, moved = 0;
+        std::vector<Ray> rays = RandomRays(box, numRays);
+        for (Ray const &r : rays) {
+            HitInfo a, b;
+            bool ha = mesh.IntersectRay(r, a, HIT_FRONT_AND_BACK);
+            bool hb = compact.IntersectRay(r, b, HIT_FRONT_AND_BACK);
+            hitsMesh += ha;
+            hitsCompact += hb;
+            if (ha && hb && std::abs(a.z - b.z) > tolerance) moved++;
+        }
+        fprintf(stdout, "  hits %d / %d, %d farther apart than %g\n", hitsMesh, hitsCompact, moved, tolerance);
+
+        char extra[64];
+        snprintf(extra, sizeof(extra), "%d rays", numRays);
+        double ns = TimeNs(numRays, [&](long i) {
+            HitInfo h;
+            DoNotOptimize(mesh.IntersectRay(rays[i], h, HIT_FRONT_AND_BACK));
+        });
+        Report(("TriMesh " + name).c_str(), ns, extra);
+        ns = TimeNs(numRays, [&](long i) {
+            HitInfo h;
+            DoNotOptimize(compact.IntersectRay(rays[i], h, HIT_FRONT_AND_BACK));
+        });
+        Report(("compact " + name).c_str(), ns, extra);
+    }
+    return 0;
+}
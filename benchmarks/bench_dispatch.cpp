@@ -0,0 +1,95 @@
+// closest hit search over a scene of spheres, planes and a mesh, with every object
+// called through the virtual Object::IntersectRay and with the instances grouped by
+// type so spheres and planes are tested inline and meshes without the vtable
+
+#include "bench.h"
+#include "benchrays.h"
+#include "dispatch.h"
+
+#include <vector>
+#include <string>
+#include <random>
+
+int main( int argc, char **argv )
+{
+    std::string meshFile = argc > 1 ? argv[1] : BENCH_SCENE_DIR "/utah_teapot_res12.obj";
+    const int numSpheres = 200;
+    const int numPlanes = 50;
+    const int numRays = 200000;
+
+    Sphere sphere;
+    Plane plane;
+    TriObj mesh;
+    if (!mesh.Load(meshFile.c_str())) {
+        fprintf(stderr, "Cannot open %s\n", meshFile.c_str());
+        return 1;
+    }
+
+    // objects scattered in a 20 unit cube, each instance only translated and scaled
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> u(-10, 10);
+    std::vector<Instance> instances;
+    auto add = [&]( Object const *obj, float scale ) {
+        Instance inst;
+        inst.node = nullptr;
+        inst.obj = obj;
+        Vec3f pos(u(rng), u(rng), u(rng));
+        inst.toWorld = Matrix3f(scale);
+        inst.toWorldPos = pos;
+        inst.toObj = Matrix3f(1 / scale);
+        inst.toObjPos = -pos / scale;
+        instances.push_back(inst);
+    };
+    for (int i = 0; i < numSpheres; i++) add(&sphere, 0.5f);
+    for (int i = 0; i < numPlanes; i++) add(&plane, 1.0f);
+    Box meshBox = mesh.GetBoundBox();
+    add(&mesh, 4 / (meshBox.pmax - meshBox.pmin).Max());
+
+    InstanceLists lists;
+    lists.Build(instances);
+    fprintf(stdout, "%d spheres, %d planes, 1 mesh of %u triangles\n", numSpheres, numPlanes, mesh.NF());
+
+    std::vector<Ray> rays = RandomRays(Box(Vec3f(-10, -10, -10), Vec3f(10, 10, 10)), numRays);
+
+    auto traceVirtual = [&]( Ray const &ray, HitInfo &h ) {
+        Instance const *hit = nullptr;
+        for (Instance const &inst : instances) {
+            if (inst.obj->IntersectRay(inst.ToObjectCoords(ray), h, HIT_FRONT_AND_BACK)) hit = &inst;
+        }
+        return hit;
+    };
+    auto traceTyped = [&]( Ray const &ray, HitInfo &h ) {
+        Instance const *hit = nullptr;
+        lists.ForEachList([&]( std::vector<Instance> const &list, auto intersect ) {
+            for (Instance const &inst : list) {
+                if (intersect(inst, inst.ToObjectCoords(ray), h, HIT_FRONT_AND_BACK)) hit = &inst;
+            }
+        });
+        return hit;
+    };
+
+    // both searches must find the same objects at the same distances
+    int mismatches = 0, hits = 0;
+    for (Ray const &r : rays) {
+        HitInfo a, b;
+        Instance const *ia = traceVirtual(r, a);
+        Instance const *ib = traceTyped(r, b);
+        hits += ia != nullptr;
+        if ((ia == nullptr) != (ib == nullptr) || a.z != b.z || (ia && ia->obj != ib->obj)) mismatches++;
+    }
+
+    char extra[96];
+    double ns = TimeNs(numRays, [&](long i) {
+        HitInfo h;
+        DoNotOptimize(traceVirtual(rays[i], h));
+    });
+    snprintf(extra, sizeof(extra), "%.2f Mrays/s, %d of %d rays hit", 1e3 / ns, hits, numRays);
+    Report("virtual dispatch", ns, extra);
+    ns = TimeNs(numRays, [&](long i) {
+        HitInfo h;
+        DoNotOptimize(traceTyped(rays[i], h));
+    });
+    snprintf(extra, sizeof(extra), "%.2f Mrays/s, %d hits differ", 1e3 / ns, mismatches);
+    Report("grouped by type", ns, extra);
+    return 0;
+}
@@ -0,0 +1,178 @@
+// the innermost kernels of the renderer one at a time, each over a fixed set of inputs
+// drawn with fixed seeds so runs on different builds see the same work: sphere, plane
+// and triangle intersections, BVH traversal of the shipped meshes, Blinn material and
+// point light sampling, and the Halton sample tables
+
+#include "bench.h"
+#include "benchrays.h"
+#include "raytracer.h"
+#include "intersect.h"
+
+#include <vector>
+#include <string>
+#include <random>
+
+Raytracer tracer(1, 1);
+SampleGenerator sampleGen = SampleGenerator::GetGenerator(256);
+
+static char const *meshFiles[] = {
+    "utah_teapot_res12.obj",
+    "ufo/ufo_body_hr.obj",
+    "ufo/ufo_dome_hr.obj",
+    "ufo/ufo_rim_hr.obj",
+};
+
+static const int numRays = 200000;
+
+// report a ray kernel with its hit rate
+static void reportRays( char const *name, double ns, int hits, int count ) {
+    char extra[96];
+    snprintf(extra, sizeof(extra), "%.2f Mrays/s, %.1f%% hit", 1e3 / ns, 100.0 * hits / count);
+    Report(name, ns, extra);
+}
+
+// closest hits of the rays with one object, counting the rays that hit
+template <class F>
+static void benchObject( char const *name, std::vector<Ray> const &rays, F &&intersect ) {
+    int hits = 0;
+    for (Ray const &r : rays) {
+        HitInfo h;
+        h.Init();
+        hits += intersect(r, h);
+    }
+    double ns = TimeNs(long(rays.size()), [&](long i) {
+        HitInfo h;
+        h.Init();
+        DoNotOptimize(intersect(rays[i], h));
+    });
+    reportRays(name, ns, hits, int(rays.size()));
+}
+
+static void benchPrimitives() {
+    Sphere sphere;
+    Plane plane;
+    benchObject("Sphere::IntersectRay", RandomRays(Box(Vec3f(-1, -1, -1), Vec3f(1, 1, 1)), numRays),
+        [&]( Ray const &r, HitInfo &h ) { return sphere.IntersectRay(r, h, HIT_FRONT_AND_BACK); });
+    benchObject("Plane::IntersectRay", RandomRays(Box(Vec3f(-1, -1, -0.1f), Vec3f(1, 1, 0.1f)), numRays),
+        [&]( Ray const &r, HitInfo &h ) { return plane.IntersectRay(r, h, HIT_FRONT_AND_BACK); });
+}
+
+static void benchMesh( std::string const &file ) {
+    TriObj mesh;
+    if (!mesh.Load(file.c_str())) {
+        fprintf(stderr, "Cannot open %s\n", file.c_str());
+        return;
+    }
+    std::string name = file.substr(file.find_last_of('/') + 1);
+    std::vector<Ray> rays = RandomRays(mesh.GetBoundBox(), numRays);
+
+    // the triangle test TriObj::IntersectTriangle makes, which is private, with each ray
+    // aimed near the center of a random face
+    std::mt19937 rng(99);
+    std::uniform_int_distribution<unsigned int> face(0, mesh.NF() - 1);
+    std::vector<unsigned int> faces(numRays);
+    std::vector<Ray> faceRays(numRays);
+    for (int i = 0; i < numRays; i++) {
+        faces[i] = face(rng);
+        cy::TriMesh::TriFace const &f = mesh.F(faces[i]);
+        Vec3f center = (mesh.V(f.v[0]) + mesh.V(f.v[1]) + mesh.V(f.v[2])) / 3;
+        faceRays[i] = Ray(rays[i].p, center - rays[i].p + (rays[(i + 1) % numRays].dir * 0.01f));
+    }
+    auto triangle = [&]( long i, TriangleHit &hit ) {
+        cy::TriMesh::TriFace const &f = mesh.F(faces[i]);
+        return RayTriangle(faceRays[i], mesh.V(f.v[0]), mesh.V(f.v[1]), mesh.V(f.v[2]), HIT_FRONT_AND_BACK, BIGFLOAT, hit);
+    };
+    int hits = 0;
+    for (int i = 0; i < numRays; i++) {
+        TriangleHit hit;
+        hits += triangle(i, hit);
+    }
+    double ns = TimeNs(numRays, [&](long i) {
+        TriangleHit hit;
+        DoNotOptimize(triangle(i, hit));
+    });
+    reportRays(("RayTriangle " + name).c_str(), ns, hits, numRays);
+
+    // TraceBVHNode from the root
+    benchObject(("TriObj::IntersectRay " + name).c_str(), rays,
+        [&]( Ray const &r, HitInfo &h ) { return mesh.IntersectRay(r, h, HIT_FRONT_AND_BACK); });
+}
+
+// shading points on the z = 0 plane seen from above
+static void randomHits( RNG &rng, std::vector<HitInfo> &hits, std::vector<Ray> &rays ) {
+    for (size_t i = 0; i < hits.size(); i++) {
+        hits[i].Init();
+        hits[i].p = Vec3f(rng.RandomFloat(), rng.RandomFloat(), 0);
+        hits[i].N = Vec3f(0, 0, 1);
+        hits[i].GN = hits[i].N;
+        hits[i].uvw = Vec3f(rng.RandomFloat(), rng.RandomFloat(), 0.5f);
+        hits[i].front = true;
+        rays[i] = Ray(hits[i].p + Vec3f(rng.RandomFloat() - 0.5f, rng.RandomFloat() - 0.5f, 1), -Vec3f(0, 0, 1));
+    }
+}
+
+static void benchSampling() {
+    const int numPoints = 1 << 16;
+    const long iterations = 2000000;
+    RNG rng(1234);
+    std::vector<HitInfo> hits(numPoints);
+    std::vector<Ray> rays(numPoints);
+    randomHits(rng, hits, rays);
+    SamplerInfo sInfo(rng);
+
+    MtlBlinn mtl;
+    mtl.SetDiffuse(Color(0.6f, 0.6f, 0.6f));
+    mtl.SetSpecular(Color(0.3f, 0.3f, 0.3f));
+    mtl.SetGlossiness(64);
+    double ns = TimeNs(iterations, [&](long i) {
+        int k = int(i % numPoints);
+        sInfo.SetHit(rays[k], hits[k]);
+        Vec3f dir;
+        DirSampler::Info si;
+        si.SetVoid();
+        DoNotOptimize(mtl.GenerateSample(sInfo, dir, si));
+        DoNotOptimize(dir);
+    });
+    Report("MtlBlinn::GenerateSample", ns, "diffuse and glossy lobes, untextured");
+
+    PointLight light;
+    light.SetIntensity(Color(10, 10, 10));
+    light.SetPosition(Vec3f(0.5f, 0.5f, 4));
+    light.SetSize(0.5f);
+    ns = TimeNs(iterations, [&](long i) {
+        int k = int(i % numPoints);
+        sInfo.SetHit(rays[k], hits[k]);
+        Vec3f dir;
+        DirSampler::Info si;
+        si.SetVoid();
+        DoNotOptimize(light.GenerateSample(sInfo, dir, si));
+        DoNotOptimize(dir);
+    });
+    Report("PointLight::GenerateSample", ns, "spherical light of radius 0.5");
+
+    // the pixel and lens offsets CameraRay asks for
+    std::vector<float> offsets(numPoints);
+    for (float &o : offsets) o = rng.RandomFloat();
+    ns = TimeNs(iterations, [&](long i) {
+        DoNotOptimize(sampleGen.GetSample(int(i & 255), offsets[i % numPoints]));
+    });
+    Report("SampleGenerator::GetSample", ns);
+    ns = TimeNs(iterations, [&](long i) {
+        DoNotOptimize(sampleGen.GetDiskSample(int(i & 255), offsets[i % numPoints], 0.1f));
+    });
+    Report("SampleGenerator::GetDiskSample", ns);
+}
+
+int main( int argc, char **argv )
+{
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; i++) files.push_back(argv[i]);
+    if (files.empty()) {
+        for (char const *f : meshFiles) files.push_back(std::string(BENCH_SCENE_DIR "/") + f);
+    }
+
+    benchPrimitives();
+    for (std::string const &file : files) benchMesh(file);
+    benchSampling();
+    return 0;
+}
@@ -0,0 +1,88 @@
+// texture lookups and time per shading point for MtlBlinn, with and without
+// sharing the per-hit evaluation record between GenerateSample and GetSampleInfo
+
+#include "bench.h"
+#include "raytracer.h"
+#include "blinneval.h"
+
+#include <vector>
+
+Raytracer tracer(1, 1);
+SampleGenerator sampleGen = SampleGenerator::GetGenerator(1);
+
+// procedural texture that counts its evaluations
+class CountingTexture : public Texture
+{
+public:
+    mutable unsigned long long evals = 0;
+    Color Eval( Vec3f const &uvw ) const override {
+        evals++;
+        float c = 0.5f + 0.5f * sinf(20 * uvw.x) * cosf(20 * uvw.y);
+        return Color(c, c, c);
+    }
+};
+
+int main()
+{
+    CountingTexture tex;
+    TextureMap map(&tex);
+
+    MtlBlinn mtl;
+    mtl.SetDiffuse(Color(0.7f, 0.7f, 0.7f));
+    mtl.SetDiffuseTexture(&map);
+    mtl.SetSpecular(Color(0.5f, 0.5f, 0.5f));
+    mtl.SetSpecularTexture(&map);
+    mtl.SetEmission(Color(0.2f, 0.2f, 0.2f));
+    mtl.SetEmissionTexture(&map);
+    mtl.SetGlossiness(64);
+
+    // fixed set of shading points
+    const int numPoints = 1 << 16;
+    RNG rng(1234);
+    std::vector<HitInfo> hits(numPoints);
+    std::vector<Ray> rays(numPoints);
+    std::vector<Vec3f> lightDirs(numPoints);
+    for (int i = 0; i < numPoints; i++) {
+        hits[i].Init();
+        hits[i].p = Vec3f(rng.RandomFloat(), rng.RandomFloat(), 0);
+        hits[i].N = Vec3f(0, 0, 1);
+        hits[i].GN = hits[i].N;
+        hits[i].uvw = Vec3f(rng.RandomFloat(), rng.RandomFloat(), 0.5f);
+        hits[i].front = true;
+        rays[i] = Ray(hits[i].p + Vec3f(rng.RandomFloat() - 0.5f, rng.RandomFloat() - 0.5f, 1), -Vec3f(0, 0, 1));
+        lightDirs[i] = Vec3f(rng.RandomFloat() - 0.5f, rng.RandomFloat() - 0.5f, 1).GetNormalized();
+    }
+
+    SamplerInfo sInfo(rng);
+    const long iterations = 2000000;
+
+    // the pair of calls materialSample makes at every bounce
+    for (int mode = 0; mode < 2; mode++) {
+        bool shared = mode == 0;
+        InvalidateBlinnEval();
+        tex.evals = 0;
+        unsigned long long lookupsBefore = BlinnEvalLookups();
+
+        double ns = TimeNs(iterations, [&](long i) {
+            int k = int(i % numPoints);
+            sInfo.SetHit(rays[k], hits[k]);
+            Vec3f dir;
+            DirSampler::Info si;
+            si.SetVoid();
+            if (!shared) InvalidateBlinnEval();
+            mtl.GenerateSample(sInfo, dir, si);
+            DoNotOptimize(si.mult);
+            if (!shared) InvalidateBlinnEval();
+            mtl.GetSampleInfo(sInfo, lightDirs[k], si);
+            DoNotOptimize(si.mult);
+        });
+
+        long calls = iterations + iterations / 10 + 1;
+        char extra[128];
+        snprintf(extra, sizeof(extra), "%.2f channel evals, %.2f texture reads per shading point",
+            double(BlinnEvalLookups() - lookupsBefore) / calls, double(tex.evals) / calls);
+        Report(shared ? "MtlBlinn sample+info, shared record" : "MtlBlinn sample+info, record per call", ns, extra);
+    }
+
+    return 0;
+}
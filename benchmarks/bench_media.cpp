@@ -0,0 +1,71 @@
+// shadow rays from a point in front of a sphere that holds a homogeneous medium to a
+// point light behind it: their transmittance must be that of the sphere's diameter, and
+// rays that pass beside the sphere must not be dimmed. Exits with an error otherwise.
+
+#include "bench.h"
+#include "raytracer.h"
+
+#include <cmath>
+#include <string>
+#include <unistd.h>
+
+Raytracer tracer(1, 1);
+SampleGenerator sampleGen = SampleGenerator::GetGenerator(1);
+
+// the sphere has radius 1 at the origin and extinction 1, the light is on the far side
+static char const *mediumScene =
+    "<xml>\n  <scene>\n"
+    "    <object type=\"sphere\" name=\"cloud\" material=\"white\"/>\n"
+    "    <medium type=\"homogeneous\" name=\"inside\" object=\"cloud\"><absorption value=\"0.4\"/><scattering value=\"0.6\"/></medium>\n"
+    "    <material type=\"blinn\" name=\"white\"><diffuse value=\"0.8\"/><specular value=\"0\"/></material>\n"
+    "    <light type=\"point\" name=\"behind\"><intensity value=\"10\"/><position x=\"0\" y=\"4\" z=\"0\"/><size value=\"0.1\"/></light>\n"
+    "  </scene>\n"
+    "  <camera>\n    <position x=\"0\" y=\"-6\" z=\"0\"/>\n    <target x=\"0\" y=\"0\" z=\"0\"/>\n"
+    "    <up x=\"0\" y=\"0\" z=\"1\"/>\n    <fov value=\"40\"/>\n    <width value=\"16\"/>\n    <height value=\"16\"/>\n  </camera>\n</xml>\n";
+
+// transmittance of the light sample along the shadow ray from p, zero if the ray is blocked
+static float lightTransmittance( Vec3f const &p, SamplerInfo const &sInfo ) {
+    Ray shadowRay(p, Vec3f(0, 4, 0) - p);
+    HitInfo shadowInfo;
+    shadowInfo.Init();
+    bool shadowHit = tracer.ShadowTraceRay(shadowRay, shadowInfo, HIT_FRONT_AND_BACK, 1.0f);
+    if (!shadowHit || !shadowInfo.isLight) return 0.0f;
+    return tracer.mediaTransmittance(shadowRay, shadowInfo, shadowHit, sInfo);
+}
+
+int main()
+{
+    char file[64];
+    snprintf(file, sizeof(file), "bench_media.%d.xml", int(getpid()));
+    FILE *f = fopen(file, "w");
+    if (!f) return 1;
+    fputs(mediumScene, f);
+    fclose(f);
+    bool loaded = tracer.LoadScene(file);
+    remove(file);
+    if (!loaded) return 1;
+
+    RNG rng(1234);
+    SamplerInfo sInfo(rng);
+    int failed = 0;
+    struct Case { char const *name; Vec3f p; float expected; };
+    // the light's radius shortens the segment beyond the sphere, not the one through it
+    Case cases[] = {
+        { "through the sphere", Vec3f(0, -3, 0), expf(-2.0f) },
+        { "beside the sphere", Vec3f(3, -3, 0), 1.0f },
+        { "from inside the sphere", Vec3f(0, -0.5f, 0), expf(-1.5f) },
+    };
+    for (Case const &c : cases) {
+        float T = lightTransmittance(c.p, sInfo);
+        bool ok = std::abs(T - c.expected) < 1e-3f;
+        failed += !ok;
+        fprintf(stdout, "%-44s transmittance %.4f, expected %.4f%s\n", c.name, T, c.expected, ok ? "" : "  FAILED");
+    }
+
+    const long iterations = 1000000;
+    double ns = TimeNs(iterations, [&](long i) {
+        DoNotOptimize(lightTransmittance(Vec3f(0.001f * (i & 255), -3, 0), sInfo));
+    });
+    Report("shadow ray through an interior medium", ns);
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,72 @@
+// load time of the OBJ files shipped with the repository, or of the files given
+// on the command line, parsed from text and copied from their binary cache
+
+#include "bench.h"
+#include "objcache.h"
+#include "cyTriMesh.h"
+#include "cyBVH.h"
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <sys/stat.h>
+
+static char const *defaultFiles[] = {
+    "utah_teapot_res12.obj",
+    "ufo/Low_poly_UFO.obj",
+    "ufo/ufo_body.obj",
+    "ufo/ufo_body_hr.obj",
+    "ufo/ufo_dome.obj",
+    "ufo/ufo_dome_hr.obj",
+    "ufo/ufo_rim.obj",
+    "ufo/ufo_rim_hr.obj",
+};
+
+int main( int argc, char **argv )
+{
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; i++) files.push_back(argv[i]);
+    if (files.empty()) {
+        for (char const *f : defaultFiles) files.push_back(std::string(BENCH_SCENE_DIR "/") + f);
+    }
+
+    for (std::string const &file : files) {
+        struct stat st;
+        if (stat(file.c_str(), &st) != 0) {
+            fprintf(stderr, "Cannot open %s\n", file.c_str());
+            continue;
+        }
+
+        // parsing the text and reading the binary cache, each as the median of several loads
+        for (int mode = 0; mode < 2; mode++) {
+            bool cached = mode == 1;
+            SetObjLoadHooks(cached);
+            if (cached) {
+                // the copy is written once the tree of the mesh is built
+                cy::TriMesh mesh;
+                mesh.LoadFromFileObj(file.c_str(), true, nullptr);
+                cy::BVHTriMesh bvh(&mesh);
+            }
+
+            const int runs = 9;
+            std::vector<double> ns(runs);
+            unsigned int numFaces = 0;
+            for (int r = 0; r < runs; r++) {
+                ns[r] = TimeNs(1, [&](long) {
+                    cy::TriMesh mesh;
+                    mesh.LoadFromFileObj(file.c_str(), true, nullptr);
+                    numFaces = mesh.NF();
+                    DoNotOptimize(numFaces);
+                });
+            }
+            std::nth_element(ns.begin(), ns.begin() + runs / 2, ns.end());
+            double median = ns[runs / 2];
+
+            char extra[128];
+            snprintf(extra, sizeof(extra), "%u triangles, %.1f MB/s of OBJ text", numFaces, double(st.st_size) / median * 1e3);
+            std::string name = std::string(cached ? "OBJ cache " : "OBJ parse ") + file.substr(file.find_last_of('/') + 1);
+            Report(name.c_str(), median, extra);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,128 @@
+// camera ray throughput traced one at a time and in packets of 4, 8 and 16 rays, for the
+// OBJ files shipped with the repository or given on the command line; each packet holds
+// jittered samples of one pixel, the same way the renderer forms packets
+
+#include "bench.h"
+#include "packet.h"
+
+#include <vector>
+#include <string>
+#include <random>
+#include <chrono>
+
+static char const *defaultFiles[] = {
+    "utah_teapot_res12.obj",
+    "ufo/ufo_body_hr.obj",
+    "ufo/ufo_dome_hr.obj",
+};
+
+// closest hit of a single ray, the same traversal as TriObj
+static bool trace( cy::BVH const &bvh, cy::TriMesh const &mesh, Ray const &ray, unsigned int nodeID, HitInfo &hInfo ) {
+    if (!RayBox(ray, bvh.GetNodeBounds(nodeID))) return false;
+
+    bool foundHit = false;
+    if (!bvh.IsLeafNode(nodeID)) {
+        if (trace(bvh, mesh, ray, bvh.GetFirstChildNode(nodeID), hInfo)) foundHit = true;
+        if (trace(bvh, mesh, ray, bvh.GetSecondChildNode(nodeID), hInfo)) foundHit = true;
+        return foundHit;
+    }
+    TriMeshTriangles tris{ &mesh };
+    unsigned int const *elements = bvh.GetNodeElements(nodeID);
+    for (unsigned int i = 0; i < bvh.GetNodeElementCount(nodeID); i++) {
+        Vec3f v0, v1, v2;
+        tris.Vertices(elements[i], v0, v1, v2);
+        TriangleHit hit;
+        if (RayTriangle(ray, v0, v1, v2, HIT_FRONT_AND_BACK, hInfo.z, hit)) {
+            tris.SetHitInfo(elements[i], hit, hInfo);
+            foundHit = true;
+        }
+    }
+    return foundHit;
+}
+
+int main( int argc, char **argv )
+{
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; i++) files.push_back(argv[i]);
+    if (files.empty()) {
+        for (char const *f : defaultFiles) files.push_back(std::string(BENCH_SCENE_DIR "/") + f);
+    }
+
+    const int resolution = 128;         // pixels on each side of the image
+    const int samplesPerPixel = 16;
+
+    for (std::string const &file : files) {
+        cy::TriMesh mesh;
+        if (!mesh.LoadFromFileObj(file.c_str(), false)) {
+            fprintf(stderr, "Cannot open %s\n", file.c_str());
+            continue;
+        }
+        if (!mesh.HasNormals()) mesh.ComputeNormals();
+        mesh.ComputeBoundingBox();
+        cy::BVHTriMesh bvh;
+        bvh.SetMesh(&mesh, 4);
+
+        // a pinhole camera looking at the mesh from the front, so that it fills most of the image
+        Vec3f center = (mesh.GetBoundMin() + mesh.GetBoundMax()) * 0.5f;
+        float extent = (mesh.GetBoundMax() - mesh.GetBoundMin()).Length();
+        Vec3f eye = center + Vec3f(0.3f, -1.5f, 0.5f) * extent;
+        Vec3f forward = (center - eye).GetNormalized();
+        Vec3f right = forward.Cross(Vec3f(0, 0, 1)).GetNormalized();
+        Vec3f up = right.Cross(forward);
+        float halfSize = 0.35f;
+
+        std::mt19937 rng(1234);
+        std::uniform_real_distribution<float> u(0, 1);
+        std::vector<Ray> rays;
+        rays.reserve(resolution * resolution * samplesPerPixel);
+        for (int j = 0; j < resolution; j++) {
+            for (int i = 0; i < resolution; i++) {
+                for (int s = 0; s < samplesPerPixel; s++) {
+                    float x = ((i + u(rng)) / resolution * 2 - 1) * halfSize;
+                    float y = ((j + u(rng)) / resolution * 2 - 1) * halfSize;
+                    rays.push_back(Ray(eye, (forward + right * x + up * y).GetNormalized()));
+                }
+            }
+        }
+
+        std::string name = file.substr(file.find_last_of('/') + 1);
+        fprintf(stdout, "%s: %u triangles, %zu camera rays\n", name.c_str(), mesh.NF(), rays.size());
+
+        // single rays are the reference for the hits of every packet size
+        std::vector<float> reference(rays.size());
+        auto start = std::chrono::steady_clock::now();
+        for (size_t r = 0; r < rays.size(); r++) {
+            HitInfo h;
+            trace(bvh, mesh, rays[r], bvh.GetRootNodeID(), h);
+            reference[r] = h.z;
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        char extra[96];
+        snprintf(extra, sizeof(extra), "%.2f Mrays/s", rays.size() / seconds * 1e-6);
+        Report(("single rays " + name).c_str(), seconds * 1e9 / rays.size(), extra);
+
+        TriMeshTriangles tris{ &mesh };
+        for (int size : { 4, 8, 16 }) {
+            int mismatches = 0;
+            HitInfo hits[PACKET_MAX_SIZE];
+            RayPacket packet;
+            packet.size = size;
+            for (int i = size; i < PACKET_MAX_SIZE; i++) packet.Set(i, Vec3f(0, 0, 0), Vec3f(1, 1, 1));
+
+            start = std::chrono::steady_clock::now();
+            for (size_t first = 0; first + size <= rays.size(); first += size) {
+                for (int i = 0; i < size; i++) {
+                    packet.Set(i, rays[first + i].p, rays[first + i].dir);
+                    hits[i].Init();
+                }
+                PacketTraversal<TriMeshTriangles>(bvh, tris, packet, hits, HIT_FRONT_AND_BACK).Trace(packet.FullMask());
+                for (int i = 0; i < size; i++) mismatches += hits[i].z != reference[first + i];
+            }
+            seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            snprintf(extra, sizeof(extra), "%.2f Mrays/s, %d hits differ from single rays", rays.size() / seconds * 1e-6, mismatches);
+            Report(("packets of " + std::to_string(size) + " " + name).c_str(), seconds * 1e9 / rays.size(), extra);
+        }
+    }
+    return 0;
+}
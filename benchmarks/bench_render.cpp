@@ -0,0 +1,292 @@
+// end to end renders of a fixed set of scenes at a fixed sample count: time, ray
+// throughput and peak memory of each render, and its error against a reference image
+// rendered earlier with many more samples, written to a JSON report so that builds can
+// be compared by the time they need to reach the same error
+//
+//   bench_render [--spp N] [--out DIR] [--refdir DIR] [--reference [--ref-spp N]] [scene.xml ...]
+//
+// Without scene files it renders small synthetic scenes written to the output directory
+// and scene.xml from the repository at a reduced resolution. The reference images are
+// kept in benchmarks/references, which is the default --refdir; a missing reference is
+// rendered there first, and --reference renders all of them again instead of comparing.
+
+#include "bench.h"
+#include "raytracer.h"
+#include "renderstats.h"
+#include "pfm.h"
+#include "tinyxml2.h"
+
+#include <vector>
+#include <string>
+#include <cmath>
+#include <thread>
+#include <chrono>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+Raytracer tracer(1, 1);
+SampleGenerator sampleGen = SampleGenerator::GetGenerator(4096);
+
+// scene.xml is rendered at this fraction of its resolution
+#define MAIN_SCENE_SCALE 0.25f
+
+struct BenchScene
+{
+    std::string name;
+    std::string file;       // absolute path
+};
+
+// what the render process sends back
+struct RenderResult
+{
+    bool ok = false;
+    int width = 0;
+    int height = 0;
+    double seconds = 0;
+    unsigned long long samples = 0;     // camera samples, every pixel takes the same number
+    unsigned long long rays = 0;        // zero unless the renderer counts them with RENDER_STATS
+    long peakKB = 0;
+};
+
+static std::string absolutePath( std::string const &path ) {
+    if (!path.empty() && path[0] == '/') return path;
+    char cwd[4096];
+    if (!getcwd(cwd, sizeof(cwd))) return path;
+    return std::string(cwd) + "/" + path;
+}
+
+// a floor, a diffuse and a glossy sphere, lit by two spherical lights
+static char const *spheresScene =
+    "    <object type=\"plane\" name=\"floor\" material=\"floor\"><scale value=\"20\"/></object>\n"
+    "    <object type=\"sphere\" name=\"left\" material=\"diffuse\"><scale value=\"0.8\"/><translate x=\"-1\" z=\"0.8\"/></object>\n"
+    "    <object type=\"sphere\" name=\"right\" material=\"glossy\"><scale value=\"0.8\"/><translate x=\"1\" z=\"0.8\"/></object>\n";
+
+static char const *teapotScene =
+    "    <object type=\"plane\" name=\"floor\" material=\"floor\"><scale value=\"20\"/></object>\n"
+    "    <object type=\"obj\" name=\"" BENCH_SCENE_DIR "/utah_teapot_res12.obj\" material=\"glossy\">\n"
+    "      <scale value=\"0.08\"/><rotate angle=\"-30\" z=\"1\"/>\n"
+    "    </object>\n";
+
+static char const *fogMedium =
+    "    <medium type=\"homogeneous\" name=\"fog\"><absorption value=\"0.08\"/><scattering value=\"0.12\"/></medium>\n";
+
+static char const *sharedItems =
+    "    <background value=\"0.1\"/>\n"
+    "    <environment value=\"0.2\"/>\n"
+    "    <material type=\"blinn\" name=\"floor\"><diffuse value=\"0.5\"/><specular value=\"0\"/></material>\n"
+    "    <material type=\"blinn\" name=\"diffuse\"><diffuse r=\"0.8\" g=\"0.3\" b=\"0.2\"/><specular value=\"0\"/></material>\n"
+    "    <material type=\"blinn\" name=\"glossy\"><diffuse value=\"0.1\"/><specular value=\"0.7\"/><glossiness value=\"200\"/></material>\n"
+    "    <light type=\"point\" name=\"key\"><intensity value=\"60\"/><position x=\"2\" y=\"-3\" z=\"4\"/><size value=\"0.5\"/><attenuation value=\"1\"/></light>\n"
+    "    <light type=\"point\" name=\"fill\"><intensity r=\"0.4\" g=\"0.5\" b=\"1\" value=\"20\"/><position x=\"-4\" y=\"-1\" z=\"2\"/><size value=\"1\"/><attenuation value=\"1\"/></light>\n";
+
+static bool writeSyntheticScene( std::string const &file, char const *objects, char const *media ) {
+    FILE *f = fopen(file.c_str(), "w");
+    if (!f) return false;
+    fprintf(f, "<xml>\n  <scene>\n%s%s%s  </scene>\n", objects, media, sharedItems);
+    fprintf(f, "  <camera>\n    <position x=\"0\" y=\"-6\" z=\"2\"/>\n    <target x=\"0\" y=\"0\" z=\"0.8\"/>\n"
+               "    <up x=\"0\" y=\"0\" z=\"1\"/>\n    <fov value=\"40\"/>\n    <width value=\"160\"/>\n    <height value=\"120\"/>\n  </camera>\n</xml>\n");
+    fclose(f);
+    return true;
+}
+
+// a copy of scene.xml with a smaller image, its relative paths still resolve from the scene directory
+static bool writeReducedScene( std::string const &source, std::string const &file ) {
+    tinyxml2::XMLDocument doc;
+    if (doc.LoadFile(source.c_str()) != tinyxml2::XML_SUCCESS) return false;
+    tinyxml2::XMLElement *xml = doc.FirstChildElement("xml");
+    tinyxml2::XMLElement *camera = xml ? xml->FirstChildElement("camera") : nullptr;
+    if (!camera) return false;
+    for (char const *dim : { "width", "height" }) {
+        tinyxml2::XMLElement *e = camera->FirstChildElement(dim);
+        if (e) e->SetAttribute("value", Max(1, int(e->IntAttribute("value") * MAIN_SCENE_SCALE)));
+    }
+    return doc.SaveFile(file.c_str()) == tinyxml2::XML_SUCCESS;
+}
+
+// render in a child process, so that every scene starts from an empty heap and reports
+// its own peak memory
+static RenderResult renderScene( BenchScene const &scene, int spp, std::string const &output ) {
+    RenderResult result;
+    int fds[2];
+    if (pipe(fds) != 0) return result;
+    // output still buffered would be written by the child too when it exits
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        // relative paths in the scenes are written for the scene directory
+        if (chdir(BENCH_SCENE_DIR) != 0) _exit(1);
+        Raytracer *r = new Raytracer(spp, spp);
+        RenderResult res;
+        if (r->LoadScene(scene.file.c_str())) {
+            auto start = std::chrono::steady_clock::now();
+            r->BeginRender();
+            while (r->IsRendering()) std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            res.width = r->GetRenderImage().GetWidth();
+            res.height = r->GetRenderImage().GetHeight();
+            res.samples = (unsigned long long)res.width * res.height * spp;
+#if RENDER_STATS
+            RenderStats stats = TotalRenderStats();
+            res.rays = stats.counters[STAT_RAYS] + stats.counters[STAT_SHADOW_RAYS];
+#endif
+            struct rusage usage;
+            getrusage(RUSAGE_SELF, &usage);
+            res.peakKB = usage.ru_maxrss;
+            std::vector<float> rgb(size_t(res.width) * res.height * 3);
+            for (size_t i = 0; i < rgb.size() / 3; i++) {
+                Color const &c = r->GetRadiance()[i];
+                rgb[i * 3 + 0] = c.r;
+                rgb[i * 3 + 1] = c.g;
+                rgb[i * 3 + 2] = c.b;
+            }
+            res.ok = SavePFM(output.c_str(), res.width, res.height, rgb.data());
+        }
+        ssize_t written = write(fds[1], &res, sizeof(res));
+#if BENCH_PROFILE
+        // an instrumented renderer writes its profile at exit, which _exit skips
+        exit(written == sizeof(res) ? 0 : 1);
+#else
+        _exit(written == sizeof(res) ? 0 : 1);
+#endif
+    }
+    close(fds[1]);
+    if (pid > 0) {
+        if (read(fds[0], &result, sizeof(result)) != sizeof(result)) result.ok = false;
+        waitpid(pid, nullptr, 0);
+    }
+    close(fds[0]);
+    return result;
+}
+
+// root mean squared error and relative mean squared error, which weighs errors in dark
+// regions like those in bright ones
+static bool imageError( std::string const &image, std::string const &reference, double &rmse, double &relMSE ) {
+    int w, h, rw, rh;
+    std::vector<float> a, b;
+    if (!LoadPFM(image.c_str(), w, h, a) || !LoadPFM(reference.c_str(), rw, rh, b)) return false;
+    if (w != rw || h != rh) {
+        fprintf(stderr, "%s is %dx%d, its reference is %dx%d\n", image.c_str(), w, h, rw, rh);
+        return false;
+    }
+    double se = 0, rel = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        double d = double(a[i]) - b[i];
+        se += d * d;
+        rel += d * d / (double(b[i]) * b[i] + 1e-2);
+    }
+    rmse = std::sqrt(se / a.size());
+    relMSE = rel / a.size();
+    return true;
+}
+
+int main( int argc, char **argv )
+{
+    int spp = 16;
+    int refSpp = 1024;
+    bool makeReferences = false;
+    std::string outDir = "render_bench";
+    std::string refDir;
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--spp" && i + 1 < argc) spp = atoi(argv[++i]);
+        else if (arg == "--ref-spp" && i + 1 < argc) refSpp = atoi(argv[++i]);
+        else if (arg == "--out" && i + 1 < argc) outDir = argv[++i];
+        else if (arg == "--refdir" && i + 1 < argc) refDir = argv[++i];
+        else if (arg == "--reference") makeReferences = true;
+        else files.push_back(absolutePath(arg));
+    }
+    // the sample tables hold 4096 entries
+    spp = Max(1, Min(spp, 4096));
+    refSpp = Max(1, Min(refSpp, 4096));
+    outDir = absolutePath(outDir);
+    refDir = refDir.empty() ? std::string(BENCH_REFERENCE_DIR) : absolutePath(refDir);
+    mkdir(outDir.c_str(), 0755);
+    mkdir(refDir.c_str(), 0755);
+
+    std::vector<BenchScene> scenes;
+    if (files.empty()) {
+        struct { char const *name; char const *objects; char const *media; } synthetic[] = {
+            { "spheres", spheresScene, "" },
+            { "teapot", teapotScene, "" },
+            { "fog", spheresScene, fogMedium },
+        };
+        for (auto const &s : synthetic) {
+            std::string file = outDir + "/" + s.name + ".xml";
+            if (writeSyntheticScene(file, s.objects, s.media)) scenes.push_back({ s.name, file });
+        }
+        std::string reduced = outDir + "/scene.xml";
+        if (writeReducedScene(BENCH_SCENE_DIR "/scene.xml", reduced)) scenes.push_back({ "scene", reduced });
+        else fprintf(stderr, "Cannot read %s\n", BENCH_SCENE_DIR "/scene.xml");
+    }
+    for (std::string const &file : files) {
+        size_t slash = file.find_last_of('/') + 1;
+        scenes.push_back({ file.substr(slash, file.find_last_of('.') - slash), file });
+    }
+
+    // with --reference every reference is rendered again, otherwise only the missing ones,
+    // except in the training run of a profile guided build, which only needs the renders
+    for (BenchScene const &s : scenes) {
+        std::string ref = refDir + "/" + s.name + ".pfm";
+        struct stat st;
+        if (!makeReferences && (BENCH_PROFILE || stat(ref.c_str(), &st) == 0)) continue;
+        RenderResult r = renderScene(s, refSpp, ref);
+        if (r.ok) fprintf(stdout, "reference %s: %d spp in %.1f s, %s\n", s.name.c_str(), refSpp, r.seconds, ref.c_str());
+        else fprintf(stderr, "Cannot render %s\n", s.name.c_str());
+    }
+    if (makeReferences) return 0;
+
+#if !RENDER_STATS
+    fprintf(stdout, "The renderer is built without RENDER_STATS, so rays are not counted; configure with\n"
+                    "-DRENDER_STATS=ON for Mrays/s, camera samples per second are reported either way\n");
+#endif
+
+    std::string reportFile = outDir + "/report.json";
+    FILE *report = fopen(reportFile.c_str(), "w");
+    if (!report) {
+        fprintf(stderr, "Cannot write %s\n", reportFile.c_str());
+        return 1;
+    }
+    fprintf(report, "{\n  \"spp\": %d,\n  \"scenes\": [", spp);
+
+    bool first = true;
+    for (BenchScene const &s : scenes) {
+        std::string image = outDir + "/" + s.name + ".pfm";
+        RenderResult r = renderScene(s, spp, image);
+        if (!r.ok) {
+            fprintf(stderr, "Cannot render %s\n", s.name.c_str());
+            continue;
+        }
+        double rmse = 0, relMSE = 0;
+        bool hasError = imageError(image, refDir + "/" + s.name + ".pfm", rmse, relMSE);
+        double msamples = r.seconds > 0 ? r.samples / r.seconds * 1e-6 : 0;
+        double mrays = r.seconds > 0 ? r.rays / r.seconds * 1e-6 : 0;
+
+        char size[32];
+        snprintf(size, sizeof(size), "%dx%d", r.width, r.height);
+        fprintf(stdout, "%-12s %-10s %8.2f s  %7.3f Msamples/s", s.name.c_str(), size, r.seconds, msamples);
+        if (RENDER_STATS) fprintf(stdout, "  %7.2f Mrays/s", mrays);
+        fprintf(stdout, "  %8.1f MB peak", r.peakKB / 1024.0);
+        if (hasError) fprintf(stdout, "  RMSE %.4g  relMSE %.4g\n", rmse, relMSE);
+        else fprintf(stdout, "  no reference\n");
+
+        // with Monte Carlo noise the error falls as one over the time spent, so time times
+        // error stays the same for a build and is lower for a faster or less noisy one
+        fprintf(report, "%s\n    {\n      \"name\": \"%s\",\n      \"width\": %d,\n      \"height\": %d,\n"
+                        "      \"seconds\": %.6f,\n      \"samples\": %llu,\n      \"msamples_per_second\": %.4f,\n      \"peak_rss_mb\": %.2f",
+                first ? "" : ",", s.name.c_str(), r.width, r.height, r.seconds, r.samples, msamples, r.peakKB / 1024.0);
+        if (RENDER_STATS) fprintf(report, ",\n      \"rays\": %llu,\n      \"mrays_per_second\": %.4f", r.rays, mrays);
+        if (hasError) fprintf(report, ",\n      \"rmse\": %.6g,\n      \"relmse\": %.6g,\n      \"seconds_x_relmse\": %.6g",
+                              rmse, relMSE, r.seconds * relMSE);
+        fprintf(report, "\n    }");
+        first = false;
+    }
+    fprintf(report, "\n  ]\n}\n");
+    fclose(report);
+    fprintf(stdout, "Report written to %s\n", reportFile.c_str());
+    return 0;
+}
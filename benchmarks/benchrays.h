@@ -0,0 +1,31 @@
+#ifndef _BENCHRAYS_H_INCLUDED_
+#define _BENCHRAYS_H_INCLUDED_
+
+#include "scene.h"
+
+#include <vector>
+#include <random>
+#include <cmath>
+
+// rays from a sphere around a box towards random points inside it
+inline std::vector<Ray> RandomRays( Box const &box, int count, unsigned int seed = 1234 ) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> u(0, 1);
+    Vec3f center = (box.pmin + box.pmax) * 0.5f;
+    float radius = (box.pmax - box.pmin).Length();
+
+    std::vector<Ray> rays(count);
+    for (Ray &r : rays) {
+        float z = 2 * u(rng) - 1;
+        float phi = 2 * float(M_PI) * u(rng);
+        float s = sqrtf(1 - z * z);
+        r.p = center + radius * Vec3f(s * cosf(phi), s * sinf(phi), z);
+        Vec3f target(box.pmin.x + u(rng) * (box.pmax.x - box.pmin.x),
+                     box.pmin.y + u(rng) * (box.pmax.y - box.pmin.y),
+                     box.pmin.z + u(rng) * (box.pmax.z - box.pmin.z));
+        r.dir = (target - r.p).GetNormalized();
+    }
+    return rays;
+}
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef _BLINNEVAL_H_INCLUDED_
+#define _BLINNEVAL_H_INCLUDED_
+
+#include "materials.h"
+
+// every texture channel and lobe probability a Blinn material needs at one shading point
+struct BlinnEval
+{
+    Color diffuse;
+    Color specular;
+    Color refraction;
+    Color emission;
+    float gloss;
+
+    // probabilities of sampling the diffuse, reflection and transmission lobes
+    float dPow, rPow, tPow;
+
+    // footprint selects the MIP level of image textures, see mipmap.h
+    void Compute( MtlBlinn const &mtl, Vec3f const &uvw, float footprint = 0 );
+};
+
+// the evaluation record of a material at a texture coordinate, reused by this thread
+// for as long as it keeps shading the same point
+BlinnEval const& GetBlinnEval( MtlBlinn const &mtl, Vec3f const &uvw );
+
+// drop this thread's cached record so the next request recomputes it
+void InvalidateBlinnEval();
+
+// number of texture channel evaluations made by this thread
+unsigned long long BlinnEvalLookups();
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef _COMPACTMESH_H_INCLUDED_
+#define _COMPACTMESH_H_INCLUDED_
+
+#include "scene.h"
+#include "cyTriMesh.h"
+#include "cyBVH.h"
+#include "intersect.h"
+#include "tinyxml2.h"
+
+#include <vector>
+#include <cstdint>
+
+class TriObj;
+
+// memory used by the nodes and element indices of a tree
+size_t BVHBytes( cy::BVH const &bvh );
+
+// a vertex of a compact mesh, 16 bytes so that four of them share a cache line
+struct CompactVertex
+{
+    uint16_t pos[3];    // position quantized to the mesh bounds
+    uint16_t uv[2];     // half float texture coordinates
+    int16_t normal[2];  // octahedral encoded normal
+    uint16_t pad;
+};
+
+// a triangle mesh with quantized vertices and one index buffer shared by positions,
+// normals and texture coordinates, for meshes too large to keep as TriMesh arrays
+class CompactMesh : public Object
+{
+private:
+    // bounding volume hierarchy over the decoded positions
+    class Hierarchy : public cy::BVH
+    {
+    public:
+        CompactMesh const *mesh = nullptr;
+    protected:
+        void GetElementBounds( unsigned int i, float box[6] ) const override;
+        float GetElementCenter( unsigned int i, int dim ) const override;
+    };
+
+    Vec3f boundMin, boundMax;
+    Vec3f step;                             // size of one quantization step on each axis
+    std::vector<CompactVertex> vertices;
+    std::vector<uint32_t> indices;          // three vertices per face
+    Hierarchy bvh;
+
+public:
+    // convert a mesh, texture coordinates keep only u and v
+    void Build( cy::TriMesh const &mesh );
+
+    bool IntersectRay( Ray const &ray, HitInfo &hInfo, int hitSide=HIT_FRONT ) const override;
+    Box GetBoundBox() const override { return Box(boundMin, boundMax); }
+
+    unsigned int NV() const { return (unsigned int)vertices.size(); }
+    unsigned int NF() const { return (unsigned int)indices.size() / 3; }
+    size_t MemoryBytes() const { return vertices.size() * sizeof(CompactVertex) + indices.size() * sizeof(uint32_t) + BVHBytes(bvh); }
+
+    Vec3f Position( unsigned int v ) const {
+        uint16_t const *q = vertices[v].pos;
+        return Vec3f(boundMin.x + q[0] * step.x, boundMin.y + q[1] * step.y, boundMin.z + q[2] * step.z);
+    }
+    Vec3f Normal( unsigned int v ) const;
+    Vec3f TexCoord( unsigned int v ) const;
+    uint32_t const* Face( unsigned int f ) const { return &indices[size_t(f) * 3]; }
+    cy::BVH const& GetBVH() const { return bvh; }
+
+    // fill the hit information of a ray that crossed a face
+    void SetHitInfo( unsigned int faceID, TriangleHit const &hit, HitInfo &hInfo ) const;
+
+private:
+    bool intersectTriangle( Ray const &ray, HitInfo &hInfo, int hitSide, unsigned int faceID ) const;
+    bool traceNode( Ray const &ray, HitInfo &hInfo, int hitSide, unsigned int nodeID ) const;
+};
+
+// memory of the meshes replaced by compact meshes
+struct CompactStats
+{
+    int meshes = 0;
+    unsigned long long faces = 0;
+    size_t bytesBefore = 0;     // arrays and trees of the original meshes
+    size_t bytesAfter = 0;
+};
+
+// read the <compactmesh> element of the <scene> element, which may be null, and replace every
+// mesh with at least its "minfaces" triangles by a compact copy, the compact meshes are added
+// to the list; replaced meshes found in ownedMeshes are deleted and removed from it, the
+// others are owned by the scene loader and only give up their arrays
+CompactStats CompactMeshes( tinyxml2::XMLElement const *sceneElem, Node &rootNode, std::vector<CompactMesh*> &meshes,
+                            std::vector<TriObj*> &ownedMeshes );
+
+// memory used by the arrays of a mesh and by the tree ObjMeshTree finds for it
+size_t TriMeshBytes( cy::TriMesh const &mesh );
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef _COSTMAP_H_INCLUDED_
+#define _COSTMAP_H_INCLUDED_
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+namespace tinyxml2 { class XMLElement; }
+
+// render time and rays traced of every pixel, saved as a false color PNG and as a
+// float image so the expensive parts of a frame can be found
+class CostMap
+{
+private:
+    int width = 0;
+    int height = 0;
+    std::vector<float> seconds;     // thread time spent on each pixel
+    std::vector<uint32_t> rays;     // closest hit and shadow rays traced for each pixel
+
+    std::string pngFile;            // false color image, empty when not saved
+    std::string pfmFile;            // float image, empty when not saved
+    bool showRays = false;          // the PNG shows rays instead of time
+
+public:
+    // read the <costmap> element of the <scene> element, which may be null, whose "png" and
+    // "pfm" attributes name the files to write and whose "measure" attribute is "time" or "rays"
+    bool LoadSettings( tinyxml2::XMLElement const *sceneElem );
+
+    bool IsEnabled() const { return !pngFile.empty() || !pfmFile.empty(); }
+
+    // clear the buffers for a render of the given size
+    void Init( int w, int h );
+
+    // each pixel is recorded by the thread that rendered it
+    void Record( int index, float pixelSeconds, uint32_t pixelRays ) {
+        seconds[index] = pixelSeconds;
+        rays[index] = pixelRays;
+    }
+
+    // write the requested files
+    bool Save() const;
+
+    // pixels colored from blue to red by their cost, scaled so that the 99th percentile is red
+    bool SavePNG( char const *filename, bool byRays ) const;
+
+    // three channel PFM holding microseconds, rays and zero for every pixel
+    bool SavePFM( char const *filename ) const;
+};
+
+#endif
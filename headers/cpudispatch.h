@@ -0,0 +1,26 @@
+#ifndef _CPUDISPATCH_H_INCLUDED_
+#define _CPUDISPATCH_H_INCLUDED_
+
+// functions marked CPU_DISPATCH are compiled once per instruction set below and the loader
+// picks the widest one the host supports, so a single binary runs the AVX-512 or AVX2
+// versions where they exist; build with -DRENDER_CPU_DISPATCH=0 for one baseline version.
+// Everything they call is inlined into each version, which is why the BVH traversals that
+// carry the mark walk the tree from a stack instead of recursing.
+// AVX-512 includes FMA, so CMake builds with -ffp-contract=off to keep multiplies and adds
+// apart; every version then rounds the same way and images do not change from one machine
+// to another
+#ifndef RENDER_CPU_DISPATCH
+#define RENDER_CPU_DISPATCH 1
+#endif
+
+#if RENDER_CPU_DISPATCH && defined(__x86_64__) && defined(__linux__) && defined(__has_attribute)
+#if __has_attribute(target_clones)
+#define CPU_DISPATCH __attribute__((target_clones("avx512f", "avx2", "sse4.2", "default"), flatten))
+#endif
+#endif
+
+#ifndef CPU_DISPATCH
+#define CPU_DISPATCH
+#endif
+
+#endif
@@ -36,6 +36,12 @@
 #ifndef _CY_BVH_H_INCLUDED_
 #define _CY_BVH_H_INCLUDED_
 
+//-------------------------------------------------------------------------------
+
+#include <cstring>
+#include <new>
+#include <vector>
+
 //-------------------------------------------------------------------------------
 namespace cy {
 //-------------------------------------------------------------------------------
@@ -56,6 +62,9 @@ namespace cy {
 #define _CY_BVH_ELEMENT_OFFSET_BITS	(_CY_BVH_NODE_DATA_BITS-1-CY_BVH_ELEMENT_COUNT_BITS)
 #define _CY_BVH_ELEMENT_OFFSET_MASK	((1<<_CY_BVH_ELEMENT_OFFSET_BITS)-1)
 
+#define _CY_BVH_NODE_SIZE			32	//!< Nodes are padded to 32 bytes, so that two sibling nodes fill one 64 byte cache line
+#define _CY_BVH_NODE_PAIR_ALIGN		64	//!< Alignment of the node array
+
 //-------------------------------------------------------------------------------
 
 //! Bounding Volume Hierarchy class
@@ -65,7 +74,7 @@ class BVH
 public:
 
 	//!@name Constructor and destructor
-	BVH() : nodes(0), elements(0) {}
+	BVH() : nodes(0), elements(0), nodeCount(0), elementCount(0) {}
 	virtual ~BVH() { Clear(); }
 
 	/////////////////////////////////////////////////////////////////////////////////
@@ -112,10 +121,11 @@ public:
 	//! Clears the tree structure
 	void Clear()
 	{
-		if (nodes) delete [] nodes;
-		nodes = 0;
+		FreeNodes();
 		if (elements) delete [] elements;
 		elements = 0;
+		nodeCount = 0;
+		elementCount = 0;
 	}
 
 	//! Builds the tree structure by recursively splitting the nodes. maxElementsPerNode cannot be larger than 8.
@@ -133,12 +143,48 @@ public:
 			GetElementBounds(i,b.b);
 			box += b;
 		}
-		TempNode *tempRoot = new TempNode( numElements, 0, box );
-		SplitTempNode(tempRoot,maxElementsPerNode);
+		// the temporary nodes are kept in one array, a tree of n elements has at most 2n-1 nodes
+		std::vector<TempNode> tempNodes;
+		tempNodes.reserve( 2*numElements );
+		tempNodes.emplace_back( numElements, 0, box );
+		TempNode *tempRoot = &tempNodes[0];
+		SplitTempNode(tempRoot,maxElementsPerNode,tempNodes);
 		unsigned int numNodes = tempRoot->GetNumNodes();
-		nodes = new Node[ numNodes+1 ];
+		AllocateNodes( numNodes+1 );
 		ConvertTempData( 1, tempRoot, 2 );
-		delete tempRoot;
+		nodeCount = numNodes+1;
+		elementCount = numElements;
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////
+	//@ Raw Data Access Methods
+	/////////////////////////////////////////////////////////////////////////////////
+
+	static size_t        NodeSize       () { return sizeof(Node); }	//!< Returns the size of a node in bytes.
+	unsigned int         GetNumNodes    () const { return nodeCount; }		//!< Returns the number of nodes, including the unused node 0.
+	unsigned int         GetNumElements () const { return elementCount; }	//!< Returns the number of element indices.
+	void const *         GetNodeData    () const { return nodes; }			//!< Returns the raw node array, for storing the tree in a file.
+	unsigned int const * GetElementData () const { return elements; }		//!< Returns the element index array, for storing the tree in a file.
+
+	//! Copies a tree that was previously stored using the raw data access methods.
+	void SetRawData( void const *nodeData, unsigned int numNodes, unsigned int const *elementData, unsigned int numElements )
+	{
+		Clear();
+		if ( numNodes == 0 ) return;
+		AllocateNodes( numNodes );
+		memcpy( static_cast<void*>(nodes), nodeData, sizeof(Node)*numNodes );
+		elements = new unsigned int[numElements];
+		memcpy( elements, elementData, sizeof(unsigned int)*numElements );
+		nodeCount = numNodes;
+		elementCount = numElements;
+	}
+
+	//! Replaces every element index by its position in the element array, so that the
+	//! elements of a leaf node are consecutive. The caller must have reordered its elements
+	//! to match GetElementData() before calling this method.
+	void SetSequentialElements()
+	{
+		for ( unsigned int i=0; i<elementCount; i++ ) elements[i] = i;
 	}
 
 	/////////////////////////////////////////////////////////////////////////////////
@@ -184,7 +230,10 @@ private:
 		void operator += ( Box const &box ) { for(int i=0; i<3; i++) { if(b[i]>box.b[i])b[i]=box.b[i]; if(b[i+3]<box.b[i+3])b[i+3]=box.b[i+3]; } }
 	};
 
-	class Node
+	//! A node is padded to 32 bytes and the node array starts at a 64 byte boundary.
+	//! Since nodes[0] is not used, the two children of a node, which are always stored
+	//! next to each other starting at an even index, share one cache line.
+	class alignas(_CY_BVH_NODE_SIZE) Node
 	{
 	public:
 		void SetLeafNode( Box const &bound, unsigned int elemCount, unsigned int elemOffset ) { box=bound; data=(elemOffset&_CY_BVH_ELEMENT_OFFSET_MASK)|((elemCount-1)<<_CY_BVH_ELEMENT_OFFSET_BITS)|_CY_BVH_LEAF_BIT_MASK; }
@@ -198,25 +247,43 @@ private:
 		Box          box;	//!< bounding box of the node
 		unsigned int data;	//!< node data bits that keep the leaf node flag and the child node index or element count and element offset.
 	};
+	static_assert( sizeof(Node) == _CY_BVH_NODE_SIZE, "BVH nodes must be 32 bytes" );
 
 	Node         *nodes;	//!< the tree structure that keeps all the node data (nodeData[0] is not used for cache coherency)
 	unsigned int *elements;	//!< indices of all elements in all nodes
+	unsigned int  nodeCount;	//!< number of nodes, including nodes[0]
+	unsigned int  elementCount;	//!< number of element indices
+
+	//! Allocates the node array on a cache line boundary.
+	void AllocateNodes( unsigned int numNodes )
+	{
+		void *mem = ::operator new[]( sizeof(Node)*numNodes, std::align_val_t(_CY_BVH_NODE_PAIR_ALIGN) );
+		nodes = static_cast<Node*>(mem);
+		for ( unsigned int i=0; i<numNodes; i++ ) new (&nodes[i]) Node();
+	}
+	void FreeNodes()
+	{
+		if (nodes) ::operator delete[]( nodes, std::align_val_t(_CY_BVH_NODE_PAIR_ALIGN) );
+		nodes = 0;
+	}
 
 	/////////////////////////////////////////////////////////////////////////////////
 	//@ Internal methods for building the BVH tree
 	/////////////////////////////////////////////////////////////////////////////////
 
 	//! Temporary node class used for building the hierarchy and then converted to NodeData.
+	//! Nodes live in one array that is reserved up front, so the child pointers remain valid.
 	class TempNode
 	{
 	public:
 		TempNode( unsigned int count, unsigned int offset, Box const &boundBox) : child1(0), child2(0), elementCount(count), elementOffset(offset), box(boundBox) {}
-		~TempNode() { if ( child1 ) delete child1; if ( child2 ) delete child2; }
 
-		void Split( unsigned int child1ElementCount, Box const &child1Box, Box const &child2Box )
+		void Split( std::vector<TempNode> &nodes, unsigned int child1ElementCount, Box const &child1Box, Box const &child2Box )
 		{
-			child1 = new TempNode(child1ElementCount,elementOffset,child1Box);
-			child2 = new TempNode(ElementCount()-child1ElementCount,elementOffset+child1ElementCount,child2Box);
+			nodes.emplace_back(child1ElementCount,elementOffset,child1Box);
+			child1 = &nodes.back();
+			nodes.emplace_back(ElementCount()-child1ElementCount,elementOffset+child1ElementCount,child2Box);
+			child2 = &nodes.back();
 		}
 		unsigned int GetNumNodes() const
 		{
@@ -239,7 +306,7 @@ private:
 	};
 
 	//! Recursively splits the given temporary node.
-	void SplitTempNode(TempNode *tNode, unsigned int maxElementsPerNode)
+	void SplitTempNode(TempNode *tNode, unsigned int maxElementsPerNode, std::vector<TempNode> &nodes)
 	{
 		float const *box = tNode->GetBounds().b;
 		unsigned int *nodeElements = &elements[tNode->ElementOffset()];
@@ -272,12 +339,14 @@ private:
 		}
 
 		// Split recursively
-		tNode->Split( child1ElemCount, child1Box, child2Box );
-		SplitTempNode(tNode->GetChild1(),maxElementsPerNode);
-		SplitTempNode(tNode->GetChild2(),maxElementsPerNode);
+		tNode->Split( nodes, child1ElemCount, child1Box, child2Box );
+		SplitTempNode(tNode->GetChild1(),maxElementsPerNode,nodes);
+		SplitTempNode(tNode->GetChild2(),maxElementsPerNode,nodes);
 	}
 
 	//! Recursively converts the temporary node data to NodeData.
+	//! Sibling pairs are stored in depth-first order, so that the pair of a node's children
+	//! is followed by the pairs of the first child's subtree before those of the second.
 	unsigned int ConvertTempData( unsigned int nodeID, TempNode *tNode, unsigned int childIndex )
 	{
 		if ( tNode->IsLeafNode() ) {
@@ -348,7 +417,34 @@ public:
 	{
 		mesh = m;
 		Clear();
+		if ( maxElementsPerNode > CY_BVH_MAX_ELEMENT_COUNT ) maxElementsPerNode = CY_BVH_MAX_ELEMENT_COUNT;
+		BuildHooks const &hooks = Hooks();
+		if ( hooks.load && hooks.load( *this, mesh, maxElementsPerNode ) ) return;
 		Build(mesh->NF(),maxElementsPerNode);
+		if ( hooks.built ) hooks.built( *this, mesh, maxElementsPerNode );
+	}
+
+	//!@name Build hooks
+	//! Optional functions that applications can set to store the trees of meshes.
+	struct BuildHooks
+	{
+		//! Called by SetMesh instead of building the tree. If it returns true, it has set the tree using SetRawData.
+		bool (*load)( BVHTriMesh &bvh, TriMesh const *mesh, unsigned int maxElementsPerNode ) = nullptr;
+		//! Called by SetMesh after building the tree.
+		void (*built)( BVHTriMesh const &bvh, TriMesh const *mesh, unsigned int maxElementsPerNode ) = nullptr;
+	};
+	static BuildHooks& Hooks() { static BuildHooks hooks; return hooks; }
+
+	//! Reorders the faces of the mesh of this tree, so that the faces of each leaf node are
+	//! consecutive in memory, and updates the element indices to match. The given pointer must
+	//! be the mesh passed to SetMesh. Meshes with more than one material are not changed, since
+	//! the faces of each material must remain consecutive. Returns true if the faces were reordered.
+	bool ReorderFaces( TriMesh *m )
+	{
+		if ( m != mesh || m->NM() > 1 || GetNumElements() != m->NF() ) return false;
+		m->ReorderFaces( GetElementData() );
+		SetSequentialElements();
+		return true;
 	}
 
 protected:
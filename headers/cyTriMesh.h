@@ -38,7 +38,22 @@
 
 #include "cyVector.h"
 #include <vector>
+#include <string>
+#include <charconv>
+#include <cstdio>
 #include <iostream>
+#ifndef _WIN32
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+#endif
+
+//-------------------------------------------------------------------------------
+
+#ifndef CY_OBJ_MIN_CHUNK_SIZE
+#define CY_OBJ_MIN_CHUNK_SIZE (1<<18)	//!< Smallest part of an OBJ file parsed as a separate chunk
+#endif
 
 //-------------------------------------------------------------------------------
 
@@ -179,11 +194,32 @@ public:
 	//!@name Compute Methods
 	void ComputeBoundingBox();						//!< Computes the bounding box
 	void ComputeNormals(bool clockwise=false);		//!< Computes and stores vertex normals
+	void ReorderFaces(unsigned int const *order);	//!< Reorders the faces, such that the i^th face is the order[i]^th face of the current order. The material face counts are not changed, so the faces of different materials must not be mixed.
 
 	//!@name Load and Save methods
 	bool LoadFromFileObj( char const *filename, bool loadMtl=true, std::ostream *outStream=&std::cout );	//!< Loads the mesh from an OBJ file. Automatically converts all faces to triangles.
 	bool SaveToFileObj( char const *filename, std::ostream *outStream );									//!< Saves the mesh to an OBJ file with the given name.
 
+	//! Sets the cumulative face count of the given material, which is the index of the face after its last face.
+	void SetMaterialCumulativeFaceCount( int mtlID, int count ) { mcfc[mtlID] = count; }
+	//! Loads the materials of the mesh from the given .mtl files, which are relative to the OBJ file.
+	//! The mesh must already have a material for each name in mtlNames, in the same order.
+	void LoadMtlFiles( char const *filename, std::vector<std::string> const &mtlFiles, std::vector<std::string> const &mtlNames, std::ostream *outStream );
+
+	//!@name Load hooks
+	//! Optional functions that applications can set to store loaded meshes and to parse the chunks of OBJ files in parallel.
+	struct LoadHooks
+	{
+		//! Called by LoadFromFileObj after clearing the mesh. If it returns true, it has filled the mesh, and the OBJ file is not parsed.
+		bool (*load)( TriMesh &mesh, char const *filename, bool loadMtl, std::ostream *outStream ) = nullptr;
+		//! Called by LoadFromFileObj after parsing an OBJ file, with the mtllib file names and the material names in material order.
+		void (*parsed)( TriMesh const &mesh, char const *filename, bool loadMtl, std::vector<std::string> const &mtlFiles, std::vector<std::string> const &mtlNames ) = nullptr;
+		//! Calls func(i,data) for every i<count, possibly in parallel. Without it, the chunks are parsed one after another.
+		void (*parallelFor)( unsigned int count, void (*func)(unsigned int i, void *data), void *data ) = nullptr;
+		unsigned int maxChunks = 1;	//!< The largest number of chunks an OBJ file is split into.
+	};
+	static LoadHooks& Hooks() { static LoadHooks hooks; return hooks; }
+
 private:
 	template <class T> void Allocate( unsigned int n, T* &t ) { if (t) delete [] t; if (n>0) t = new T[n]; else t=nullptr; }
 	template <class T> bool Allocate( unsigned int n, T* &t, unsigned int &nt ) { if (n==nt) return false; nt=n; Allocate(n,t); return true; }
@@ -200,6 +236,243 @@ private:
 		MtlData() { faceCount=0; firstFace=0; }
 	};
 	struct MtlLibName { std::string filename; };
+
+	// Read-only view of a whole OBJ file, memory-mapped where possible
+	class ObjFileData
+	{
+		char const *data = nullptr;
+		size_t size = 0;
+#ifdef _WIN32
+		std::vector<char> buffer;
+#endif
+	public:
+		~ObjFileData() { Close(); }
+		bool Open( char const *filename )
+		{
+#ifdef _WIN32
+			FILE *fp = fopen(filename,"rb");
+			if ( !fp ) return false;
+			fseek(fp,0,SEEK_END);
+			buffer.resize((size_t)ftell(fp));
+			fseek(fp,0,SEEK_SET);
+			size = fread(buffer.data(),1,buffer.size(),fp);
+			fclose(fp);
+			data = buffer.data();
+			return true;
+#else
+			int fd = open(filename,O_RDONLY);
+			if ( fd < 0 ) return false;
+			struct stat st;
+			if ( fstat(fd,&st) != 0 ) { close(fd); return false; }
+			size = (size_t)st.st_size;
+			if ( size > 0 ) {
+				void *p = mmap(nullptr,size,PROT_READ,MAP_PRIVATE,fd,0);
+				if ( p == MAP_FAILED ) { close(fd); return false; }
+				madvise(p,size,MADV_SEQUENTIAL);
+				data = static_cast<char const*>(p);
+			}
+			close(fd);
+			return true;
+#endif
+		}
+		void Close()
+		{
+#ifndef _WIN32
+			if ( data ) munmap(const_cast<char*>(data),size);
+#endif
+			data = nullptr;
+			size = 0;
+		}
+		char const * Data() const { return data; }
+		size_t Size() const { return size; }
+	};
+
+	// Consecutive faces that share a material and their position in the final face array
+	struct ObjRun
+	{
+		unsigned int firstFace;
+		int mtl;
+		unsigned int target;
+	};
+
+	// Final arrays the OBJ chunks are parsed into
+	struct ObjTarget
+	{
+		Vec3f *v, *vt, *vn;
+		TriFace *f, *ft, *fn;
+		ObjRun const *runs;
+		unsigned int numRuns;
+	};
+
+	// A part of an OBJ file that ends at a line break
+	struct ObjChunk
+	{
+		struct Command
+		{
+			unsigned int face;	// faces of the chunk before the command
+			bool isMtlLib;		// mtllib or usemtl
+			std::string name;
+		};
+		char const *begin = nullptr, *end = nullptr;
+		unsigned int nv=0, nvt=0, nvn=0, nf=0;		// components in this chunk
+		unsigned int v0=0, vt0=0, vn0=0, f0=0;		// components before this chunk
+		std::vector<Command> commands;
+
+		static bool IsSpace( char c ) { return c==' ' || c=='\t' || c=='\v' || c=='\f'; }
+		bool IsLineEnd( char const *p ) const { return p>=end || *p=='\n' || *p=='\r' || *p=='\0'; }
+		char const * SkipSpace( char const *p ) const { while ( p<end && IsSpace(*p) ) p++; return p; }
+		char const * NextLine( char const *p ) const
+		{
+			while ( !IsLineEnd(p) ) p++;
+			while ( p<end && IsLineEnd(p) ) p++;
+			return p;
+		}
+		bool IsCommand( char const *p, char const *cmd ) const
+		{
+			while ( *cmd ) {
+				if ( p>=end || *p!=*cmd ) return false;
+				p++; cmd++;
+			}
+			return IsLineEnd(p) || IsSpace(*p);
+		}
+		// the rest of the line with runs of white space replaced by a single space
+		std::string ReadName( char const *p ) const
+		{
+			std::string s;
+			p = SkipSpace(p);
+			while ( !IsLineEnd(p) ) {
+				if ( IsSpace(*p) ) {
+					p = SkipSpace(p);
+					if ( !IsLineEnd(p) ) s += ' ';
+				} else s += *p++;
+			}
+			return s;
+		}
+		// number of vertices of a face line
+		int CountFaceVerts( char const *p ) const
+		{
+			int n = 0;
+			while ( true ) {
+				p = SkipSpace(p);
+				if ( IsLineEnd(p) ) return n;
+				n++;
+				while ( !IsLineEnd(p) && !IsSpace(*p) ) p++;
+			}
+		}
+		static unsigned int FaceTriangles( int verts ) { return verts >= 3 ? verts-2 : ( verts > 0 ? 1 : 0 ); }
+
+		void Count()
+		{
+			for ( char const *p=begin; p<end; p=NextLine(p) ) {
+				p = SkipSpace(p);
+				if ( p>=end ) break;
+				switch ( *p ) {
+					case 'v':
+						if      ( IsCommand(p,"v" ) ) nv++;
+						else if ( IsCommand(p,"vt") ) nvt++;
+						else if ( IsCommand(p,"vn") ) nvn++;
+						break;
+					case 'f':
+						if ( IsCommand(p,"f") ) nf += FaceTriangles( CountFaceVerts(p+1) );
+						break;
+					case 'u':
+						if ( IsCommand(p,"usemtl") ) commands.push_back( Command{ nf, false, ReadName(p+6) } );
+						break;
+					case 'm':
+						if ( IsCommand(p,"mtllib") ) commands.push_back( Command{ nf, true, ReadName(p+6) } );
+						break;
+				}
+			}
+		}
+
+		char const * ReadVertex( char const *p, Vec3f &vert ) const
+		{
+			vert.Zero();
+			for ( int i=0; i<3; i++ ) {
+				p = SkipSpace(p);
+				if ( IsLineEnd(p) ) break;
+				if ( *p == '+' ) p++;
+				std::from_chars_result r = std::from_chars(p,end,vert[i]);
+				if ( r.ec != std::errc() ) break;
+				p = r.ptr;
+			}
+			return p;
+		}
+		// one vertex of a face, "v", "v/t", "v//n" or "v/t/n"
+		char const * ReadFaceVert( char const *p, unsigned int count[3], unsigned int index[3] ) const
+		{
+			for ( int type=0; type<3; type++ ) {
+				index[type] = 0;
+				if ( type > 0 ) {
+					if ( IsLineEnd(p) || *p != '/' ) continue;
+					p++;
+				}
+				bool negative = ( p<end && *p=='-' );
+				if ( negative ) p++;
+				unsigned int i = 0;
+				std::from_chars_result r = std::from_chars(p,end,i);
+				if ( r.ec == std::errc() ) {
+					p = r.ptr;
+					index[type] = negative ? count[type]-i : i-1;
+				}
+			}
+			while ( !IsLineEnd(p) && !IsSpace(*p) ) p++;
+			return p;
+		}
+
+		void Parse( ObjTarget &t ) const
+		{
+			unsigned int count[3] = { v0, vt0, vn0 };	// vertices, texture vertices and normals read so far
+			unsigned int face = f0;
+			unsigned int run = 0;
+			while ( run+1 < t.numRuns && t.runs[run+1].firstFace <= face ) run++;
+
+			auto addFace = [&]( TriFace const &fv, TriFace const &ftv, TriFace const &fnv ) {
+				while ( run+1 < t.numRuns && t.runs[run+1].firstFace <= face ) run++;
+				unsigned int i = t.runs[run].target + ( face - t.runs[run].firstFace );
+				t.f[i] = fv;
+				if ( t.ft ) t.ft[i] = ftv;
+				if ( t.fn ) t.fn[i] = fnv;
+				face++;
+			};
+
+			for ( char const *p=begin; p<end; p=NextLine(p) ) {
+				p = SkipSpace(p);
+				if ( p>=end ) break;
+				if ( *p == 'v' ) {
+					if      ( IsCommand(p,"v" ) ) ReadVertex(p+1, t.v [count[0]++]);
+					else if ( IsCommand(p,"vt") ) ReadVertex(p+2, t.vt[count[1]++]);
+					else if ( IsCommand(p,"vn") ) ReadVertex(p+2, t.vn[count[2]++]);
+				}
+				else if ( *p == 'f' && IsCommand(p,"f") ) {
+					// triangulate as a fan around the first vertex
+					TriFace fv, ftv, fnv;
+					for ( int j=0; j<3; j++ ) fv.v[j] = ftv.v[j] = fnv.v[j] = 0;
+					int nverts = 0;
+					p++;
+					while ( true ) {
+						p = SkipSpace(p);
+						if ( IsLineEnd(p) ) break;
+						unsigned int index[3];
+						p = ReadFaceVert(p, count, index);
+						int j = nverts < 2 ? nverts : 2;
+						if ( nverts >= 3 ) {
+							addFace(fv,ftv,fnv);
+							fv.v[1] = fv.v[2];
+							ftv.v[1] = ftv.v[2];
+							fnv.v[1] = fnv.v[2];
+						}
+						fv.v[j] = index[0];
+						ftv.v[j] = index[1];
+						fnv.v[j] = index[2];
+						nverts++;
+					}
+					if ( nverts > 0 ) addFace(fv,ftv,fnv);
+				}
+			}
+		}
+	};
+
 };
 
 //-------------------------------------------------------------------------------
@@ -227,6 +500,18 @@ inline int TriMesh::GetMaterialIndex(int faceID) const
 	return -1;
 }
 
+inline void TriMesh::ReorderFaces( unsigned int const *order )
+{
+	TriFace *tmp = new TriFace[nf];
+	TriFace *faces[3] = { f, ft, fn };
+	for ( int j=0; j<3; j++ ) {
+		if ( !faces[j] ) continue;
+		for ( unsigned int i=0; i<nf; i++ ) tmp[i] = faces[j][order[i]];
+		memcpy( faces[j], tmp, sizeof(TriFace)*nf );
+	}
+	delete [] tmp;
+}
+
 inline void TriMesh::ComputeBoundingBox()
 {
 	if ( nv > 0 ) {
@@ -261,16 +546,8 @@ inline void TriMesh::ComputeNormals(bool clockwise)
 	for ( unsigned int i=0; i<nvn; i++ ) vn[i].Normalize();
 }
 
-inline bool TriMesh::LoadFromFileObj( char const *filename, bool loadMtl, std::ostream *outStream )
+inline void TriMesh::LoadMtlFiles( char const *filename, std::vector<std::string> const &mtlFiles, std::vector<std::string> const &mtlNames, std::ostream *outStream )
 {
-	FILE *fp = fopen(filename,"r");
-	if ( !fp ) {
-		if ( outStream ) *outStream << "ERROR: Cannot open file " << filename << std::endl;
-		return false;
-	}
-
-	Clear();
-
 	class Buffer
 	{
 		char data[1024];
@@ -323,7 +600,107 @@ inline bool TriMesh::LoadFromFileObj( char const *filename, bool loadMtl, std::o
 	};
 	Buffer buffer;
 
+	// get the path from filename
+	char *mtlPathName = nullptr;
+	char const *pathEnd = strrchr(filename,'\\');
+	if ( !pathEnd ) pathEnd = strrchr(filename,'/');
+	if ( pathEnd ) {
+		int n = int(pathEnd-filename) + 1;
+		mtlPathName = new char[n+1];
+		strncpy(mtlPathName,filename,n);
+		mtlPathName[n] = '\0';
+	}
+	for ( unsigned int mi=0; mi<mtlFiles.size(); mi++ ) {
+		std::string mtlFilename = ( mtlPathName ) ? std::string(mtlPathName) + mtlFiles[mi] : mtlFiles[mi];
+		FILE *fpm = fopen(mtlFilename.data(),"r");
+		if ( !fpm ) {
+			if ( outStream ) *outStream << "ERROR: Cannot open file " << mtlFilename.c_str() << std::endl;
+			continue;
+		}
+		int mtlID = -1;
+		while ( buffer.ReadLine(fpm) ) {
+			if ( buffer.IsCommand("newmtl") ) {
+				mtlID = -1;
+				for ( unsigned int i=0; i<mtlNames.size() && i<nm; i++ ) if ( mtlNames[i] == buffer.Data(7) ) { mtlID = (int)i; break; }
+				if ( mtlID >= 0 ) buffer.Copy( m[mtlID].name, 7 );
+			} else if ( mtlID >= 0 ) {
+				if ( buffer.IsCommand("Ka") ) buffer.ReadFloat3( m[mtlID].Ka );
+				else if ( buffer.IsCommand("Kd") ) buffer.ReadFloat3( m[mtlID].Kd );
+				else if ( buffer.IsCommand("Ks") ) buffer.ReadFloat3( m[mtlID].Ks );
+				else if ( buffer.IsCommand("Tf") ) buffer.ReadFloat3( m[mtlID].Tf );
+				else if ( buffer.IsCommand("Ns") ) buffer.ReadFloat( &m[mtlID].Ns );
+				else if ( buffer.IsCommand("Ni") ) buffer.ReadFloat( &m[mtlID].Ni );
+				else if ( buffer.IsCommand("illum") ) buffer.ReadInt( &m[mtlID].illum, 5 );
+				else if ( buffer.IsCommand("map_Ka"  ) ) buffer.Copy( m[mtlID].map_Ka,   7 );
+				else if ( buffer.IsCommand("map_Kd"  ) ) buffer.Copy( m[mtlID].map_Kd,   7 );
+				else if ( buffer.IsCommand("map_Ks"  ) ) buffer.Copy( m[mtlID].map_Ks,   7 );
+				else if ( buffer.IsCommand("map_Ns"  ) ) buffer.Copy( m[mtlID].map_Ns,   7 );
+				else if ( buffer.IsCommand("map_d"   ) ) buffer.Copy( m[mtlID].map_d,    6 );
+				else if ( buffer.IsCommand("map_bump") ) buffer.Copy( m[mtlID].map_bump, 9 );
+				else if ( buffer.IsCommand("bump"    ) ) buffer.Copy( m[mtlID].map_bump, 5 );
+				else if ( buffer.IsCommand("map_disp") ) buffer.Copy( m[mtlID].map_disp, 9 );
+				else if ( buffer.IsCommand("disp"    ) ) buffer.Copy( m[mtlID].map_disp, 5 );
+			}
+		}
+		fclose(fpm);
+	}
+	if ( mtlPathName ) delete [] mtlPathName;
+}
+
+//-------------------------------------------------------------------------------
+
+inline bool TriMesh::LoadFromFileObj( char const *filename, bool loadMtl, std::ostream *outStream )
+{
+	// Map the whole file, so that chunks of it can be parsed in parallel
+	ObjFileData file;
+	if ( !file.Open(filename) ) {
+		if ( outStream ) *outStream << "ERROR: Cannot open file " << filename << std::endl;
+		return false;
+	}
+
+	Clear();
+
+	// Let the application provide the mesh, e.g. from a binary copy of the file
+	LoadHooks const &hooks = Hooks();
+	if ( hooks.load && hooks.load( *this, filename, loadMtl, outStream ) ) return true;
 
+	// Split the file into chunks that end at line breaks
+	char const *fileBegin = file.Data();
+	char const *fileEnd = file.Data() + file.Size();
+	size_t chunkCount = file.Size() / CY_OBJ_MIN_CHUNK_SIZE + 1;
+	size_t maxChunks = hooks.parallelFor && hooks.maxChunks > 0 ? hooks.maxChunks : 1;
+	if ( chunkCount > maxChunks ) chunkCount = maxChunks;
+	std::vector<ObjChunk> chunks(chunkCount);
+	char const *p = fileBegin;
+	for ( size_t i=0; i<chunkCount; i++ ) {
+		chunks[i].begin = p;
+		p = ( i+1 == chunkCount ) ? fileEnd : fileBegin + file.Size()*(i+1)/chunkCount;
+		if ( p < chunks[i].begin ) p = chunks[i].begin;
+		while ( p < fileEnd && *p != '\n' ) p++;
+		if ( p < fileEnd ) p++;
+		chunks[i].end = p;
+	}
+	auto forEachChunk = [&chunks,&hooks]( void (*func)(ObjChunk&, void*), void *data ) {
+		if ( chunks.size() == 1 ) { func(chunks[0], data); return; }
+		struct Call { std::vector<ObjChunk> &chunks; void (*func)(ObjChunk&, void*); void *data; } call = { chunks, func, data };
+		hooks.parallelFor( (unsigned int)chunks.size(), []( unsigned int i, void *c ) { Call &call = *static_cast<Call*>(c); call.func(call.chunks[i], call.data); }, &call );
+	};
+
+	// First pass: count the components of each chunk
+	forEachChunk( [](ObjChunk &chunk, void*) { chunk.Count(); }, nullptr );
+
+	// Offsets of each chunk in the final arrays
+	unsigned int numV=0, numVT=0, numVN=0, numF=0;
+	for ( ObjChunk &c : chunks ) {
+		c.v0 = numV;  numV  += c.nv;
+		c.vt0= numVT; numVT += c.nvt;
+		c.vn0= numVN; numVN += c.nvn;
+		c.f0 = numF;  numF  += c.nf;
+	}
+	if ( numF == 0 ) return true; // No faces found
+
+	// Material runs: faces are grouped by material in the order the materials are first used,
+	// followed by the faces without a material, so each run of faces gets its final position
 	struct MtlList {
 		std::vector<MtlData> mtlData;
 		int GetMtlIndex( char const *mtlName )
@@ -346,203 +723,60 @@ inline bool TriMesh::LoadFromFileObj( char const *filename, bool loadMtl, std::o
 		}
 	};
 	MtlList mtlList;
-
-	std::vector<Vec3f>      _v;		// vertices
-	std::vector<TriFace>    _f;		// faces
-	std::vector<Vec3f>      _vn;	// vertex normal
-	std::vector<TriFace>    _fn;	// normal faces
-	std::vector<Vec3f>      _vt;	// texture vertices
-	std::vector<TriFace>    _ft;	// texture faces
 	std::vector<MtlLibName> mtlFiles;
-	std::vector<int>        faceMtlIndex;
-
-	int currentMtlIndex = -1;
-	bool hasTextures=false, hasNormals=false;
-
-	while ( int rb = buffer.ReadLine(fp) ) {
-		if ( buffer.IsCommand("v") ) {
-			Vec3f vertex;
-			buffer.ReadVertex(vertex);
-			_v.push_back(vertex);
-		}
-		else if ( buffer.IsCommand("vt") ) {
-			Vec3f texVert;
-			buffer.ReadVertex(texVert);
-			_vt.push_back(texVert);
-			hasTextures = true;
-		}
-		else if ( buffer.IsCommand("vn") ) {
-			Vec3f normal;
-			buffer.ReadVertex(normal);
-			_vn.push_back(normal);
-			hasNormals = true;
-		}
-		else if ( buffer.IsCommand("f") ) {
-			int facevert = -1;
-			bool inspace = true;
-			bool negative = false;
-			int type = 0;
-			unsigned int index;
-			TriFace face, textureFace, normalFace;
-			unsigned int nFacesBefore = (unsigned int)_f.size();
-			for ( int i=2; i<rb; i++ ) {
-				if ( buffer[i] == ' ' ) inspace = true;
-				else {
-					if ( inspace ) {
-						inspace=false;
-						negative = false;
-						type=0;
-						index=0;
-						switch ( facevert ) {
-							case -1:
-								// initialize face
-								face.v[0] = face.v[1] = face.v[2] = 0;
-								textureFace.v[0] = textureFace.v[1] = textureFace.v[2] = 0;
-								normalFace. v[0] = normalFace. v[1] = normalFace. v[2] = 0;
-							case 0:
-							case 1:
-								facevert++;
-								break;
-							case 2:
-								// copy the first two vertices from the previous face
-								_f.push_back(face);
-								face.v[1] = face.v[2];
-								if ( hasTextures ) {
-									_ft.push_back(textureFace);
-									textureFace.v[1] = textureFace.v[2];
-								}
-								if ( hasNormals ) {
-									_fn.push_back(normalFace);
-									normalFace.v[1] = normalFace.v[2];
-								}
-								faceMtlIndex.push_back(currentMtlIndex);
-								break;
-						}
-					}
-					if ( buffer[i] == '/' ) { type++; index=0; }
-					if ( buffer[i] == '-' ) negative = true;
-					if ( buffer[i] >= '0' && buffer[i] <= '9' ) {
-						index = index*10 + (buffer[i]-'0');
-						switch ( type ) {
-							case 0: face.v       [facevert] = negative ? (unsigned int)_v. size()-index : index-1; break;
-							case 1: textureFace.v[facevert] = negative ? (unsigned int)_vt.size()-index : index-1; hasTextures=true; break;
-							case 2: normalFace.v [facevert] = negative ? (unsigned int)_vn.size()-index : index-1; hasNormals =true; break;
-						}
-					}
+	std::vector<ObjRun> runs;
+	runs.push_back( ObjRun{ 0, -1, 0 } );
+	if ( loadMtl ) {
+		for ( ObjChunk &c : chunks ) {
+			for ( ObjChunk::Command const &cmd : c.commands ) {
+				if ( cmd.isMtlLib ) {
+					MtlLibName libName;
+					libName.filename = cmd.name;
+					mtlFiles.push_back(libName);
+				} else {
+					unsigned int face = c.f0 + cmd.face;
+					int mtl = mtlList.CreateMtl(cmd.name.c_str(), face);
+					if ( runs.back().firstFace == face ) runs.back().mtl = mtl;
+					else runs.push_back( ObjRun{ face, mtl, 0 } );
 				}
 			}
-			_f.push_back(face);
-			if ( hasTextures ) _ft.push_back(textureFace);
-			if ( hasNormals  ) _fn.push_back(normalFace);
-			faceMtlIndex.push_back(currentMtlIndex);
-			if ( currentMtlIndex>=0 ) mtlList.mtlData[currentMtlIndex].faceCount += (unsigned int)_f.size() - nFacesBefore;
 		}
-		else if ( loadMtl ) {
-			if ( buffer.IsCommand("usemtl") ) {
-				currentMtlIndex = mtlList.CreateMtl(buffer.Data(7), (unsigned int)_f.size());
-			}
-			if ( buffer.IsCommand("mtllib") ) {
-				MtlLibName libName;
-				libName.filename = buffer.Data(7);
-				mtlFiles.push_back(libName);
-			}
-		}
-		if ( feof(fp) ) break;
 	}
+	std::vector<unsigned int> mtlFaceCount(mtlList.mtlData.size()+1, 0);	// the last entry counts faces without a material
+	for ( size_t r=0; r<runs.size(); r++ ) {
+		unsigned int next = r+1 < runs.size() ? runs[r+1].firstFace : numF;
+		int m = runs[r].mtl >= 0 ? runs[r].mtl : (int)mtlList.mtlData.size();
+		runs[r].target = mtlFaceCount[m];	// position within the material, offset below
+		mtlFaceCount[m] += next - runs[r].firstFace;
+	}
+	std::vector<unsigned int> mtlFirstFace(mtlFaceCount.size(), 0);
+	for ( size_t m=1; m<mtlFaceCount.size(); m++ ) mtlFirstFace[m] = mtlFirstFace[m-1] + mtlFaceCount[m-1];
+	for ( ObjRun &r : runs ) r.target += mtlFirstFace[ r.mtl >= 0 ? r.mtl : (int)mtlList.mtlData.size() ];
 
-	fclose(fp);
-
-
-	if ( _f.size() == 0 ) return true; // No faces found
-	SetNumVertex((unsigned int)_v.size());
-	SetNumFaces((unsigned int)_f.size());
-	SetNumTexVerts((unsigned int)_vt.size());
-	SetNumNormals((unsigned int)_vn.size());
+	// Allocate the final arrays
+	SetNumVertex(numV);
+	SetNumFaces(numF);
+	SetNumTexVerts(numVT);
+	SetNumNormals(numVN);
 	if ( loadMtl ) SetNumMtls((unsigned int)mtlList.mtlData.size());
-
-	// Copy data
-	memcpy(v, _v.data(), sizeof(Vec3f)*_v.size());
-	if ( _vt.size() > 0 ) memcpy(vt, _vt.data(), sizeof(Vec3f)*_vt.size());
-	if ( _vn.size() > 0 ) memcpy(vn, _vn.data(), sizeof(Vec3f)*_vn.size());
-
-	if ( mtlList.mtlData.size() > 0 ) {
-		unsigned int fid = 0;
-		for ( int mi=0; mi<(int)mtlList.mtlData.size(); mi++ ) {
-			for ( unsigned int i=mtlList.mtlData[mi].firstFace, j=0; j<mtlList.mtlData[mi].faceCount && i<_f.size(); i++ ) {
-				if ( faceMtlIndex[i] == mi ) {
-					f[fid] = _f[i];
-					if ( fn ) fn[fid] = _fn[i];
-					if ( ft ) ft[fid] = _ft[i];
-					fid++;
-					j++;
-				}
-			}
-			mcfc[mi] = fid;
-		}
-		if ( fid <_f.size() ) {
-			for ( unsigned int i=0; i<_f.size(); i++ ) {
-				if ( faceMtlIndex[i] < 0 ) {
-					f[fid] = _f[i];
-					if ( fn ) fn[fid] = _fn[i];
-					if ( ft ) ft[fid] = _ft[i];
-					fid++;
-				}
-			}
-		}
-	} else {
-		memcpy(f, _f.data(), sizeof(TriFace)*_f.size());
-		if ( ft ) memcpy(ft, _ft.data(), sizeof(TriFace)*_ft.size());
-		if ( fn ) memcpy(fn, _fn.data(), sizeof(TriFace)*_fn.size());
+	for ( unsigned int mi=0; mi<nm; mi++ ) {
+		mtlList.mtlData[mi].faceCount = mtlFaceCount[mi];
+		mcfc[mi] = mtlFirstFace[mi] + mtlFaceCount[mi];
 	}
 
+	// Second pass: parse each chunk directly into the final arrays
+	ObjTarget target = { v, vt, vn, f, ft, fn, runs.data(), (unsigned int)runs.size() };
+	forEachChunk( [](ObjChunk &chunk, void *t) { chunk.Parse(*static_cast<ObjTarget*>(t)); }, &target );
+	file.Close();
 
 	// Load the .mtl files
-	if ( loadMtl ) {
-		// get the path from filename
-		char *mtlPathName = nullptr;
-		char const *pathEnd = strrchr(filename,'\\');
-		if ( !pathEnd ) pathEnd = strrchr(filename,'/');
-		if ( pathEnd ) {
-			int n = int(pathEnd-filename) + 1;
-			mtlPathName = new char[n+1];
-			strncpy(mtlPathName,filename,n);
-			mtlPathName[n] = '\0';
-		}
-		for ( unsigned int mi=0; mi<mtlFiles.size(); mi++ ) {
-			std::string mtlFilename = ( mtlPathName ) ? std::string(mtlPathName) + mtlFiles[mi].filename : mtlFiles[mi].filename;
-			FILE *fpm = fopen(mtlFilename.data(),"r");
-			if ( !fpm ) {
-				if ( outStream ) *outStream << "ERROR: Cannot open file " << mtlFilename.c_str() << std::endl;
-				continue;
-			}
-			int mtlID = -1;
-			while ( buffer.ReadLine(fpm) ) {
-				if ( buffer.IsCommand("newmtl") ) {
-					mtlID = mtlList.GetMtlIndex(buffer.Data(7));
-					if ( mtlID >= 0 ) buffer.Copy( m[mtlID].name, 7 );
-				} else if ( mtlID >= 0 ) {
-					if ( buffer.IsCommand("Ka") ) buffer.ReadFloat3( m[mtlID].Ka );
-					else if ( buffer.IsCommand("Kd") ) buffer.ReadFloat3( m[mtlID].Kd );
-					else if ( buffer.IsCommand("Ks") ) buffer.ReadFloat3( m[mtlID].Ks );
-					else if ( buffer.IsCommand("Tf") ) buffer.ReadFloat3( m[mtlID].Tf );
-					else if ( buffer.IsCommand("Ns") ) buffer.ReadFloat( &m[mtlID].Ns );
-					else if ( buffer.IsCommand("Ni") ) buffer.ReadFloat( &m[mtlID].Ni );
-					else if ( buffer.IsCommand("illum") ) buffer.ReadInt( &m[mtlID].illum, 5 );
-					else if ( buffer.IsCommand("map_Ka"  ) ) buffer.Copy( m[mtlID].map_Ka,   7 );
-					else if ( buffer.IsCommand("map_Kd"  ) ) buffer.Copy( m[mtlID].map_Kd,   7 );
-					else if ( buffer.IsCommand("map_Ks"  ) ) buffer.Copy( m[mtlID].map_Ks,   7 );
-					else if ( buffer.IsCommand("map_Ns"  ) ) buffer.Copy( m[mtlID].map_Ns,   7 );
-					else if ( buffer.IsCommand("map_d"   ) ) buffer.Copy( m[mtlID].map_d,    6 );
-					else if ( buffer.IsCommand("map_bump") ) buffer.Copy( m[mtlID].map_bump, 9 );
-					else if ( buffer.IsCommand("bump"    ) ) buffer.Copy( m[mtlID].map_bump, 5 );
-					else if ( buffer.IsCommand("map_disp") ) buffer.Copy( m[mtlID].map_disp, 9 );
-					else if ( buffer.IsCommand("disp"    ) ) buffer.Copy( m[mtlID].map_disp, 5 );
-				}
-			}
-			fclose(fpm);
-		}
-		if ( mtlPathName ) delete [] mtlPathName;
-	}
+	std::vector<std::string> mtlNames;
+	for ( MtlData const &md : mtlList.mtlData ) mtlNames.push_back(md.mtlName);
+	std::vector<std::string> mtlLibs;
+	for ( MtlLibName const &lib : mtlFiles ) mtlLibs.push_back(lib.filename);
+	if ( loadMtl ) LoadMtlFiles( filename, mtlLibs, mtlNames, outStream );
+
+	if ( hooks.parsed ) hooks.parsed( *this, filename, loadMtl, mtlLibs, mtlNames );
 
 	return true;
 }
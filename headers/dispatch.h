@@ -0,0 +1,98 @@
+#ifndef _DISPATCH_H_INCLUDED_
+#define _DISPATCH_H_INCLUDED_
+
+#include "scene.h"
+#include "objects.h"
+#include "materials.h"
+#include "lights.h"
+#include "instancing.h"
+#include "compactmesh.h"
+#include "intersect.h"
+#include "renderstats.h"
+
+#include <vector>
+#include <typeinfo>
+
+// the instances of the scene split by the concrete type of their object, so that the
+// tracer calls each type's intersection directly: spheres and planes inline, meshes
+// through a non-virtual call, and only unknown object types through the vtable
+struct InstanceLists
+{
+    std::vector<Instance> spheres;
+    std::vector<Instance> planes;
+    std::vector<Instance> meshes;
+    std::vector<Instance> compactMeshes;
+    std::vector<Instance> others;
+
+    void Build( std::vector<Instance> const &instances );
+
+    // call fn(instance, intersect) for every list, where intersect(instance, ray, hInfo,
+    // hitSide) is the intersection of that list's object type
+    template <class F>
+    void ForEachList( F &&fn ) const {
+        fn(spheres, []( Instance const &, Ray const &r, HitInfo &h, int side ) { return RaySphere(r, side, h); });
+        fn(planes, []( Instance const &, Ray const &r, HitInfo &h, int side ) { return RayPlane(r, side, h); });
+        fn(meshes, []( Instance const &inst, Ray const &r, HitInfo &h, int side ) {
+            return static_cast<TriObj const*>(inst.obj)->TriObj::IntersectRay(r, h, side);
+        });
+        fn(compactMeshes, []( Instance const &inst, Ray const &r, HitInfo &h, int side ) {
+            return static_cast<CompactMesh const*>(inst.obj)->CompactMesh::IntersectRay(r, h, side);
+        });
+        fn(others, []( Instance const &inst, Ray const &r, HitInfo &h, int side ) {
+            return inst.obj->IntersectRay(r, h, side);
+        });
+    }
+};
+
+// the renderable lights split the same way
+struct LightLists
+{
+    std::vector<Light*> points;
+    std::vector<Light*> spots;
+    std::vector<Light*> others;
+
+    void Build( LightList const &lights );
+
+    template <class F>
+    void ForEachList( F &&fn ) const {
+        fn(points, []( Light const *l, Ray const &r, HitInfo &h, int side ) {
+            return static_cast<PointLight const*>(l)->PointLight::IntersectRay(r, h, side);
+        });
+        fn(spots, []( Light const *l, Ray const &r, HitInfo &h, int side ) {
+            return static_cast<SpotLight const*>(l)->SpotLight::IntersectRay(r, h, side);
+        });
+        fn(others, []( Light const *l, Ray const &r, HitInfo &h, int side ) {
+            return l->IntersectRay(r, h, side);
+        });
+    }
+};
+
+// sampling calls of materials and lights with the types the scenes use called directly,
+// comparing the type costs one load against the vtable's indirect call
+inline bool SampleMaterial( Material const *mtl, SamplerInfo const &sInfo, Vec3f &dir, DirSampler::Info &si ) {
+    if (typeid(*mtl) == typeid(MtlBlinn)) return static_cast<MtlBlinn const*>(mtl)->MtlBlinn::GenerateSample(sInfo, dir, si);
+    return mtl->GenerateSample(sInfo, dir, si);
+}
+
+inline void MaterialSampleInfo( Material const *mtl, SamplerInfo const &sInfo, Vec3f const &dir, DirSampler::Info &si ) {
+    if (typeid(*mtl) == typeid(MtlBlinn)) static_cast<MtlBlinn const*>(mtl)->MtlBlinn::GetSampleInfo(sInfo, dir, si);
+    else mtl->GetSampleInfo(sInfo, dir, si);
+}
+
+inline bool SampleLight( Light const *light, SamplerInfo const &sInfo, Vec3f &dir, DirSampler::Info &si ) {
+    StatTimerScope timer(TIMER_LIGHTS);
+    std::type_info const &type = typeid(*light);
+    if (type == typeid(PointLight)) return static_cast<PointLight const*>(light)->PointLight::GenerateSample(sInfo, dir, si);
+    if (type == typeid(SpotLight)) return static_cast<SpotLight const*>(light)->SpotLight::GenerateSample(sInfo, dir, si);
+    return light->GenerateSample(sInfo, dir, si);
+}
+
+inline void LightSampleInfo( Light const *light, SamplerInfo const &sInfo, Vec3f const &dir, DirSampler::Info &si ) {
+    StatTimerScope timer(TIMER_LIGHTS);
+    std::type_info const &type = typeid(*light);
+    if (type == typeid(PointLight)) static_cast<PointLight const*>(light)->PointLight::GetSampleInfo(sInfo, dir, si);
+    else if (type == typeid(SpotLight)) static_cast<SpotLight const*>(light)->SpotLight::GetSampleInfo(sInfo, dir, si);
+    else light->GetSampleInfo(sInfo, dir, si);
+}
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef _FASTMATH_H_INCLUDED_
+#define _FASTMATH_H_INCLUDED_
+
+#include <cmath>
+
+// single precision constants, so that expressions like 2 * M_PI * u stay in float
+// instead of going through double precision
+#define FAST_PI         3.14159265358979f
+#define FAST_TWO_PI     6.28318530717959f
+#define FAST_INV_PI     0.318309886183791f
+#define FAST_INV_4PI    0.0795774715459477f
+
+// sine and cosine of one angle in single precision
+inline void SinCos( float x, float &s, float &c ) {
+#ifdef __GNUC__
+    sincosf(x, &s, &c);
+#else
+    s = sinf(x);
+    c = cosf(x);
+#endif
+}
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef _INSTANCING_H_INCLUDED_
+#define _INSTANCING_H_INCLUDED_
+
+#include "scene.h"
+
+#include <vector>
+
+// geometry shared between scene nodes that reference the same OBJ file
+struct InstancingStats
+{
+    int uniqueMeshes = 0;               // distinct OBJ files
+    int instances = 0;                  // nodes using one of them
+    unsigned long long uniqueTriangles = 0;
+    unsigned long long instancedTriangles = 0;  // triangles rendered through all instances
+    size_t bytesSaved = 0;              // mesh memory a copy per node would take
+};
+
+// count the nodes that share each mesh and print the load report; the meshes are shared
+// when they are loaded, see LoadDeferredMeshes in loadpipeline.h
+InstancingStats CountMeshInstances( Node const &rootNode );
+
+// a node with an object and the transforms of all its ancestors composed into one,
+// so the tracer can test it without walking the scene graph
+struct Instance
+{
+    Node const *node;       // node reported in the hit info
+    Object const *obj;
+    Matrix3f toObj;         // world to object space, p_obj = toObj * p + toObjPos
+    Vec3f toObjPos;
+    Matrix3f toWorld;       // object to world space, p = toWorld * p_obj + toWorldPos
+    Vec3f toWorldPos;
+
+    // the ray in object space, the direction is not normalized so hit distances stay
+    // the same as along the world space ray
+    Ray ToObjectCoords( Ray const &ray ) const {
+        Ray r;
+        r.p = toObj * ray.p + toObjPos;
+        r.dir = toObj * ray.dir;
+        return r;
+    }
+    // move a hit from object space to world space
+    void FromObjectCoords( HitInfo &hInfo ) const {
+        hInfo.p = toWorld * hInfo.p + toWorldPos;
+        hInfo.N = Transformation::TransposeMult(toObj, hInfo.N).GetNormalized();
+        hInfo.GN = Transformation::TransposeMult(toObj, hInfo.GN).GetNormalized();
+    }
+};
+
+// flatten the scene graph into the list of nodes that hold an object
+void BuildInstances( Node const &rootNode, std::vector<Instance> &instances );
+
+#endif
@@ -0,0 +1,211 @@
+#ifndef _INTERSECT_H_INCLUDED_
+#define _INTERSECT_H_INCLUDED_
+
+#include "scene.h"
+#include "renderstats.h"
+#include "cyTriMesh.h"
+#include "cyBVH.h"
+
+#include <cmath>
+
+// where a ray crosses a triangle
+struct TriangleHit
+{
+    float t;        // distance along the ray direction
+    Vec3f bc;       // barycentric coordinates of the hit point
+    Vec3f p;        // hit point
+    Vec3f n_star;   // unnormalized geometric normal
+    bool front;     // the ray hit the front side
+};
+
+// intersect a ray with the triangle v0 v1 v2, only hits closer than tMax are reported
+inline bool RayTriangle( Ray const &ray, Vec3f const &v0, Vec3f const &v1, Vec3f const &v2,
+                         int hitSide, float tMax, TriangleHit &hit ) {
+    float bias = 0.00002;
+
+    Vec3f n_star = (v1 - v0).Cross(v2 - v0);
+
+    float cosTheta = n_star.Dot(ray.dir);
+    if (std::abs(cosTheta) < bias) return false; // we're basically parallel to the triangle
+    if (cosTheta > bias && hitSide == HIT_FRONT) return false;  // we hit a back side and only want front
+
+    float t = ( v0.Dot(n_star) - ray.p.Dot(n_star) ) / cosTheta;
+
+    if ( t <= bias ) return false; // the triangle is behind the ray origin
+    if ( t >= tMax ) return false;  // we don't know if this is actually a hit or not
+                                    // but if it is, it's farther away than our last, so quit
+
+    Vec3f x = ray.p + t*ray.dir;    // "intersect" point
+
+    // collapse the triangle to 2d based on the normal direction
+    Vec2d v02d;
+    Vec2d v12d;
+    Vec2d v22d;
+    Vec2d x2d;
+
+    if ( std::abs(n_star.x) >= std::abs(n_star.y) && std::abs(n_star.x) >= std::abs(n_star.z) ) {
+        // x is greatest component of n_star
+        v02d = Vec2d(v0.y, v0.z);
+        v12d = Vec2d(v1.y, v1.z);
+        v22d = Vec2d(v2.y, v2.z);
+        x2d = Vec2d(x.y, x.z);
+    }
+    else if ( std::abs(n_star.y) >= std::abs(n_star.x) && std::abs(n_star.y) >= std::abs(n_star.z) ) {
+        // y is greatest component of n_star
+        v02d = Vec2d(v0.x, v0.z);
+        v12d = Vec2d(v1.x, v1.z);
+        v22d = Vec2d(v2.x, v2.z);
+        x2d = Vec2d(x.x, x.z);
+    }
+    else {
+        // z is greatest component of n_star
+        v02d = Vec2d(v0.x, v0.y);
+        v12d = Vec2d(v1.x, v1.y);
+        v22d = Vec2d(v2.x, v2.y);
+        x2d = Vec2d(x.x, x.y);
+    }
+
+    // check if any of the areas match sign
+    float area0 = (v12d - v02d).Cross(x2d - v02d);
+    float area1 = (v22d - v12d).Cross(x2d - v12d);
+    float area2 = (v02d - v22d).Cross(x2d - v22d);
+
+    if ( !(((area0>=0) == (area1>=0)) && ((area1>=0) == (area2>=0))) ) return false;    //the signs don't match
+
+    // okay, this is an actual hit, believe it or not
+    float areaTotal = (v12d - v02d).Cross(v22d - v02d);
+    hit.t = t;
+    hit.bc = Vec3f(std::abs(area1 / areaTotal), std::abs(area2 / areaTotal), std::abs(area0 / areaTotal));
+    hit.p = x;
+    hit.n_star = n_star;
+    hit.front = cosTheta <= -bias;
+    return true;
+}
+
+// intersect a ray with the unit sphere at the origin, only hits closer than hInfo.z are stored
+inline bool RaySphere( Ray const &ray, int hitSide, HitInfo &hInfo ) {
+    float bias = 0.002;
+    bool front = true;
+
+    // q is [0, 0, 0] and r = 1
+    float a = ray.dir.Dot(ray.dir);
+    float b = 2 * ray.dir.Dot(ray.p);
+    float c = ray.p.Dot(ray.p) - 1;
+
+    float delta = (b * b) - (4 * a * c);
+    if (delta < 0) return false;
+
+    float t = ( -b - std::sqrt(delta) ) / ( 2 * a );
+    if ( t <= bias ) {
+        if (hitSide == HIT_BACK || hitSide == HIT_FRONT_AND_BACK) {
+            front = false;
+            t = ( -b + std::sqrt(delta) ) / ( 2 * a );
+            if (t <= bias) {
+                return false;
+            }
+        }
+        else {
+            return false;
+        }
+    }
+
+    //okay so we actually hit, so let's check if it's closer than previous stored hit
+    cy::Vec3f p = ray.p + ray.dir * t;
+
+    if ( std::abs(p.Dot(ray.dir)) <= bias) return false; //too close to parallel??
+
+    if (t < hInfo.z) {
+        hInfo.z = t;
+        hInfo.front = front;
+        hInfo.p = p;
+        hInfo.N = p;    // we'll normalize it later since we have to apply transforms anyway
+        hInfo.GN = p;
+        // calculate uv mapping
+        float u = atan2(p.y, p.x) / (2 * M_PI);
+        float v = asin(p.z) / M_PI + 0.5;
+        hInfo.uvw = Vec3f(u, v, 0.5);
+        return true;
+    }
+
+    return false;
+}
+
+// intersect a ray with the square [-1, 1] x [-1, 1] in the z = 0 plane
+inline bool RayPlane( Ray const &ray, int hitSide, HitInfo &hInfo ) {
+    float bias = 0.002;
+
+    // if we're hitting the back and we only want the front
+    if (ray.dir.z > 0 && hitSide == HIT_FRONT) return false;
+
+    float t = -ray.p.z / ray.dir.z;
+
+    if (t <= bias) return false;    //the plane is behind our origin point
+    if (t >= hInfo.z) return false;  // we don't know if this is actually a hit or not
+                                    // but if it is, it's farther away than our last, so quit
+
+    Vec3f x = ray.p + t*ray.dir;
+
+    if (x.x < -1 || x.x > 1 || x.y < -1 || x.y > 1) return false;   // no intersection
+
+    // check if we're closer than previous hit before returning
+    hInfo.z = t;
+    hInfo.front = ray.dir.z < 0;
+    hInfo.p = x;
+    hInfo.N = Vec3f(0, 0, 1);
+    hInfo.GN = hInfo.N;
+    hInfo.uvw = (x + 1) / 2;
+    return true;
+}
+
+// slab test of a ray against a box stored as min xyz followed by max xyz
+inline bool RayBox( Ray const &ray, float const *bounds ) {
+    float tx0 = (bounds[0] - ray.p.x) / ray.dir.x;
+    float tx1 = (bounds[3] - ray.p.x) / ray.dir.x;
+    float ty0 = (bounds[1] - ray.p.y) / ray.dir.y;
+    float ty1 = (bounds[4] - ray.p.y) / ray.dir.y;
+    float tz0 = (bounds[2] - ray.p.z) / ray.dir.z;
+    float tz1 = (bounds[5] - ray.p.z) / ray.dir.z;
+
+    if (tx0 > tx1) Swap(tx0, tx1);
+    if (ty0 > ty1) Swap(ty0, ty1);
+    if (tz0 > tz1) Swap(tz0, tz1);
+
+    return Max(tx0, ty0, tz0) <= Min(tx1, ty1, tz1);
+}
+
+// closest hit of a ray with the elements under a BVH node, where leaf(element) tests one
+// element and returns true if it updated the hit. The nodes are visited in the order of a
+// recursive traversal, but from a stack inside one function, so a CPU_DISPATCH caller
+// compiles the whole traversal for its instruction set
+template <class LEAF>
+inline bool TraceBVH( cy::BVH const &bvh, Ray const &ray, unsigned int nodeID, LEAF &&leaf ) {
+    unsigned int stack[64];
+    int top = 0;
+    stack[top++] = nodeID;
+    bool foundHit = false;
+    while (top > 0) {
+        nodeID = stack[--top];
+        CountStat(STAT_BVH_NODES);
+        if (!RayBox(ray, bvh.GetNodeBounds(nodeID))) continue;
+
+        if (!bvh.IsLeafNode(nodeID)) {
+            // trees deeper than the stack continue in a nested call
+            if (top + 2 > 64) {
+                if (TraceBVH(bvh, ray, bvh.GetFirstChildNode(nodeID), leaf)) foundHit = true;
+                if (TraceBVH(bvh, ray, bvh.GetSecondChildNode(nodeID), leaf)) foundHit = true;
+                continue;
+            }
+            stack[top++] = bvh.GetSecondChildNode(nodeID);
+            stack[top++] = bvh.GetFirstChildNode(nodeID);
+            continue;
+        }
+        unsigned int const *elements = bvh.GetNodeElements(nodeID);
+        CountStat(STAT_TRIANGLES, bvh.GetNodeElementCount(nodeID));
+        for (unsigned int i = 0; i < bvh.GetNodeElementCount(nodeID); i++) {
+            if (leaf(elements[i])) foundHit = true;
+        }
+    }
+    return foundHit;
+}
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef _LAZYLOAD_H_INCLUDED_
+#define _LAZYLOAD_H_INCLUDED_
+
+#include <atomic>
+#include <mutex>
+#include <cstddef>
+#include <cstdint>
+
+namespace tinyxml2 { class XMLElement; }
+
+// geometry and textures loaded when a ray first needs them, enabled with the <lazyload>
+// element; with a memory budget the least recently used ones are unloaded again. Data of
+// an unloaded item is freed only once every render thread has pinned again after the
+// unload, so a thread may use what it acquired until its next LazyPin::Pin
+
+// read the <lazyload> element of the <scene> element, which may be null, whose "memory"
+// attribute is a budget in MB
+bool LoadLazySettings( tinyxml2::XMLElement const *sceneElem );
+
+bool IsLazyLoading();
+
+// data that is loaded on first use, one thread loads it while only the threads that need
+// the same item wait
+class LazyItem
+{
+private:
+    // loading is invisible to the users of an item, so even const items load
+    mutable std::atomic<void*> data{nullptr};   // loaded data, null while not loaded
+    mutable std::atomic<uint64_t> lastUse{0};   // pin tick of the last thread that used it
+    mutable std::mutex loadMutex;               // held while loading
+    mutable size_t bytes = 0;                   // memory of the loaded data
+    mutable std::atomic<bool> failed{false};    // loading failed, it is not tried again
+
+    friend class LazyCache;
+
+public:
+    LazyItem();
+    virtual ~LazyItem();
+    LazyItem( LazyItem const & ) = delete;
+    LazyItem& operator=( LazyItem const & ) = delete;
+
+    virtual char const* GetName() const = 0;
+    bool IsLoaded() const { return data.load() != nullptr; }
+
+protected:
+    // load the data and its memory use, null if it cannot be loaded
+    virtual void* load( size_t &dataBytes ) const = 0;
+    // free data returned by load
+    virtual void unload( void *d ) const = 0;
+
+    // the loaded data, loading it first if needed; null if it cannot be loaded
+    void* acquire() const {
+        void *d = data.load();
+        if (!d) return acquireSlow();
+        touch();
+        return d;
+    }
+    // free the data now, only when no thread can be using it
+    void release();
+
+private:
+    void* acquireSlow() const;
+    void touch() const;
+};
+
+// marks the calling thread as a user of lazily loaded data from construction or the last
+// Pin until the next Pin or the end of the scope; render threads pin again for every pixel
+class LazyPin
+{
+public:
+    LazyPin() { Pin(); }
+    ~LazyPin();
+    LazyPin( LazyPin const & ) = delete;
+    LazyPin& operator=( LazyPin const & ) = delete;
+
+    void Pin();
+};
+
+// print what was loaded, unloaded and how much memory it held
+void PrintLazyLoadStats();
+
+#endif
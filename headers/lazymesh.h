@@ -0,0 +1,43 @@
+#ifndef _LAZYMESH_H_INCLUDED_
+#define _LAZYMESH_H_INCLUDED_
+
+#include "scene.h"
+#include "objects.h"
+#include "lazyload.h"
+#include "loadpipeline.h"
+
+#include <vector>
+#include <string>
+
+// a mesh that keeps only its bounds until a ray first crosses them, then loads its OBJ
+// file and builds its tree; the bounds come from the binary OBJ cache, so a mesh without
+// an up to date cache is loaded with the scene once to write it
+class LazyMesh : public Object, public LazyItem
+{
+private:
+    std::string filename;
+    float bounds[6];        // min and max corner of the mesh in object space
+
+public:
+    explicit LazyMesh( char const *file ) : filename(file) {}
+    ~LazyMesh() { release(); }
+
+    // read the bounds, false if the mesh cannot be loaded
+    bool Init();
+
+    bool IntersectRay( Ray const &ray, HitInfo &hInfo, int hitSide=HIT_FRONT ) const override;
+    Box GetBoundBox() const override { return Box(Vec3f(bounds[0], bounds[1], bounds[2]), Vec3f(bounds[3], bounds[4], bounds[5])); }
+    char const* GetName() const override { return filename.c_str(); }
+
+    // the mesh, loaded first if needed, null if it cannot be loaded
+    TriObj const* GetMesh() const { return static_cast<TriObj const*>(acquire()); }
+
+protected:
+    void* load( size_t &dataBytes ) const override;
+    void unload( void *d ) const override;
+};
+
+// give the nodes of the deferred meshes one LazyMesh per file
+void AttachLazyMeshes( Node &rootNode, std::vector<std::string> const &deferred, std::vector<LazyMesh*> &meshes );
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef _LOADPIPELINE_H_INCLUDED_
+#define _LOADPIPELINE_H_INCLUDED_
+
+#include "scene.h"
+#include "objects.h"
+#include "tinyxml2.h"
+
+#include <vector>
+#include <string>
+#include <functional>
+
+// assets of a scene loaded as independent tasks on a pool of threads: OBJ parsing,
+// normals and BVH builds of each mesh, and PNG decoding and pyramids of each texture
+class LoadPipeline
+{
+private:
+    struct Task
+    {
+        char const *kind;           // a string literal, also the name of its trace scope
+        std::string name;
+        size_t cost;                // larger tasks start first
+        std::function<bool()> run;
+        double seconds = 0;
+        bool ran = false;
+        bool ok = false;
+    };
+    std::vector<Task> tasks;
+    std::vector<std::function<void()>> finishers;
+    int threads = 0;
+    double seconds = 0;         // wall clock time of all runs
+
+public:
+    // the pipeline uses a pool of threads only with a <loadpipeline> element, whose threads
+    // attribute sets their number, the given default without it; otherwise, or with zero,
+    // the tasks run one after the other on the calling thread
+    void LoadSettings( tinyxml2::XMLElement const *sceneElem, int defaultThreads );
+    bool IsEnabled() const { return threads > 0; }
+    int Threads() const { return threads; }
+
+    // a task that loads one asset and returns false if it cannot
+    void Add( char const *kind, std::string const &name, size_t cost, std::function<bool()> run );
+    // work done on the calling thread once every task has finished, in the order added
+    void AddFinish( std::function<void()> finish );
+    // run the tasks added since the last run, then the finishing work
+    void Run();
+
+    // the time of every task and of all runs together
+    void PrintReport() const;
+};
+
+// a copy of the parsed scene file, in the temporary directory, in which the OBJ objects are plain nodes, so
+// that the scene loader skips their meshes; their file names are added to deferred. Returns
+// the name of the copy, or an empty string if the scene has no OBJ objects
+std::string WriteDeferredScene( tinyxml2::XMLDocument &doc, char const *sceneFilename, std::vector<std::string> &deferred );
+
+// load each deferred mesh once, as a task of the pipeline, and give it to the nodes that
+// name its file when the pipeline finishes; the meshes are added to meshes
+void LoadDeferredMeshes( Node &rootNode, std::vector<std::string> const &deferred, LoadPipeline &pipeline, std::vector<TriObj*> &meshes );
+
+// the resolved path of a file, which identifies a mesh that several nodes load
+std::string ResolvedFileName( char const *name );
+
+#endif
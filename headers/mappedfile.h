@@ -0,0 +1,63 @@
+#ifndef _MAPPEDFILE_H_INCLUDED_
+#define _MAPPEDFILE_H_INCLUDED_
+
+#include <cstddef>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// a read-only memory mapping of a whole file, pages are shared with every other
+// process that maps the same file
+class MappedFile
+{
+private:
+    void *data = nullptr;
+    size_t size = 0;
+
+public:
+    MappedFile() {}
+    ~MappedFile() { Close(); }
+    MappedFile( MappedFile const & ) = delete;
+    MappedFile& operator=( MappedFile const & ) = delete;
+
+    bool Open( char const *filename ) {
+        Close();
+        int fd = open(filename, O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            close(fd);
+            return false;
+        }
+        void *p = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) return false;
+        data = p;
+        size = size_t(st.st_size);
+        return true;
+    }
+
+    void Close() {
+        if (data) munmap(data, size);
+        data = nullptr;
+        size = 0;
+    }
+
+    bool IsOpen() const { return data != nullptr; }
+    char const* Data() const { return static_cast<char const*>(data); }
+    size_t Size() const { return size; }
+};
+
+// 64-bit FNV-1a hash of a block of memory
+inline uint64_t HashBytes( void const *bytes, size_t count, uint64_t hash = 14695981039346656037ULL ) {
+    unsigned char const *p = static_cast<unsigned char const*>(bytes);
+    for (size_t i = 0; i < count; i++) {
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef _MEDIUM_H_INCLUDED_
+#define _MEDIUM_H_INCLUDED_
+
+#include "renderer.h"
+#include "tinyxml2.h"
+
+#include <vector>
+#include <string>
+
+struct Instance;
+
+// a grid of density values loaded from a simple binary voxel file
+//
+// file layout: three little-endian int32 resolutions (nx, ny, nz) followed by
+// nx*ny*nz float32 densities, with x varying fastest and z slowest
+class DensityGrid
+{
+private:
+    int nx = 0, ny = 0, nz = 0;     // grid resolution
+    std::vector<float> density;     // voxel densities
+    float maxDensity = 0.0f;        // largest density in the grid, used as the majorant
+
+public:
+    bool Load( char const *filename );
+
+    // trilinearly interpolated density at a point given in [0,1]^3 grid coordinates
+    float Lookup( Vec3f const &uvw ) const;
+
+    float MaxDensity() const { return maxDensity; }
+    size_t MemoryBytes() const { return density.size() * sizeof(float); }
+};
+
+// a participating medium that is either unbounded, limited to a world space box,
+// or attached to the interior of a scene object
+class Medium
+{
+public:
+    enum Extent { UNBOUNDED, BOX, INTERIOR };
+
+private:
+    std::string name;
+    Extent extent = UNBOUNDED;
+    float sig_a = 0.0f;             // absorption coefficient at unit density
+    float sig_s = 0.0f;             // scattering coefficient at unit density
+    float densityScale = 1.0f;      // multiplier applied to grid densities
+    Box bounds;                     // world space bounds (grid mapping and box extent)
+    Node const *node = nullptr;     // object whose interior holds this medium
+    DensityGrid *grid = nullptr;    // density grid, or null for a homogeneous medium
+
+public:
+    Medium() { bounds.Init(); }
+    ~Medium() { if (grid != nullptr) { delete grid; } }
+
+    // read a <medium> element from the scene file
+    bool Load( tinyxml2::XMLElement const *element, Node const &rootNode );
+
+    char const* GetName() const { return name.c_str(); }
+    bool IsHomogeneous() const { return grid == nullptr; }
+    float SigmaT() const { return sig_a + sig_s; }
+    // probability that a real collision is an absorption event
+    float AbsorptionProb() const { return sig_a / (sig_a + sig_s); }
+
+    // the object whose interior holds this medium, null for the other extents
+    Node const* InteriorNode() const { return extent == INTERIOR ? node : nullptr; }
+
+    // clip the ray segment [0, t_max] to the extent of this medium; the interior of an
+    // object is only known when the segment ends on its back face
+    bool Overlap( Ray const &ray, HitInfo const &hInfo, bool hit, float &t0, float &t1 ) const;
+
+    // transmittance over the parts of [0, t_max] that are inside the object of an interior
+    // medium, found by following the ray from one surface hit of its instance to the next
+    float InteriorTransmittance( Instance const &boundary, Ray const &ray, float t_max, SamplerInfo const &sInfo ) const;
+
+    // delta tracking: sample the first real collision inside [t0, t1],
+    // returns false if the ray leaves the segment without colliding
+    bool SampleCollision( Ray const &ray, float t0, float t1, SamplerInfo const &sInfo, float &t ) const;
+
+    // ratio tracking: unbiased estimate of the transmittance over [t0, t1]
+    float Transmittance( Ray const &ray, float t0, float t1, SamplerInfo const &sInfo ) const;
+
+private:
+    float densityAt( Vec3f const &p ) const;
+};
+
+// read every <medium> element of the <scene> element, which may be null
+bool LoadMedia( tinyxml2::XMLElement const *sceneElem, Node const &rootNode, std::vector<Medium*> &media );
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef _MIPMAP_H_INCLUDED_
+#define _MIPMAP_H_INCLUDED_
+
+#include "scene.h"
+#include "mappedfile.h"
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+class LoadPipeline;
+
+// an image texture stored as a MIP pyramid of 8x8 texel tiles, so that a filtered
+// lookup touches one or two 256 byte tiles instead of several scattered image rows
+class TiledMipMap
+{
+public:
+    static const int TILE_SIZE = 8;             // tile width and height in texels
+    static const int TILE_TEXELS = TILE_SIZE * TILE_SIZE;
+    static const int MAX_LEVELS = 16;
+
+    struct Level
+    {
+        int width, height;      // texels on this level
+        int tilesX, tilesY;     // tiles on this level
+        size_t offset;          // first texel of this level in the texel storage
+    };
+
+private:
+    std::string name;
+    std::vector<Level> levels;
+    std::vector<uint32_t> storage;      // owned RGBA8 texels, tile by tile
+    MappedFile cache;                   // texels mapped from the texture cache instead
+    uint32_t const *texels = nullptr;   // texel data used for lookups
+    int id = 0;                         // index used for lookup statistics
+    bool fromCache = false;
+    double loadSeconds = 0;
+
+public:
+    // map the pyramid of a PNG file from the texture cache, or decode the file,
+    // build the pyramid and add it to the cache
+    bool LoadFile( char const *filename );
+    // build the pyramid from RGBA8 pixels stored row by row
+    void Build( unsigned char const *rgba, int width, int height );
+
+    // filtered lookup, footprint is the width of the lookup area as a fraction of the texture
+    Color Eval( Vec3f const &uvw, float footprint ) const;
+
+    char const* GetName() const { return name.c_str(); }
+    int NumLevels() const { return int(levels.size()); }
+    Level const& GetLevel( int i ) const { return levels[i]; }
+    int GetWidth() const { return levels.empty() ? 0 : levels[0].width; }
+    int GetHeight() const { return levels.empty() ? 0 : levels[0].height; }
+    size_t TexelCount() const { return levels.empty() ? 0 : levels.back().offset + size_t(levels.back().tilesX) * levels.back().tilesY * TILE_TEXELS; }
+    size_t MemoryBytes() const { return TexelCount() * sizeof(uint32_t); }
+    bool IsFromCache() const { return fromCache; }
+    double LoadSeconds() const { return loadSeconds; }
+
+    void SetID( int i ) { id = i; }
+    int GetID() const { return id; }
+
+private:
+    size_t layout( int width, int height );
+    bool loadCache( char const *cacheFile, uint64_t hash );
+    void saveCache( char const *cacheFile, uint64_t hash ) const;
+    uint32_t texel( Level const &level, int x, int y ) const;
+    Color bilinear( int level, float u, float v ) const;
+};
+
+// build pyramids for every image texture used by the scene's materials, as tasks of the
+// pipeline; they are ready once it has run
+void BuildMipMaps( Scene const &scene, LoadPipeline &pipeline );
+
+// the pyramid that replaces a framework texture, or null if there is none
+TiledMipMap const* FindMipMap( Texture const *texture );
+
+// evaluate a textured color through its pyramid when one exists
+Color EvalFiltered( TexturedColor const &color, Vec3f const &uvw, float footprint );
+
+// texture footprint of the path this thread is currently tracing
+void SetTextureFootprint( float footprint );
+float GetTextureFootprint();
+
+// print memory use and lookups per level of every pyramid, lookups are only counted
+// when RENDER_STATS is on
+void PrintMipMapReport();
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef _OBJCACHE_H_INCLUDED_
+#define _OBJCACHE_H_INCLUDED_
+
+#include "cyVector.h"
+#include "cyTriMesh.h"
+#include "cyBVH.h"
+
+// binary copies of OBJ files, written beside each file as model.obj.cymesh once the BVH of
+// its mesh is built; they hold the mesh arrays, the material names and the tree, and later
+// loads of the unchanged file copy them into the mesh and tree instead of parsing the text
+// and building the tree, so a cached mesh takes the same memory as a parsed one
+
+// set the load hooks of cy::TriMesh and cy::BVHTriMesh, so that OBJ files are parsed on
+// several threads, their parse and tree build are traced, and, with useCache, they are read
+// from and written to their binary copies; this must be called before meshes are loaded,
+// without it files are parsed on one thread
+void SetObjLoadHooks( bool useCache );
+
+// the tree that cy::BVHTriMesh::SetMesh last built or read for the mesh since the hooks were
+// set, such as the one inside a TriObj, or null if there is none; it belongs to its owner
+// and stays valid as long as the owner does
+cy::BVHTriMesh const* ObjMeshTree( cy::TriMesh const *mesh );
+
+// the number of threads that parse each OBJ file loaded on the calling thread, zero for one
+// per core; threads that load files side by side share the cores this way
+void SetObjParseThreads( unsigned int threads );
+
+// the bounds of the vertices in the binary copy of an OBJ file, false if it has no copy of
+// the file's current contents, which are hashed when its size or time differ from the copy's
+bool ObjCacheBounds( char const *filename, cy::Vec3f &boundMin, cy::Vec3f &boundMax );
+
+#endif
@@ -0,0 +1,219 @@
+#ifndef _PACKET_H_INCLUDED_
+#define _PACKET_H_INCLUDED_
+
+#include "scene.h"
+#include "intersect.h"
+#include "instancing.h"
+#include "compactmesh.h"
+#include "renderstats.h"
+#include "cyTriMesh.h"
+#include "cyBVH.h"
+#include "tinyxml2.h"
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+
+#define PACKET_MAX_SIZE 16
+
+// rays traced together, stored one array per component so that a box test over
+// the whole packet compiles to vector instructions
+struct RayPacket
+{
+    int size = 0;
+    float ox[PACKET_MAX_SIZE], oy[PACKET_MAX_SIZE], oz[PACKET_MAX_SIZE];     // origins
+    float dx[PACKET_MAX_SIZE], dy[PACKET_MAX_SIZE], dz[PACKET_MAX_SIZE];     // directions
+    float ix[PACKET_MAX_SIZE], iy[PACKET_MAX_SIZE], iz[PACKET_MAX_SIZE];     // inverse directions
+
+    void Set( int i, Vec3f const &p, Vec3f const &dir ) {
+        ox[i] = p.x;  oy[i] = p.y;  oz[i] = p.z;
+        dx[i] = dir.x;  dy[i] = dir.y;  dz[i] = dir.z;
+        ix[i] = 1 / dir.x;  iy[i] = 1 / dir.y;  iz[i] = 1 / dir.z;
+    }
+    Ray Get( int i ) const { return Ray(Vec3f(ox[i], oy[i], oz[i]), Vec3f(dx[i], dy[i], dz[i])); }
+    uint32_t FullMask() const { return size >= 32 ? ~0u : (1u << size) - 1; }
+};
+
+// bounds of the origins and inverse directions of a packet, used to reject a box for
+// all rays at once when every ray points into the same octant
+struct PacketFrustum
+{
+    bool coherent = false;
+    float oMin[3], oMax[3];
+    float iMin[3], iMax[3];
+
+    void Init( RayPacket const &p, uint32_t active );
+    // true if no ray of the packet can cross the box before tMax
+    bool Misses( float const *bounds, float tMax ) const;
+};
+
+// slab test of every ray of a packet against a box, only crossings in front of the
+// origin and closer than the ray's current hit count; every lane is tested, so the lanes
+// past the packet size must hold rays that miss or a tMax below zero
+uint32_t PacketBoxMask( RayPacket const &p, float const *b, float const *tMax );
+
+// triangle access of a cy::TriMesh for the packet traversal
+struct TriMeshTriangles
+{
+    cy::TriMesh const *mesh;
+
+    void Vertices( unsigned int faceID, Vec3f &v0, Vec3f &v1, Vec3f &v2 ) const {
+        cy::TriMesh::TriFace const &f = mesh->F(faceID);
+        v0 = mesh->V(f.v[0]);  v1 = mesh->V(f.v[1]);  v2 = mesh->V(f.v[2]);
+    }
+    // the same hit information as TriObj
+    void SetHitInfo( unsigned int faceID, TriangleHit const &hit, HitInfo &hInfo ) const {
+        hInfo.z = hit.t;
+        hInfo.front = hit.front;
+        hInfo.p = hit.p;
+        hInfo.N = mesh->GetNormal(faceID, hit.bc);
+        hInfo.GN = hit.n_star.GetNormalized();
+        hInfo.uvw = mesh->GetTexCoord(faceID, hit.bc);
+    }
+};
+
+// triangle access of a CompactMesh for the packet traversal
+struct CompactTriangles
+{
+    CompactMesh const *mesh;
+
+    void Vertices( unsigned int faceID, Vec3f &v0, Vec3f &v1, Vec3f &v2 ) const {
+        uint32_t const *f = mesh->Face(faceID);
+        v0 = mesh->Position(f[0]);  v1 = mesh->Position(f[1]);  v2 = mesh->Position(f[2]);
+    }
+    void SetHitInfo( unsigned int faceID, TriangleHit const &hit, HitInfo &hInfo ) const {
+        mesh->SetHitInfo(faceID, hit, hInfo);
+    }
+};
+
+// closest hits of the rays of a packet with a mesh, where hits[i].z is the distance to
+// beat for ray i; returns the rays whose hit information was updated
+template <class TRIANGLES>
+class PacketTraversal
+{
+private:
+    cy::BVH const &bvh;
+    TRIANGLES const &tris;
+    RayPacket const &packet;
+    HitInfo *hits;
+    int hitSide;
+    float tMax[PACKET_MAX_SIZE];
+    PacketFrustum frustum;
+    uint32_t hitMask = 0;
+
+public:
+    PacketTraversal( cy::BVH const &b, TRIANGLES const &t, RayPacket const &p, HitInfo *h, int side )
+        : bvh(b), tris(t), packet(p), hits(h), hitSide(side) {}
+
+    uint32_t Trace( uint32_t active ) {
+        for (int i = 0; i < PACKET_MAX_SIZE; i++) tMax[i] = (active >> i) & 1 ? hits[i].z : -BIGFLOAT;
+        frustum.Init(packet, active);
+        if (bvh.GetNumNodes() > 1) traceNode(bvh.GetRootNodeID(), active);
+        return hitMask;
+    }
+
+private:
+    // the nodes are visited in the order of a recursive traversal, from a stack of the
+    // nodes and the rays that reached them, like TraceBVH
+    void traceNode( unsigned int nodeID, uint32_t mask ) {
+        struct Entry { unsigned int nodeID; uint32_t mask; };
+        Entry stack[64];
+        int top = 0;
+        stack[top++] = { nodeID, mask };
+        while (top > 0) {
+            nodeID = stack[--top].nodeID;
+            mask = stack[top].mask;
+            // counted per ray, so the numbers compare with single ray traversal
+            float const *bounds = bvh.GetNodeBounds(nodeID);
+            CountStat(STAT_BVH_NODES, __builtin_popcount(mask));
+            if (frustum.coherent) {
+                float farthest = 0;
+                for (uint32_t m = mask; m; m &= m - 1) farthest = std::max(farthest, tMax[__builtin_ctz(m)]);
+                if (frustum.Misses(bounds, farthest)) continue;
+            }
+            mask &= PacketBoxMask(packet, bounds, tMax);
+            if (!mask) continue;
+
+            // the packet has diverged to a single ray, which is cheaper to trace on its own
+            if ((mask & (mask - 1)) == 0) {
+                int i = __builtin_ctz(mask);
+                if (traceSingle(packet.Get(i), nodeID, hits[i])) {
+                    tMax[i] = hits[i].z;
+                    hitMask |= mask;
+                }
+                continue;
+            }
+
+            if (!bvh.IsLeafNode(nodeID)) {
+                // trees deeper than the stack continue in a nested call
+                if (top + 2 > 64) {
+                    traceNode(bvh.GetFirstChildNode(nodeID), mask);
+                    traceNode(bvh.GetSecondChildNode(nodeID), mask);
+                    continue;
+                }
+                stack[top++] = { bvh.GetSecondChildNode(nodeID), mask };
+                stack[top++] = { bvh.GetFirstChildNode(nodeID), mask };
+                continue;
+            }
+
+            unsigned int const *elements = bvh.GetNodeElements(nodeID);
+            CountStat(STAT_TRIANGLES, bvh.GetNodeElementCount(nodeID) * __builtin_popcount(mask));
+            for (unsigned int e = 0; e < bvh.GetNodeElementCount(nodeID); e++) {
+                Vec3f v0, v1, v2;
+                tris.Vertices(elements[e], v0, v1, v2);
+                for (uint32_t m = mask; m; m &= m - 1) {
+                    int i = __builtin_ctz(m);
+                    TriangleHit hit;
+                    if (RayTriangle(packet.Get(i), v0, v1, v2, hitSide, tMax[i], hit)) {
+                        tris.SetHitInfo(elements[e], hit, hits[i]);
+                        tMax[i] = hit.t;
+                        hitMask |= 1u << i;
+                    }
+                }
+            }
+        }
+    }
+
+    bool traceSingle( Ray const &ray, unsigned int nodeID, HitInfo &hInfo ) const {
+        return TraceBVH(bvh, ray, nodeID, [&]( unsigned int faceID ) {
+            Vec3f v0, v1, v2;
+            tris.Vertices(faceID, v0, v1, v2);
+            TriangleHit hit;
+            if (!RayTriangle(ray, v0, v1, v2, hitSide, hInfo.z, hit)) return false;
+            tris.SetHitInfo(faceID, hit, hInfo);
+            return true;
+        });
+    }
+};
+
+// closest object hits of packets of world space rays, used for camera rays
+class PacketTracer
+{
+private:
+    // how the packet traversal reaches the triangles of an instance
+    struct Target
+    {
+        Instance const *inst;
+        cy::BVH const *bvh = nullptr;       // null for objects traced one ray at a time
+        cy::TriMesh const *triMesh = nullptr;
+        CompactMesh const *compact = nullptr;
+    };
+
+    int size = 0;                           // rays per packet, zero disables packets
+    std::vector<Target> targets;
+
+public:
+    // read the <packets> element from the <scene> element, which may be null
+    bool LoadSettings( tinyxml2::XMLElement const *sceneElem );
+    // prepare the instances of the scene for packet traversal
+    void Build( std::vector<Instance> const &instances );
+
+    bool IsEnabled() const { return size > 0; }
+    int Size() const { return size; }
+
+    // closest hits of the active rays with the scene objects, hits[i] must be initialized
+    // and its node is set for every ray that hits; returns the rays that hit
+    uint32_t Trace( RayPacket const &packet, uint32_t active, HitInfo *hits, int hitSide ) const;
+};
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef _PFM_H_INCLUDED_
+#define _PFM_H_INCLUDED_
+
+#include <vector>
+
+// portable float maps, three floats per pixel with the top row first in memory;
+// the files store little endian rows from the bottom up
+
+bool SavePFM( char const *filename, int width, int height, float const *rgb );
+
+// only three channel ("PF") files are read
+bool LoadPFM( char const *filename, int &width, int &height, std::vector<float> &rgb );
+
+#endif
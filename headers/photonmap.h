@@ -0,0 +1,81 @@
+#ifndef _PHOTONMAP_H_INCLUDED_
+#define _PHOTONMAP_H_INCLUDED_
+
+#include "scene.h"
+#include "tinyxml2.h"
+
+#include <vector>
+
+// a stored photon, padded so that two photons share a cache line
+struct alignas(32) Photon
+{
+    Vec3f pos;              // hit position in world space
+    Color power;            // photon flux
+    unsigned char theta;    // quantized incoming direction
+    unsigned char phi;
+    short plane;            // kd-tree splitting axis
+
+    void SetDirection( Vec3f const &dir );
+    Vec3f GetDirection() const;
+};
+
+// result of a k-nearest photon query, kept as a max-heap on distance
+struct PhotonQuery
+{
+    int k = 0;                          // number of photons requested
+    int found = 0;                      // number of photons found
+    float maxDist2 = 0;                 // current squared search radius
+    std::vector<Photon const*> list;    // found photons
+    std::vector<float> dist2;           // squared distances of the found photons
+
+    void Init( int count, float radius ) {
+        k = count;
+        found = 0;
+        maxDist2 = radius * radius;
+        list.resize(k);
+        dist2.resize(k);
+    }
+};
+
+// a caustic photon map stored as a left-balanced kd-tree in a flat array
+class PhotonMap
+{
+private:
+    std::vector<Photon> photons;    // heap ordered tree, photons[0] is unused
+    int numPhotons = 0;             // photons stored in the tree
+
+    // settings from the scene file
+    int emitCount = 0;              // photons to emit, zero disables the photon map
+    int gatherCount = 50;           // photons used for each radiance estimate
+    float gatherRadius = 0.1f;      // largest search radius
+
+    // statistics
+    double emitSeconds = 0;
+    double buildSeconds = 0;
+
+public:
+
+    // read the <photonmap> element from the <scene> element, which may be null
+    bool LoadSettings( tinyxml2::XMLElement const *sceneElem );
+
+    bool IsEnabled() const { return emitCount > 0; }
+    bool IsEmpty() const { return numPhotons == 0; }
+    int EmitCount() const { return emitCount; }
+    int GatherCount() const { return gatherCount; }
+    float GatherRadius() const { return gatherRadius; }
+
+    // merge the photons traced by each thread and balance the tree
+    void Build( std::vector<std::vector<Photon>> &threadPhotons, double emitTime );
+
+    // find the nearest photons around a point
+    void Gather( Vec3f const &p, PhotonQuery &query ) const;
+
+    size_t MemoryBytes() const { return photons.capacity() * sizeof(Photon); }
+    void PrintStats() const;
+
+private:
+    void balance( std::vector<Photon*> &list, int index, int start, int end, int depth );
+    void locate( Vec3f const &p, int index, PhotonQuery &query ) const;
+};
+
+#endif
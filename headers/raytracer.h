@@ -4,6 +4,18 @@
 #include "renderer.h"
 #include "rng.h"
 #include "photonmap.h"
+#include "medium.h"
+#include "instancing.h"
+#include "compactmesh.h"
+#include "packet.h"
+#include "wavefront.h"
+#include "fastmath.h"
+#include "dispatch.h"
+#include "costmap.h"
+#include "lazymesh.h"
+
+#include <atomic>
+#include <chrono>
 
 // a class for using Halton sequences to produce pseudo-random samples
 // of pixels and disks
@@ -48,14 +60,16 @@ public:
 
     // get a sample within a disk, with an additional random offset and with a given radius
     std::pair<float, float> GetDiskSample(int sampleNum, float offset, float r) {
-        float radius = sqrt(radii[sampleNum]) + offset;
+        float radius = sqrtf(radii[sampleNum]) + offset;
         float theta = angles[sampleNum] + offset;
         // if (radius > 1.0f) radius -= 1.0f;
         if (radius > 1.0f) radius = 2.0f - radius;
         if (theta > 1.0f) theta -= 1.0f;
         radius *= r;
-        theta *= 2.0f * M_PI;
-        return std::pair<float, float>(radius * cos(theta), radius * sin(theta));
+        theta *= FAST_TWO_PI;
+        float sinTheta, cosTheta;
+        SinCos(theta, sinTheta, cosTheta);
+        return std::pair<float, float>(radius * cosTheta, radius * sinTheta);
     }
 };
 
@@ -85,20 +99,40 @@ private:
     PhotonMap* pMap = nullptr;              // photon map
     std::vector<Light*> lightsRenderable;   // list of renderable lights
 
-    // global volume parameters
-    float sig_a = 0.15f;
-    float sig_s = 0.06f;
-    float sig_t = sig_a + sig_s;
+    std::vector<Medium*> media;             // participating media defined in the scene file
+    std::vector<Instance const*> mediumBoundaries;  // instances of the objects that hold a medium
+    std::vector<Instance> instances;        // scene nodes with objects and their composed transforms
+    InstanceLists instanceLists;            // the same instances grouped by object type
+    LightLists lightLists;                  // renderable lights grouped by type
+    std::vector<CompactMesh*> compactMeshes;    // quantized copies that replaced large meshes
+    std::vector<LazyMesh*> lazyMeshes;      // meshes loaded when first hit, see the <lazyload> element
+    std::vector<TriObj*> loadedMeshes;      // meshes loaded by the load pipeline instead of the scene loader
+    PacketTracer packets;                   // packet traversal of camera rays
+    Wavefront wavefront;                    // batched path tracing settings
+    CostMap costMap;                        // per pixel render time and rays, when the scene asks for it
+    std::vector<Color> radiance;            // linear pixel colors of the last render, before any tone mapping
+
+    std::atomic<unsigned long long> cameraRays{0};            // camera rays traced
+    std::chrono::steady_clock::time_point renderStart;        // when the threads were started
 
 public:
     Raytracer(int minSamples, int maxSamples)
         : sampleMax(maxSamples), sampleMin(minSamples)
     { next = 0; pMap = new PhotonMap(); }
 
-    ~Raytracer() { if (pMap != nullptr) { delete pMap; }}
+    ~Raytracer() {
+        if (pMap != nullptr) { delete pMap; }
+        for (Medium* m : media) { delete m; }
+        for (CompactMesh* m : compactMeshes) { delete m; }
+        for (LazyMesh* m : lazyMeshes) { delete m; }
+        for (TriObj* m : loadedMeshes) { delete m; }
+    }
 
     int GetMaxBounce() const { return bounceMax; }
 
+    // linear colors of the rendered pixels, row by row from the top
+    Color const* GetRadiance() const { return radiance.data(); }
+
     bool LoadScene( char const *sceneFilename ) override;
 
     void BeginRender() override;
@@ -108,11 +142,16 @@ public:
 	bool TraceRay( Ray const &ray, HitInfo &hInfo, int hitSide=HIT_FRONT_AND_BACK ) const override;
     // trace a shadow ray through the scene
     bool ShadowTraceRay( Ray const &ray, HitInfo &hInfo, int hitSide, float t_max ) const;
+    // trace a packet of rays through the scene, returns the rays that hit something
+    uint32_t TraceRayPacket( RayPacket const &packet, HitInfo *hits, int hitSide ) const;
 
-    // search the scene tree for an intersection
-    bool SearchTree( Ray const &ray, HitInfo &hInfo, int hitSide, Node const *node ) const;
-    // search the scene tree specifically for a shadow ray intersection
-    bool ShadowSearch ( Ray const &ray, HitInfo &hInfo, Node const *node, float t_max ) const;
+    // search the flattened scene for the closest intersection
+    bool SearchInstances( Ray const &ray, HitInfo &hInfo, int hitSide ) const;
+    // search the flattened scene for any intersection closer than t_max; the surfaces of
+    // objects that hold a medium do not block shadow rays, their interior attenuates them
+    bool ShadowSearch ( Ray const &ray, HitInfo &hInfo, float t_max ) const;
+    // transmittance through all media along a shadow ray segment that ends at its hit
+    float mediaTransmittance( Ray const &ray, HitInfo const &hInfo, bool hit, SamplerInfo const &sInfo ) const;
 
     // construct a photon map
     void BuildPhotonMap() const;
@@ -122,16 +161,52 @@ private:
     cy::Vec3f CamRayDest( int i, int j, int sampleNum, float pixelOffset );
     // get a random camera ray for a specific pixel and sample number
     Ray CameraRay( int i, int j, int sampleNum, float pixelOffset, float diskOffset);
+    // number of worker threads used for rendering and photon emission
+    int threadCount() const;
     // worker thread render loop
     void RenderPixels();
+    // store the average of the samples of a pixel, returns true when it was the last pixel
+    bool finishPixel( int index, Color const &sum, float zMin, int sampNum );
+    // rays the calling thread has traced so far, for the cost map
+    uint32_t threadRayCount() const;
+    // worker thread render loop that traces batches of paths one stage at a time
+    void renderWavefront();
+    // find the closest hits of the active paths
+    void extendPaths( PathStates &paths, std::vector<int> const &active ) const;
+    // shade the hit of a path and set up its next ray, returns false when the path ends
+    bool shadePath( int p, PathStates &paths, ShadowQueue &shadows, SamplerInfo &sInfo );
+    // trace the queued shadow rays and add the light of the visible ones to their paths
+    void traceShadows( PathStates &paths, ShadowQueue const &shadows, SamplerInfo &sInfo ) const;
     // a single sample of a specific pixel
     Color samplePixel( float pixelOffset, float dofOffset, int sampleNum, HitInfo& info, SamplerInfo& sInfo, float& z );
+    // samples of a pixel whose camera rays are traced as one packet
+    Color samplePacket( float pixelOffset, float dofOffset, int firstSample, int count, SamplerInfo& sInfo, RNG& rng, float& zMin );
     // trace a path through the scene
     Color tracePath( Ray ray, SamplerInfo sInfo, HitInfo& hInfo, int bounce=0 );
+    // continue a path from a ray whose hit has already been found
+    Color continuePath( Ray const &ray, SamplerInfo sInfo, HitInfo& hInfo, bool hit, int bounce );
+    // closest hit with the renderable lights
+    bool traceLights( Ray const &ray, HitInfo &hInfo, int hitSide ) const;
+    // camera ray throughput of the finished render, timed only with RENDER_STATS
+    void printCameraRayStats() const;
+    // path throughput of the finished render
+    void printPathStats() const;
     // light energy output based on a material surface as opposed to a volume
     Color materialSample( Ray ray, SamplerInfo sInfo, HitInfo& hInfo, int bounce=0 );
     // select a random light in the scene
     Light* randomLight(SamplerInfo const &sInfo);
+    // radiance along a ray that leaves the scene
+    Color missColor( Ray const &ray, SamplerInfo const &sInfo, int bounce ) const;
+    // the instance is the surface of an object that holds a medium
+    bool isMediumBoundary( Instance const &inst ) const;
+    // sample the nearest real collision with any medium along a ray segment
+    Medium const* sampleMedia( Ray const &ray, HitInfo const &hInfo, bool hit, SamplerInfo const &sInfo, float &t ) const;
+    // the centers of the renderable lights, which photons are emitted from
+    void lightCenters( std::vector<Vec3f> &centers ) const;
+    // emit photons from the lights and keep the ones that land on a surface after a specular bounce
+    void emitPhotons( int seed, int count, std::vector<Vec3f> const &centers, std::vector<Photon> &stored ) const;
+    // radiance estimate of the caustic photons around a hit point
+    Color causticRadiance( SamplerInfo const &sInfo, HitInfo const &hInfo ) const;
 };
 
 extern Raytracer tracer;
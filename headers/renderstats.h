@@ -0,0 +1,122 @@
+#ifndef _RENDERSTATS_H_INCLUDED_
+#define _RENDERSTATS_H_INCLUDED_
+
+#include <cstddef>
+#include <chrono>
+
+namespace tinyxml2 { class XMLElement; }
+
+// build with -DRENDER_STATS=1 to compile the counters and timers in
+#ifndef RENDER_STATS
+#define RENDER_STATS 0
+#endif
+
+// build with -DRENDER_ALLOC_STATS=1 to count heap allocations as well
+#ifndef RENDER_ALLOC_STATS
+#define RENDER_ALLOC_STATS 0
+#endif
+
+enum StatCounter
+{
+    STAT_CAMERA_RAYS,
+    STAT_RAYS,              // closest hit rays, camera rays included
+    STAT_SHADOW_RAYS,
+    STAT_BVH_NODES,         // BVH nodes whose box was tested
+    STAT_TRIANGLES,         // ray triangle tests
+    STAT_PATH_SEGMENTS,     // hits shaded along paths, divided by camera rays gives the path length
+    STAT_NEE_SAMPLES,       // light samples tested with a shadow ray
+    STAT_NEE_VISIBLE,       // of those, the ones that reached the light
+    STAT_PHOTON_QUERIES,    // caustic photon map searches
+    STAT_PHOTONS_GATHERED,  // photons found by them
+    STAT_PHOTON_GATHER_NS,  // time spent in them, also counted in the timer they run under
+    STAT_CAMERA_RAY_NS,     // time spent finding the closest hits of camera rays, alone or in packets
+    STAT_COUNTER_COUNT
+};
+
+// exclusive time categories, time spent in a nested category is only counted there
+enum StatTimer
+{
+    TIMER_OTHER,            // camera rays, pixel output and anything outside the other categories
+    TIMER_INTERSECT,
+    TIMER_SHADE,
+    TIMER_LIGHTS,
+    TIMER_COUNT
+};
+
+// the counters of one thread, only written by that thread
+struct RenderStats
+{
+    unsigned long long counters[STAT_COUNTER_COUNT] = {};
+    unsigned long long nanoseconds[TIMER_COUNT] = {};
+
+    // time keeping of the category the thread is in
+    StatTimer current = TIMER_OTHER;
+    std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
+
+    void Add( RenderStats const &s );
+};
+
+// a new set of counters for the calling thread, included in the sums from then on
+RenderStats* RegisterRenderStats();
+
+// the calling thread's counters, the traversal loops count into them on every node
+inline RenderStats& ThreadRenderStats() {
+    static thread_local RenderStats *stats = nullptr;
+    if (!stats) stats = RegisterRenderStats();
+    return *stats;
+}
+
+inline void CountStat( StatCounter c, unsigned long long n = 1 ) {
+#if RENDER_STATS
+    ThreadRenderStats().counters[c] += n;
+#else
+    (void)c; (void)n;
+#endif
+}
+
+// charge the time until the end of the scope to a category, and give the enclosing
+// category back its time afterwards
+class StatTimerScope
+{
+#if RENDER_STATS
+    RenderStats &stats;
+    StatTimer previous;
+
+    void switchTo( StatTimer t ) {
+        auto now = std::chrono::steady_clock::now();
+        stats.nanoseconds[stats.current] += std::chrono::duration_cast<std::chrono::nanoseconds>(now - stats.last).count();
+        stats.last = now;
+        stats.current = t;
+    }
+public:
+    explicit StatTimerScope( StatTimer t ) : stats(ThreadRenderStats()), previous(stats.current) { switchTo(t); }
+    ~StatTimerScope() { switchTo(previous); }
+#else
+public:
+    explicit StatTimerScope( StatTimer ) {}
+#endif
+    StatTimerScope( StatTimerScope const & ) = delete;
+    StatTimerScope& operator=( StatTimerScope const & ) = delete;
+};
+
+// heap allocations of the whole process so far, counted by the replaced operator new
+// when RENDER_ALLOC_STATS is on and zero otherwise
+unsigned long long HeapAllocations();
+
+// largest resident memory of the process so far, in bytes
+size_t PeakMemoryBytes();
+
+// clear the counters of every thread, before a render starts
+void ResetRenderStats();
+
+// the counters of all threads added up
+RenderStats TotalRenderStats();
+
+// read the <renderstats> element of the <scene> element, which may be null, whose "json"
+// attribute names a file for the report
+bool LoadRenderStatsSettings( tinyxml2::XMLElement const *sceneElem );
+
+// sum the counters of all threads and print them, and write them as JSON when requested
+void PrintRenderStats( double renderSeconds, int threads );
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef _TRACE_H_INCLUDED_
+#define _TRACE_H_INCLUDED_
+
+#include <cstdint>
+#include <chrono>
+#include <vector>
+
+// timeline of named scopes, written at exit as Chrome trace JSON that chrome://tracing
+// and ui.perfetto.dev open; build with -DRENDER_TRACE=1 to record it, and set
+// RENDER_TRACE_FILE to change the file from trace.json
+#ifndef RENDER_TRACE
+#define RENDER_TRACE 0
+#endif
+
+struct TraceEvent
+{
+    char const *name;       // a string literal, only the pointer is kept
+    uint64_t start;         // nanoseconds since the first event of the process
+    uint64_t duration;
+};
+
+// the events of one thread, only written by that thread
+struct TraceBuffer
+{
+    std::vector<TraceEvent> events;
+    char const *threadName = nullptr;
+    int id = 0;
+};
+
+// a new buffer for the calling thread, written out with the others at exit
+TraceBuffer* RegisterTraceBuffer();
+
+inline TraceBuffer& ThreadTraceBuffer() {
+    static thread_local TraceBuffer *buffer = nullptr;
+    if (!buffer) buffer = RegisterTraceBuffer();
+    return *buffer;
+}
+
+inline uint64_t TraceNow() {
+    static const std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count());
+}
+
+inline void TraceRecord( char const *name, uint64_t start, uint64_t end ) {
+    ThreadTraceBuffer().events.push_back({ name, start, end - start });
+}
+
+// label the calling thread in the timeline
+inline void TraceThreadName( char const *name ) {
+#if RENDER_TRACE
+    ThreadTraceBuffer().threadName = name;
+#else
+    (void)name;
+#endif
+}
+
+class TraceScope
+{
+    char const *name;
+    uint64_t start;
+public:
+    explicit TraceScope( char const *n ) : name(n), start(TraceNow()) {}
+    ~TraceScope() { TraceRecord(name, start, TraceNow()); }
+    TraceScope( TraceScope const & ) = delete;
+    TraceScope& operator=( TraceScope const & ) = delete;
+};
+
+// one event for every run of a number of steps, for loops whose iterations are too
+// short and too many to trace one by one
+class TraceRun
+{
+#if RENDER_TRACE
+    char const *name;
+    int length;
+    int steps = 0;
+    uint64_t start;
+public:
+    TraceRun( char const *n, int len ) : name(n), length(len), start(TraceNow()) {}
+    ~TraceRun() { if (steps > 0) TraceRecord(name, start, TraceNow()); }
+    void Step() {
+        if (++steps < length) return;
+        uint64_t now = TraceNow();
+        TraceRecord(name, start, now);
+        start = now;
+        steps = 0;
+    }
+#else
+public:
+    TraceRun( char const *, int ) {}
+    void Step() {}
+#endif
+    TraceRun( TraceRun const & ) = delete;
+    TraceRun& operator=( TraceRun const & ) = delete;
+};
+
+#if RENDER_TRACE
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+// record the time from here to the end of the enclosing scope
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#else
+#define TRACE_SCOPE(name) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef _WAVEFRONT_H_INCLUDED_
+#define _WAVEFRONT_H_INCLUDED_
+
+#include "scene.h"
+#include "tinyxml2.h"
+
+#include <vector>
+#include <cstdint>
+
+// the paths of a wavefront batch, one array per field so that each stage only touches
+// the fields it needs
+struct PathStates
+{
+    std::vector<Vec3f> origin, dir;         // ray of the next extension
+    std::vector<HitInfo> hit;               // closest hit of that ray
+    std::vector<uint8_t> hitSomething;
+    std::vector<Color> throughput;          // product of the path weights so far
+    std::vector<Color> radiance;            // radiance gathered so far
+    std::vector<float> footprint;           // texture footprint of the next hit
+    std::vector<int> bounce;
+    std::vector<int> pixel;                 // index of the pixel in the batch
+    std::vector<int> sample;                // pixel sample number
+
+    int Size() const { return (int)origin.size(); }
+    void Resize( int n );
+};
+
+// shadow rays queued by shading, each adds its contribution to its path when it reaches
+// the sampled light
+struct ShadowQueue
+{
+    std::vector<Vec3f> origin, dir;         // the light sample is at origin + dir
+    std::vector<Light const*> light;
+    std::vector<Color> contribution;        // radiance added if the light is visible
+    std::vector<float> lightProb;           // for samples from inside a medium, zero otherwise
+    std::vector<int> path;
+
+    int Size() const { return (int)origin.size(); }
+    void Clear();
+    void Push( int p, Vec3f const &o, Vec3f const &d, Light const *l, Color const &c, float prob=0 );
+};
+
+// settings of the wavefront integrator, read from the <wavefront> element
+class Wavefront
+{
+private:
+    int paths = 0;          // paths in flight per thread, zero renders one path at a time
+    bool sortRays = true;   // sort by direction before tracing and by material before shading
+
+public:
+    // read the <wavefront> element from the <scene> element, which may be null
+    bool LoadSettings( tinyxml2::XMLElement const *sceneElem );
+
+    bool IsEnabled() const { return paths > 0; }
+    int Paths() const { return paths; }
+    bool SortRays() const { return sortRays; }
+};
+
+// reorder active path indices so that rays with similar directions are traced together
+void SortByDirection( std::vector<int> &active, PathStates const &states, std::vector<uint64_t> &keys );
+// reorder active path indices so that hits on the same material are shaded together
+void SortByMaterial( std::vector<int> &active, PathStates const &states, std::vector<uint64_t> &keys );
+
+#endif
@@ -0,0 +1,303 @@
+#include "compactmesh.h"
+#include "objects.h"
+#include "intersect.h"
+#include "renderstats.h"
+#include "trace.h"
+#include "cpudispatch.h"
+#include "objcache.h"
+#include "tinyxml2.h"
+
+#include <algorithm>
+#include <iostream>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+// IEEE half float with round to nearest even
+static uint16_t floatToHalf( float f ) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    uint32_t sign = (x >> 16) & 0x8000;
+    uint32_t mant = x & 0x7fffff;
+    int exp = int((x >> 23) & 0xff) - 127 + 15;
+
+    if (((x >> 23) & 0xff) == 0xff) return sign | 0x7c00 | (mant ? 0x200 : 0);    // inf and nan
+    if (exp >= 31) return sign | 0x7c00;    // too large
+    if (exp <= 0) {
+        // subnormal half
+        if (exp < -10) return sign;
+        mant |= 0x800000;
+        uint32_t shift = 14 - exp;
+        uint32_t half = mant >> shift;
+        uint32_t rem = mant & ((1u << shift) - 1);
+        uint32_t mid = 1u << (shift - 1);
+        if (rem > mid || (rem == mid && (half & 1))) half++;
+        return sign | half;
+    }
+    uint32_t half = (uint32_t(exp) << 10) | (mant >> 13);
+    uint32_t rem = mant & 0x1fff;
+    if (rem > 0x1000 || (rem == 0x1000 && (half & 1))) half++;  // a carry rounds up to the next exponent
+    return sign | half;
+}
+
+static float halfToFloat( uint16_t h ) {
+    uint32_t sign = uint32_t(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    if (exp == 0) {
+        float f = mant * (1.0f / 16777216.0f);
+        return sign ? -f : f;
+    }
+    uint32_t x = exp == 31 ? sign | 0x7f800000 | (mant << 13) : sign | ((exp + 112) << 23) | (mant << 13);
+    float f;
+    memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+static float signNotZero( float v ) { return v >= 0 ? 1.0f : -1.0f; }
+
+// map a direction onto the octahedron and unfold it into the unit square
+static void encodeOctahedral( Vec3f n, int16_t out[2] ) {
+    float len = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    if (len == 0) n = Vec3f(0, 0, 1);
+    else n /= len;
+
+    float x = n.x, y = n.y;
+    if (n.z < 0) {
+        x = (1 - std::abs(n.y)) * signNotZero(n.x);
+        y = (1 - std::abs(n.x)) * signNotZero(n.y);
+    }
+    out[0] = int16_t(std::lround(Max(-1.0f, Min(1.0f, x)) * 32767));
+    out[1] = int16_t(std::lround(Max(-1.0f, Min(1.0f, y)) * 32767));
+}
+
+static Vec3f decodeOctahedral( int16_t const in[2] ) {
+    Vec3f n(in[0] / 32767.0f, in[1] / 32767.0f, 0);
+    n.z = 1 - std::abs(n.x) - std::abs(n.y);
+    if (n.z < 0) {
+        float x = n.x;
+        n.x = (1 - std::abs(n.y)) * signNotZero(x);
+        n.y = (1 - std::abs(x)) * signNotZero(n.y);
+    }
+    return n.GetNormalized();
+}
+
+static uint16_t quantize( float v, float min, float step ) {
+    if (step == 0) return 0;
+    return uint16_t(Max(0L, Min(65535L, std::lround((v - min) / step))));
+}
+
+static void growBounds( Vec3f &bmin, Vec3f &bmax, Vec3f const &p ) {
+    for (int a = 0; a < 3; a++) {
+        bmin[a] = Min(bmin[a], p[a]);
+        bmax[a] = Max(bmax[a], p[a]);
+    }
+}
+
+// identical encoded vertices are merged, whichever face corners they came from
+struct CompactVertexHash
+{
+    size_t operator()( CompactVertex const &v ) const {
+        uint64_t w[2];
+        memcpy(w, &v, sizeof(w));
+        return size_t(w[0] * 0x9e3779b97f4a7c15ULL ^ w[1]);
+    }
+};
+
+struct CompactVertexEqual
+{
+    bool operator()( CompactVertex const &a, CompactVertex const &b ) const { return memcmp(&a, &b, sizeof(a)) == 0; }
+};
+
+void CompactMesh::Build( cy::TriMesh const &mesh ) {
+    vertices.clear();
+    indices.clear();
+
+    boundMin = mesh.NV() ? mesh.V(0) : Vec3f(0, 0, 0);
+    boundMax = boundMin;
+    for (unsigned int i = 1; i < mesh.NV(); i++) {
+        growBounds(boundMin, boundMax, mesh.V(i));
+    }
+    step = (boundMax - boundMin) / 65535.0f;
+
+    std::unordered_map<CompactVertex, uint32_t, CompactVertexHash, CompactVertexEqual> unique;
+    unique.reserve(mesh.NV());
+    indices.resize(size_t(mesh.NF()) * 3);
+
+    for (unsigned int f = 0; f < mesh.NF(); f++) {
+        cy::TriMesh::TriFace const &face = mesh.F(f);
+        Vec3f faceNormal = (mesh.V(face.v[1]) - mesh.V(face.v[0])).Cross(mesh.V(face.v[2]) - mesh.V(face.v[0]));
+
+        for (int c = 0; c < 3; c++) {
+            CompactVertex v;
+            memset(&v, 0, sizeof(v));
+
+            Vec3f p = mesh.V(face.v[c]);
+            v.pos[0] = quantize(p.x, boundMin.x, step.x);
+            v.pos[1] = quantize(p.y, boundMin.y, step.y);
+            v.pos[2] = quantize(p.z, boundMin.z, step.z);
+
+            encodeOctahedral(mesh.HasNormals() ? mesh.VN(mesh.FN(f).v[c]) : faceNormal, v.normal);
+
+            if (mesh.HasTextureVertices()) {
+                Vec3f uv = mesh.VT(mesh.FT(f).v[c]);
+                v.uv[0] = floatToHalf(uv.x);
+                v.uv[1] = floatToHalf(uv.y);
+            }
+
+            auto it = unique.emplace(v, uint32_t(vertices.size()));
+            if (it.second) vertices.push_back(v);
+            indices[size_t(f) * 3 + c] = it.first->second;
+        }
+    }
+    vertices.shrink_to_fit();
+
+    // the bounds of the decoded positions, which can differ from the source by half a step
+    // boundMin stays the quantization origin, so it is only updated at the end
+    if (!vertices.empty()) {
+        Vec3f decodedMin = Position(0), decodedMax = Position(0);
+        for (unsigned int i = 1; i < NV(); i++) {
+            growBounds(decodedMin, decodedMax, Position(i));
+        }
+        boundMin = decodedMin;
+        boundMax = decodedMax;
+    }
+
+    bvh.mesh = this;
+    bvh.Build(NF(), 4);
+
+    // store the faces in tree order so that the faces of a leaf are consecutive
+    std::vector<uint32_t> ordered(indices.size());
+    unsigned int const *order = bvh.GetElementData();
+    for (unsigned int i = 0; i < NF(); i++) {
+        memcpy(&ordered[size_t(i) * 3], &indices[size_t(order[i]) * 3], 3 * sizeof(uint32_t));
+    }
+    indices.swap(ordered);
+    bvh.SetSequentialElements();
+}
+
+Vec3f CompactMesh::Normal( unsigned int v ) const {
+    return decodeOctahedral(vertices[v].normal);
+}
+
+Vec3f CompactMesh::TexCoord( unsigned int v ) const {
+    return Vec3f(halfToFloat(vertices[v].uv[0]), halfToFloat(vertices[v].uv[1]), 0);
+}
+
+void CompactMesh::Hierarchy::GetElementBounds( unsigned int i, float box[6] ) const {
+    uint32_t const *f = &mesh->indices[size_t(i) * 3];
+    Vec3f p = mesh->Position(f[0]);
+    box[0] = box[3] = p.x;
+    box[1] = box[4] = p.y;
+    box[2] = box[5] = p.z;
+    for (int j = 1; j < 3; j++) {
+        Vec3f q = mesh->Position(f[j]);
+        for (int k = 0; k < 3; k++) {
+            box[k] = Min(box[k], q[k]);
+            box[k + 3] = Max(box[k + 3], q[k]);
+        }
+    }
+}
+
+float CompactMesh::Hierarchy::GetElementCenter( unsigned int i, int dim ) const {
+    uint32_t const *f = &mesh->indices[size_t(i) * 3];
+    return (mesh->Position(f[0])[dim] + mesh->Position(f[1])[dim] + mesh->Position(f[2])[dim]) / 3.0f;
+}
+
+bool CompactMesh::IntersectRay( Ray const &ray, HitInfo &hInfo, int hitSide ) const {
+    if (indices.empty()) return false;
+    return traceNode(ray, hInfo, hitSide, bvh.GetRootNodeID());
+}
+
+bool CompactMesh::intersectTriangle( Ray const &ray, HitInfo &hInfo, int hitSide, unsigned int faceID ) const {
+    uint32_t const *f = Face(faceID);
+    TriangleHit hit;
+    if (!RayTriangle(ray, Position(f[0]), Position(f[1]), Position(f[2]), hitSide, hInfo.z, hit)) return false;
+    SetHitInfo(faceID, hit, hInfo);
+    return true;
+}
+
+void CompactMesh::SetHitInfo( unsigned int faceID, TriangleHit const &hit, HitInfo &hInfo ) const {
+    // normals and texture coordinates are only decoded for hits
+    uint32_t const *f = Face(faceID);
+    hInfo.z = hit.t;
+    hInfo.front = hit.front;
+    hInfo.p = hit.p;
+    hInfo.N = Normal(f[0]) * hit.bc.x + Normal(f[1]) * hit.bc.y + Normal(f[2]) * hit.bc.z;
+    hInfo.GN = hit.n_star.GetNormalized();
+    hInfo.uvw = TexCoord(f[0]) * hit.bc.x + TexCoord(f[1]) * hit.bc.y + TexCoord(f[2]) * hit.bc.z;
+}
+
+CPU_DISPATCH bool CompactMesh::traceNode( Ray const &ray, HitInfo &hInfo, int hitSide, unsigned int nodeID ) const {
+    return TraceBVH(bvh, ray, nodeID, [&]( unsigned int faceID ) {
+        return intersectTriangle(ray, hInfo, hitSide, faceID);
+    });
+}
+
+size_t BVHBytes( cy::BVH const &bvh ) {
+    return cy::BVH::NodeSize() * bvh.GetNumNodes() + sizeof(unsigned int) * bvh.GetNumElements();
+}
+
+size_t TriMeshBytes( cy::TriMesh const &mesh ) {
+    size_t faces = sizeof(cy::TriMesh::TriFace) * mesh.NF();
+    size_t bytes = sizeof(Vec3f) * (mesh.NV() + mesh.NVT() + mesh.NVN()) + faces;
+    if (mesh.HasTextureVertices()) bytes += faces;
+    if (mesh.HasNormals()) bytes += faces;
+    if (cy::BVHTriMesh const *bvh = ObjMeshTree(&mesh)) bytes += BVHBytes(*bvh);
+    return bytes + mesh.NM() * (sizeof(cy::TriMesh::Mtl) + sizeof(int));
+}
+
+static void compactMeshes( Node *node, unsigned int minFaces, std::unordered_map<TriObj*, CompactMesh*> &converted,
+                           std::vector<CompactMesh*> &meshes, CompactStats &stats ) {
+    TriObj *mesh = dynamic_cast<TriObj*>(node->GetNodeObj());
+    if (mesh && mesh->NF() >= minFaces && mesh->NF() > 0) {
+        // meshes shared between nodes are converted once
+        auto it = converted.find(mesh);
+        if (it == converted.end()) {
+            CompactMesh *compact = new CompactMesh();
+            compact->Build(*mesh);
+            stats.meshes++;
+            stats.faces += mesh->NF();
+            stats.bytesBefore += TriMeshBytes(*mesh);
+            stats.bytesAfter += compact->MemoryBytes();
+            meshes.push_back(compact);
+            it = converted.emplace(mesh, compact).first;
+        }
+        node->SetNodeObj(it->second);
+    }
+    for (int i = 0; i < node->GetNumChild(); i++) {
+        compactMeshes(node->GetChild(i), minFaces, converted, meshes, stats);
+    }
+}
+
+CompactStats CompactMeshes( tinyxml2::XMLElement const *sceneElem, Node &rootNode, std::vector<CompactMesh*> &meshes,
+                            std::vector<TriObj*> &ownedMeshes ) {
+    TRACE_SCOPE("CompactMeshes");
+    CompactStats stats;
+
+    tinyxml2::XMLElement const *e = sceneElem ? sceneElem->FirstChildElement("compactmesh") : nullptr;
+    if (!e) return stats;
+
+    unsigned int minFaces = 0;
+    e->QueryUnsignedAttribute("minfaces", &minFaces);
+
+    std::unordered_map<TriObj*, CompactMesh*> converted;
+    compactMeshes(&rootNode, minFaces, converted, meshes, stats);
+
+    // no node refers to the original meshes any more; the ones loaded by the tracer are
+    // deleted with their trees, the scene loader owns the others, so only their arrays go
+    for (auto const &c : converted) {
+        auto owned = std::find(ownedMeshes.begin(), ownedMeshes.end(), c.first);
+        if (owned != ownedMeshes.end()) {
+            ownedMeshes.erase(owned);
+            delete c.first;
+        }
+        else c.first->Clear();
+    }
+
+    if (stats.meshes > 0) {
+        fprintf(stdout, "Compact meshes: %d (%llu triangles), %.2f MB -> %.2f MB\n",
+                stats.meshes, stats.faces, stats.bytesBefore / (1024.0 * 1024.0), stats.bytesAfter / (1024.0 * 1024.0));
+    }
+    return stats;
+}
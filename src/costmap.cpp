@@ -0,0 +1,82 @@
+#include "costmap.h"
+#include "tinyxml2.h"
+#include "lodepng.h"
+#include "pfm.h"
+
+#include <cstdio>
+#include <algorithm>
+
+bool CostMap::LoadSettings( tinyxml2::XMLElement const *sceneElem ) {
+    pngFile.clear();
+    pfmFile.clear();
+    if (!sceneElem) return false;
+
+    tinyxml2::XMLElement const *e = sceneElem->FirstChildElement("costmap");
+    if (!e) return true;
+    char const *png = e->Attribute("png");
+    char const *pfm = e->Attribute("pfm");
+    char const *measure = e->Attribute("measure");
+    pngFile = png ? png : (pfm ? "" : "cost.png");
+    pfmFile = pfm ? pfm : "";
+    showRays = measure && std::string(measure) == "rays";
+    return true;
+}
+
+void CostMap::Init( int w, int h ) {
+    width = w;
+    height = h;
+    seconds.assign(size_t(w) * h, 0.0f);
+    rays.assign(size_t(w) * h, 0);
+}
+
+bool CostMap::Save() const {
+    bool saved = true;
+    if (!pngFile.empty()) saved = SavePNG(pngFile.c_str(), showRays) && saved;
+    if (!pfmFile.empty()) saved = SavePFM(pfmFile.c_str()) && saved;
+    return saved;
+}
+
+// blue, cyan, green, yellow, red for t from 0 to 1
+static void falseColor( float t, unsigned char *rgb ) {
+    static const float stops[5][3] = { {0, 0, 1}, {0, 1, 1}, {0, 1, 0}, {1, 1, 0}, {1, 0, 0} };
+    t = std::min(std::max(t, 0.0f), 1.0f) * 4;
+    int i = std::min(int(t), 3);
+    float f = t - i;
+    for (int c = 0; c < 3; c++) {
+        rgb[c] = (unsigned char)(255.0f * (stops[i][c] * (1 - f) + stops[i + 1][c] * f) + 0.5f);
+    }
+}
+
+bool CostMap::SavePNG( char const *filename, bool byRays ) const {
+    size_t n = seconds.size();
+    if (n == 0) return false;
+    std::vector<float> values(n);
+    for (size_t i = 0; i < n; i++) values[i] = byRays ? float(rays[i]) : seconds[i];
+
+    // a few pathological pixels would leave the rest of the image blue
+    std::vector<float> sorted(values);
+    size_t k = std::min(n - 1, n * 99 / 100);
+    std::nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+    float scale = sorted[k] > 0 ? 1 / sorted[k] : 0;
+
+    std::vector<unsigned char> rgb(n * 3);
+    for (size_t i = 0; i < n; i++) falseColor(values[i] * scale, &rgb[i * 3]);
+    unsigned error = lodepng::encode(filename, rgb, width, height, LCT_RGB, 8);
+    if (error) {
+        fprintf(stderr, "Cannot write %s: %s\n", filename, lodepng_error_text(error));
+        return false;
+    }
+    if (byRays) fprintf(stdout, "Cost map %s: red is %.0f rays per pixel\n", filename, sorted[k]);
+    else fprintf(stdout, "Cost map %s: red is %.3f ms per pixel\n", filename, sorted[k] * 1e3f);
+    return true;
+}
+
+bool CostMap::SavePFM( char const *filename ) const {
+    std::vector<float> rgb(seconds.size() * 3);
+    for (size_t i = 0; i < seconds.size(); i++) {
+        rgb[i * 3 + 0] = seconds[i] * 1e6f;
+        rgb[i * 3 + 1] = float(rays[i]);
+        rgb[i * 3 + 2] = 0;
+    }
+    return ::SavePFM(filename, width, height, rgb.data());
+}
@@ -0,0 +1,33 @@
+#include "dispatch.h"
+
+void InstanceLists::Build( std::vector<Instance> const &instances ) {
+    spheres.clear();
+    planes.clear();
+    meshes.clear();
+    compactMeshes.clear();
+    others.clear();
+
+    // exact types only, a subclass may override the intersection
+    for (Instance const &inst : instances) {
+        std::type_info const &type = typeid(*inst.obj);
+        if (type == typeid(Sphere)) spheres.push_back(inst);
+        else if (type == typeid(Plane)) planes.push_back(inst);
+        else if (type == typeid(TriObj)) meshes.push_back(inst);
+        else if (type == typeid(CompactMesh)) compactMeshes.push_back(inst);
+        else others.push_back(inst);
+    }
+}
+
+void LightLists::Build( LightList const &lights ) {
+    points.clear();
+    spots.clear();
+    others.clear();
+
+    for (Light *light : lights) {
+        if (!light->IsRenderable()) continue;
+        std::type_info const &type = typeid(*light);
+        if (type == typeid(PointLight)) points.push_back(light);
+        else if (type == typeid(SpotLight)) spots.push_back(light);
+        else others.push_back(light);
+    }
+}
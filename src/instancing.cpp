@@ -0,0 +1,72 @@
+#include "instancing.h"
+#include "objects.h"
+#include "compactmesh.h"
+#include "trace.h"
+
+#include <iostream>
+#include <unordered_set>
+
+static void countMeshInstances( Node const *node, std::unordered_set<TriObj const*> &meshes, InstancingStats &stats ) {
+    TriObj const *mesh = dynamic_cast<TriObj const*>(node->GetNodeObj());
+    if (mesh) {
+        stats.instances++;
+        stats.instancedTriangles += mesh->NF();
+        if (meshes.insert(mesh).second) {
+            stats.uniqueMeshes++;
+            stats.uniqueTriangles += mesh->NF();
+        }
+        else {
+            stats.bytesSaved += TriMeshBytes(*mesh);
+        }
+    }
+    for (int i = 0; i < node->GetNumChild(); i++) {
+        countMeshInstances(node->GetChild(i), meshes, stats);
+    }
+}
+
+InstancingStats CountMeshInstances( Node const &rootNode ) {
+    TRACE_SCOPE("CountMeshInstances");
+    InstancingStats stats;
+    std::unordered_set<TriObj const*> meshes;
+    countMeshInstances(&rootNode, meshes, stats);
+
+    if (stats.instances > stats.uniqueMeshes) {
+        fprintf(stdout, "Meshes: %d unique (%llu triangles), %d instances (%llu triangles), %.2f MB saved\n",
+                stats.uniqueMeshes, stats.uniqueTriangles, stats.instances, stats.instancedTriangles,
+                stats.bytesSaved / (1024.0 * 1024.0));
+    }
+    return stats;
+}
+
+static void buildInstances( Node const *node, Matrix3f const &toObj, Vec3f const &toObjPos,
+                            Matrix3f const &toWorld, Vec3f const &toWorldPos, std::vector<Instance> &instances ) {
+    // compose this node's transform with its parent's, the same as ToNodeCoords and
+    // FromNodeCoords applied at every level
+    Matrix3f const &itm = node->GetInverseTransform();
+    Matrix3f nodeToObj = itm * toObj;
+    Vec3f nodeToObjPos = itm * (toObjPos - node->GetPosition());
+    Matrix3f nodeToWorld = toWorld * node->GetTransform();
+    Vec3f nodeToWorldPos = toWorld * node->GetPosition() + toWorldPos;
+
+    if (node->GetNodeObj()) {
+        Instance inst;
+        inst.node = node;
+        inst.obj = node->GetNodeObj();
+        inst.toObj = nodeToObj;
+        inst.toObjPos = nodeToObjPos;
+        inst.toWorld = nodeToWorld;
+        inst.toWorldPos = nodeToWorldPos;
+        instances.push_back(inst);
+    }
+    for (int i = 0; i < node->GetNumChild(); i++) {
+        buildInstances(node->GetChild(i), nodeToObj, nodeToObjPos, nodeToWorld, nodeToWorldPos, instances);
+    }
+}
+
+void BuildInstances( Node const &rootNode, std::vector<Instance> &instances ) {
+    TRACE_SCOPE("BuildInstances");
+    instances.clear();
+    Matrix3f identity;
+    identity.SetIdentity();
+    buildInstances(&rootNode, identity, Vec3f(0, 0, 0), identity, Vec3f(0, 0, 0), instances);
+}
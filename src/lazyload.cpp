@@ -0,0 +1,206 @@
+#include "lazyload.h"
+#include "tinyxml2.h"
+
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+
+// pin tick of a thread that is not using lazily loaded data
+static const uint64_t IDLE = ~uint64_t(0);
+
+struct PinSlot
+{
+    std::atomic<uint64_t> tick{IDLE};
+};
+
+static bool lazyEnabled = false;
+static size_t memoryBudget = 0;         // bytes, zero for no budget
+
+class LazyCache
+{
+public:
+    struct Retired
+    {
+        LazyItem *item;
+        void *data;
+        uint64_t tick;      // clock when it was unloaded
+    };
+
+    static std::mutex mutex;                // guards everything below but the atomics
+    static std::vector<LazyItem*> items;
+    static std::vector<PinSlot*> slots;
+    static std::vector<Retired> retired;
+    static std::atomic<size_t> retiredCount;
+    static std::atomic<uint64_t> clock;     // advanced by every pin and unload
+    static size_t resident;
+    static size_t peakResident;
+    static unsigned long long loads;
+    static unsigned long long unloads;
+
+    static PinSlot& threadSlot() {
+        // never freed, slots of finished threads stay idle
+        static thread_local PinSlot *slot = nullptr;
+        if (!slot) {
+            slot = new PinSlot();
+            std::lock_guard<std::mutex> lock(mutex);
+            slots.push_back(slot);
+        }
+        return *slot;
+    }
+
+    // count a newly loaded item and unload the least recently used ones over the budget
+    static void loaded( LazyItem const *item, size_t itemBytes ) {
+        std::lock_guard<std::mutex> lock(mutex);
+        loads++;
+        resident += itemBytes;
+        peakResident = std::max(peakResident, resident);
+        while (memoryBudget > 0 && resident > memoryBudget) {
+            LazyItem *lru = nullptr;
+            for (LazyItem *i : items) {
+                if (i == item || !i->data.load()) continue;
+                if (!lru || i->lastUse.load(std::memory_order_relaxed) < lru->lastUse.load(std::memory_order_relaxed)) lru = i;
+            }
+            if (!lru) break;
+            void *d;
+            size_t lruBytes;
+            {
+                // bytes changes when the item loads again
+                std::lock_guard<std::mutex> itemLock(lru->loadMutex);
+                d = lru->data.exchange(nullptr);
+                lruBytes = lru->bytes;
+            }
+            if (!d) continue;
+            resident -= lruBytes;
+            unloads++;
+            retired.push_back({ lru, d, clock.fetch_add(1) + 1 });
+            retiredCount++;
+        }
+        collect();
+    }
+
+    // free unloaded data that no pinned thread can still be using, mutex must be held
+    static void collect() {
+        if (retired.empty()) return;
+        // a thread pinned before the unload may still hold the data, one pinned after
+        // it found the item unloaded
+        uint64_t oldest = IDLE;
+        for (PinSlot const *s : slots) oldest = std::min(oldest, s->tick.load());
+        size_t kept = 0;
+        for (Retired const &r : retired) {
+            if (r.tick < oldest) r.item->unload(r.data);
+            else retired[kept++] = r;
+        }
+        retired.resize(kept);
+        retiredCount = kept;
+    }
+};
+
+std::mutex LazyCache::mutex;
+std::vector<LazyItem*> LazyCache::items;
+std::vector<PinSlot*> LazyCache::slots;
+std::vector<LazyCache::Retired> LazyCache::retired;
+std::atomic<size_t> LazyCache::retiredCount(0);
+std::atomic<uint64_t> LazyCache::clock(0);
+size_t LazyCache::resident = 0;
+size_t LazyCache::peakResident = 0;
+unsigned long long LazyCache::loads = 0;
+unsigned long long LazyCache::unloads = 0;
+
+bool LoadLazySettings( tinyxml2::XMLElement const *sceneElem ) {
+    lazyEnabled = false;
+    memoryBudget = 0;
+    if (!sceneElem) return false;
+
+    tinyxml2::XMLElement const *e = sceneElem->FirstChildElement("lazyload");
+    if (!e) return true;
+    lazyEnabled = true;
+    float megabytes = 0;
+    e->QueryFloatAttribute("memory", &megabytes);
+    memoryBudget = megabytes > 0 ? size_t(megabytes * 1024 * 1024) : 0;
+    if (memoryBudget > 0) fprintf(stdout, "Lazy loading with a budget of %.0f MB\n", megabytes);
+    else fprintf(stdout, "Lazy loading\n");
+    return true;
+}
+
+bool IsLazyLoading() {
+    return lazyEnabled;
+}
+
+LazyItem::LazyItem() {
+    std::lock_guard<std::mutex> lock(LazyCache::mutex);
+    LazyCache::items.push_back(this);
+}
+
+LazyItem::~LazyItem() {
+    std::lock_guard<std::mutex> lock(LazyCache::mutex);
+    auto &items = LazyCache::items;
+    items.erase(std::remove(items.begin(), items.end(), this), items.end());
+}
+
+void LazyItem::release() {
+    // unload is virtual, so derived classes call this from their own destructor
+    std::lock_guard<std::mutex> lock(LazyCache::mutex);
+    auto &retired = LazyCache::retired;
+    size_t kept = 0;
+    for (LazyCache::Retired const &r : retired) {
+        if (r.item == this) unload(r.data);
+        else retired[kept++] = r;
+    }
+    retired.resize(kept);
+    LazyCache::retiredCount = kept;
+    if (void *d = data.exchange(nullptr)) {
+        LazyCache::resident -= bytes;
+        unload(d);
+    }
+}
+
+void LazyItem::touch() const {
+    uint64_t tick = LazyCache::threadSlot().tick.load(std::memory_order_relaxed);
+    if (tick != IDLE && lastUse.load(std::memory_order_relaxed) < tick) lastUse.store(tick, std::memory_order_relaxed);
+}
+
+void* LazyItem::acquireSlow() const {
+    if (failed) return nullptr;
+    void *d;
+    size_t dataBytes = 0;
+    {
+        std::lock_guard<std::mutex> lock(loadMutex);
+        d = data.load();
+        if (d || failed) return d;
+        d = load(dataBytes);
+        if (!d) {
+            failed = true;
+            return nullptr;
+        }
+        bytes = dataBytes;
+        lastUse = LazyCache::clock.load();
+        data.store(d);
+    }
+    LazyCache::loaded(this, dataBytes);
+    return d;
+}
+
+LazyPin::~LazyPin() {
+    if (!lazyEnabled) return;
+    LazyCache::threadSlot().tick.store(IDLE);
+}
+
+void LazyPin::Pin() {
+    if (!lazyEnabled) return;
+    LazyCache::threadSlot().tick.store(LazyCache::clock.fetch_add(1) + 1);
+    // other threads pinning is what lets unloaded data go
+    if (LazyCache::retiredCount.load(std::memory_order_relaxed) > 0 && LazyCache::mutex.try_lock()) {
+        LazyCache::collect();
+        LazyCache::mutex.unlock();
+    }
+}
+
+void PrintLazyLoadStats() {
+    if (!lazyEnabled) return;
+    std::lock_guard<std::mutex> lock(LazyCache::mutex);
+    int loaded = 0;
+    for (LazyItem const *i : LazyCache::items) loaded += i->IsLoaded();
+    fprintf(stdout, "Lazy loading: %d of %zu items loaded, %llu loads, %llu unloads, %.2f MB resident, %.2f MB at most\n",
+            loaded, LazyCache::items.size(), LazyCache::loads, LazyCache::unloads,
+            LazyCache::resident / (1024.0 * 1024.0), LazyCache::peakResident / (1024.0 * 1024.0));
+}
@@ -0,0 +1,83 @@
+#include "lazymesh.h"
+#include "objcache.h"
+#include "compactmesh.h"
+#include "intersect.h"
+#include "trace.h"
+
+#include <cstdio>
+#include <unordered_map>
+#include <unordered_set>
+
+bool LazyMesh::Init() {
+    Vec3f bmin, bmax;
+    if (!ObjCacheBounds(filename.c_str(), bmin, bmax)) {
+        // loading writes the cache that later runs read the bounds from
+        TriObj const *mesh = GetMesh();
+        if (!mesh) return false;
+        bmin = mesh->GetBoundMin();
+        bmax = mesh->GetBoundMax();
+    }
+    for (int i = 0; i < 3; i++) {
+        bounds[i] = bmin[i];
+        bounds[i + 3] = bmax[i];
+    }
+    return true;
+}
+
+bool LazyMesh::IntersectRay( Ray const &ray, HitInfo &hInfo, int hitSide ) const {
+    // rays that miss the bounds never load the mesh
+    if (!RayBox(ray, bounds)) return false;
+    TriObj const *mesh = GetMesh();
+    return mesh && mesh->IntersectRay(ray, hInfo, hitSide);
+}
+
+void* LazyMesh::load( size_t &dataBytes ) const {
+    TRACE_SCOPE("LazyMesh load");
+    TriObj *mesh = new TriObj();
+    if (!mesh->Load(filename.c_str())) {
+        fprintf(stderr, "Cannot load mesh %s\n", filename.c_str());
+        delete mesh;
+        return nullptr;
+    }
+    // the tree adds about one 32 byte node and one index per two faces
+    dataBytes = TriMeshBytes(*mesh) + size_t(mesh->NF()) * 20;
+    return mesh;
+}
+
+void LazyMesh::unload( void *d ) const {
+    delete static_cast<TriObj*>(d);
+}
+
+static void attachLazyMeshes( Node *node, std::unordered_set<std::string> const &deferred,
+                              std::unordered_map<std::string, LazyMesh*> &byFile, std::vector<LazyMesh*> &meshes ) {
+    if (!node->GetNodeObj() && deferred.count(node->GetName())) {
+        std::string key = ResolvedFileName(node->GetName());
+        auto it = byFile.find(key);
+        if (it == byFile.end()) {
+            LazyMesh *mesh = new LazyMesh(node->GetName());
+            if (!mesh->Init()) {
+                delete mesh;
+                mesh = nullptr;
+            }
+            else meshes.push_back(mesh);
+            it = byFile.emplace(key, mesh).first;
+        }
+        if (it->second) node->SetNodeObj(it->second);
+    }
+    for (int i = 0; i < node->GetNumChild(); i++) {
+        attachLazyMeshes(node->GetChild(i), deferred, byFile, meshes);
+    }
+}
+
+void AttachLazyMeshes( Node &rootNode, std::vector<std::string> const &deferred, std::vector<LazyMesh*> &meshes ) {
+    TRACE_SCOPE("AttachLazyMeshes");
+    if (deferred.empty()) return;
+    std::unordered_set<std::string> names(deferred.begin(), deferred.end());
+    std::unordered_map<std::string, LazyMesh*> byFile;
+    size_t first = meshes.size();
+    attachLazyMeshes(&rootNode, names, byFile, meshes);
+
+    int loaded = 0;
+    for (size_t i = first; i < meshes.size(); i++) loaded += meshes[i]->IsLoaded();
+    fprintf(stdout, "Lazy meshes: %zu, %d loaded with the scene for lack of a cache\n", meshes.size() - first, loaded);
+}
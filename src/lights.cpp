@@ -1,5 +1,6 @@
 #include "lights.h"
 #include "raytracer.h"
+#include "fastmath.h"
 #include <iostream>
 
 // check if the given ray intersects this light
@@ -17,12 +18,12 @@ bool PointLight::IntersectRay( Ray const &ray, HitInfo &hInfo, int hitSide ) con
     float delta = (b * b) - (4 * a * c);
     if (delta < 0) return false;
 
-    float t = ( -b - sqrt(delta) ) / ( 2 * a );
+    float t = ( -b - sqrtf(delta) ) / ( 2 * a );
     if ( t <= 0 ) { return false; }
     if ( t <= bias ) {
         if (hitSide == HIT_BACK || hitSide == HIT_FRONT_AND_BACK) {
             front = false;
-            t = ( -b + sqrt(delta) ) / ( 2 * a );
+            t = ( -b + sqrtf(delta) ) / ( 2 * a );
             if (t <= bias) {
                 return false;
             }
@@ -44,8 +45,8 @@ bool PointLight::IntersectRay( Ray const &ray, HitInfo &hInfo, int hitSide ) con
         hInfo.N = p;    // we'll normalize it later since we have to apply transforms anyway
         hInfo.GN = p;
         // calculate uv mapping
-        float u = atan2(p.y, p.x) / (2 * M_PI);
-        float v = asin(p.z) / M_PI + 0.5;
+        float u = atan2f(p.y, p.x) * (FAST_INV_PI / 2);
+        float v = asinf(p.z) * FAST_INV_PI + 0.5f;
         hInfo.uvw = Vec3f(u, v, 0.5);
         return true;
     }
@@ -56,11 +57,13 @@ bool PointLight::IntersectRay( Ray const &ray, HitInfo &hInfo, int hitSide ) con
 bool PointLight::GenerateSample( SamplerInfo const &sInfo, Vec3f       &dir, Info &si ) const { 
     // generate a random point on the "disk" that is our light
     Vec3f diskNorm = position-sInfo.P();
-    float radius = sqrt(diskNorm.LengthSquared() - size * size) * size / diskNorm.Length();
-    float sampleRadius = sqrt(sInfo.RandomFloat()) * this->size;
-    float theta = sInfo.RandomFloat() * 2 * M_PI;
-    float x_offset = sampleRadius * cos(theta);
-    float y_offset = sampleRadius * sin(theta);
+    float radius = sqrtf(diskNorm.LengthSquared() - size * size) * size / diskNorm.Length();
+    float sampleRadius = sqrtf(sInfo.RandomFloat()) * this->size;
+    float theta = sInfo.RandomFloat() * FAST_TWO_PI;
+    float sinTheta, cosTheta;
+    SinCos(theta, sinTheta, cosTheta);
+    float x_offset = sampleRadius * cosTheta;
+    float y_offset = sampleRadius * sinTheta;
 
     Vec3f u, v;
     (this->position-sInfo.P()).GetNormalized().GetOrthonormals(u, v);
@@ -70,7 +73,7 @@ bool PointLight::GenerateSample( SamplerInfo const &sInfo, Vec3f       &dir, Inf
     dir = sampPoint - sInfo.P();
 
     // calculate the probability and energy of this sample
-    si.prob = 1 / ( radius * radius * M_PI );
+    si.prob = 1 / ( radius * radius * FAST_PI );
     si.mult = this->intensity / dir.LengthSquared();
 
     return true;
@@ -86,12 +89,12 @@ void PointLight::GetSampleInfo ( SamplerInfo const &sInfo, Vec3f const &dir, Inf
         // if so, return the probability of this light generating that sample
         // as well as what energy said sample would have
         Vec3f diskNorm = position-sInfo.P();
-        float radius = sqrt(diskNorm.LengthSquared() - size * size) * size / diskNorm.Length();
+        float radius = sqrtf(diskNorm.LengthSquared() - size * size) * size / diskNorm.Length();
 
         Vec3f diff = hInfo.p - sInfo.P();
 
         si.prob = 2 * radius * radius / diff.LengthSquared();
-        si.mult = this->intensity / diff.LengthSquared() * 4 * M_PI * radius * radius;
+        si.mult = this->intensity / diff.LengthSquared() * (4 * FAST_PI) * radius * radius;
     }
     else {
         si.prob = 0;
@@ -110,9 +113,10 @@ bool SpotLight::IntersectRay( Ray const &ray, HitInfo &hInfo, int hitSide ) cons
     if (!hitSphere) return false;
 
     Vec3f hitDir = (hInfo.p - this->position).GetNormalized();
-    float hitRadius = sqrt(1 - pow(hitDir.Dot(normDir), 2));
+    float cosHit = hitDir.Dot(normDir);
+    float hitRadius = sqrtf(1 - cosHit * cosHit);
 
-    float radius = sin(this->angle);
+    float radius = sinf(this->angle);
     if (hitRadius > radius) {
         return false;
     }
@@ -122,7 +126,7 @@ bool SpotLight::IntersectRay( Ray const &ray, HitInfo &hInfo, int hitSide ) cons
 
 bool SpotLight::GenerateSample( SamplerInfo const &sInfo, Vec3f       &dir, Info &si ) const { 
     Vec3f pDir = (sInfo.P() - this->position).GetNormalized();
-    if ( pDir.Dot(this->direction.GetNormalized()) < cos(this->angle) ) {
+    if ( pDir.Dot(this->direction.GetNormalized()) < cosf(this->angle) ) {
         // this point lies without the cone
         si.mult = Color().Black();
         si.prob = 0;
@@ -131,12 +135,14 @@ bool SpotLight::GenerateSample( SamplerInfo const &sInfo, Vec3f       &dir, Info
     }
 
     // generate a random point on the "disk" that is our light
-    float radius = sin(angle) * size;
+    float radius = sinf(angle) * size;
 
-    float sampleRadius = sqrt(sInfo.RandomFloat()) * radius;
-    float theta = sInfo.RandomFloat() * 2 * M_PI;
-    float x_offset = sampleRadius * cos(theta);
-    float y_offset = sampleRadius * sin(theta);
+    float sampleRadius = sqrtf(sInfo.RandomFloat()) * radius;
+    float theta = sInfo.RandomFloat() * FAST_TWO_PI;
+    float sinTheta, cosTheta;
+    SinCos(theta, sinTheta, cosTheta);
+    float x_offset = sampleRadius * cosTheta;
+    float y_offset = sampleRadius * sinTheta;
 
     Vec3f u, v;
     (this->position-sInfo.P()).GetNormalized().GetOrthonormals(u, v);
@@ -144,7 +150,7 @@ bool SpotLight::GenerateSample( SamplerInfo const &sInfo, Vec3f       &dir, Info
 
     dir = sampPoint - sInfo.P();
 
-    si.prob = 1 / ( radius * radius * M_PI );
+    si.prob = 1 / ( radius * radius * FAST_PI );
     si.mult = this->intensity / dir.LengthSquared();
 
     return true;
@@ -152,7 +158,7 @@ bool SpotLight::GenerateSample( SamplerInfo const &sInfo, Vec3f       &dir, Info
 void SpotLight::GetSampleInfo ( SamplerInfo const &sInfo, Vec3f const &dir, Info &si ) const {
     Vec3f pDir = (sInfo.P() - this->position).GetNormalized();
     float cosPos = pDir.Dot(this->direction.GetNormalized());
-    if ( cosPos < cos(this->angle) ) {
+    if ( cosPos < cosf(this->angle) ) {
         // this point lies without the cone
         si.mult = Color().Black();
         si.prob = 0;
@@ -163,11 +169,11 @@ void SpotLight::GetSampleInfo ( SamplerInfo const &sInfo, Vec3f const &dir, Info
     hInfo.Init();
     bool hit = this->IntersectRay(Ray(sInfo.P(), dir), hInfo, HIT_FRONT);
     if (hit) {
-        float radius = sin(this->angle);
+        float radius = sinf(this->angle);
         Vec3f diff = hInfo.p - sInfo.P();
 
         si.prob = 2 * radius * radius / diff.LengthSquared();
-        si.mult = this->intensity / diff.LengthSquared() * 4 * M_PI * radius * radius;
+        si.mult = this->intensity / diff.LengthSquared() * (4 * FAST_PI) * radius * radius;
     }
     else {
         si.prob = 0;
@@ -0,0 +1,184 @@
+#include "loadpipeline.h"
+#include "tinyxml2.h"
+#include "trace.h"
+#include "objcache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <climits>
+#include <cstdlib>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <sys/stat.h>
+#include <unistd.h>
+
+void LoadPipeline::LoadSettings( tinyxml2::XMLElement const *sceneElem, int defaultThreads ) {
+    threads = 0;
+    tinyxml2::XMLElement const *e = sceneElem ? sceneElem->FirstChildElement("loadpipeline") : nullptr;
+    if (!e) return;
+    threads = defaultThreads;
+    e->QueryIntAttribute("threads", &threads);
+    threads = std::max(0, threads);
+}
+
+void LoadPipeline::Add( char const *kind, std::string const &name, size_t cost, std::function<bool()> run ) {
+    Task task;
+    task.kind = kind;
+    task.name = name;
+    task.cost = cost;
+    task.run = std::move(run);
+    tasks.push_back(std::move(task));
+}
+
+void LoadPipeline::AddFinish( std::function<void()> finish ) {
+    finishers.push_back(std::move(finish));
+}
+
+void LoadPipeline::Run() {
+    TRACE_SCOPE("LoadPipeline::Run");
+    std::vector<Task*> pending;
+    for (Task &t : tasks) {
+        if (!t.ran) pending.push_back(&t);
+    }
+    // the largest first, so that a big mesh does not start last and hold up the rest
+    std::stable_sort(pending.begin(), pending.end(), [](Task const *a, Task const *b) { return a->cost > b->cost; });
+
+    auto start = std::chrono::steady_clock::now();
+    std::atomic<size_t> next(0);
+    // the cores are shared by the tasks, so each OBJ file is parsed on fewer threads
+    int n = std::min(std::max(threads, 1), int(pending.size()));
+    unsigned int parseThreads = std::max(1u, std::thread::hardware_concurrency() / unsigned(n));
+    auto work = [&]() {
+        SetObjParseThreads(parseThreads);
+        for (size_t i = next++; i < pending.size(); i = next++) {
+            Task &task = *pending[i];
+            TRACE_SCOPE(task.kind);
+            auto taskStart = std::chrono::steady_clock::now();
+            task.ok = task.run();
+            task.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - taskStart).count();
+            task.ran = true;
+        }
+        SetObjParseThreads(0);
+    };
+    // the calling thread takes tasks too
+    std::vector<std::thread> pool;
+    for (int i = 1; i < n; i++) {
+        pool.emplace_back([&]() {
+            TraceThreadName("loader");
+            work();
+        });
+    }
+    work();
+    for (std::thread &t : pool) t.join();
+    seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (Task *t : pending) t->run = nullptr;
+    std::vector<std::function<void()>> finish;
+    finish.swap(finishers);
+    for (auto &f : finish) f();
+}
+
+void LoadPipeline::PrintReport() const {
+    if (tasks.empty()) return;
+    double taskSeconds = 0;
+    int failed = 0;
+    for (Task const &t : tasks) {
+        fprintf(stdout, "  %s %s: %.1f ms%s\n", t.kind, t.name.c_str(), t.seconds * 1000.0, t.ok ? "" : ", failed");
+        taskSeconds += t.seconds;
+        failed += !t.ok;
+    }
+    fprintf(stdout, "Loaded %zu assets in %.1f ms on %d threads (%.1f ms of task time)",
+            tasks.size() - failed, seconds * 1000.0, std::max(threads, 1), taskSeconds * 1000.0);
+    if (failed > 0) fprintf(stdout, ", %d failed", failed);
+    fprintf(stdout, "\n");
+}
+
+static void deferObjects( tinyxml2::XMLElement *parent, std::vector<std::string> &deferred ) {
+    for (tinyxml2::XMLElement *e = parent->FirstChildElement("object"); e; e = e->NextSiblingElement("object")) {
+        char const *type = e->Attribute("type");
+        char const *name = e->Attribute("name");
+        if (type && name && strcmp(type, "obj") == 0) {
+            // without a type the object is a node like any group, with its transform and material
+            deferred.push_back(name);
+            e->DeleteAttribute("type");
+        }
+        deferObjects(e, deferred);
+    }
+}
+
+std::string WriteDeferredScene( tinyxml2::XMLDocument &doc, char const *sceneFilename, std::vector<std::string> &deferred ) {
+    TRACE_SCOPE("WriteDeferredScene");
+    tinyxml2::XMLElement *xml = doc.FirstChildElement("xml");
+    tinyxml2::XMLElement *sceneElem = xml ? xml->FirstChildElement("scene") : nullptr;
+    if (!sceneElem) return "";
+    size_t first = deferred.size();
+    deferObjects(sceneElem, deferred);
+    if (deferred.size() == first) return "";
+
+    // a name of its own in the temporary directory, so that renders of the same scene do
+    // not share it; the file names in a scene are relative to the working directory, so
+    // they resolve the same way from the copy
+    static std::atomic<unsigned int> copyCount(0);
+    char const *tmpDir = getenv("TMPDIR");
+    if (!tmpDir || !tmpDir[0]) tmpDir = "/tmp";
+    char const *base = strrchr(sceneFilename, '/');
+    base = base ? base + 1 : sceneFilename;
+    char copyName[PATH_MAX];
+    snprintf(copyName, sizeof(copyName), "%s/%s.%d.%u.xml", tmpDir, base, int(getpid()), copyCount++);
+    std::string copy = copyName;
+    if (doc.SaveFile(copy.c_str()) != tinyxml2::XML_SUCCESS) {
+        fprintf(stderr, "Cannot write %s, meshes are loaded with the scene\n", copy.c_str());
+        deferred.resize(first);
+        return "";
+    }
+    return copy;
+}
+
+std::string ResolvedFileName( char const *name ) {
+    char resolved[PATH_MAX];
+    if (realpath(name, resolved)) return resolved;
+    return name;
+}
+
+static void collectNodes( Node *node, std::unordered_set<std::string> const &names,
+                          std::unordered_map<std::string, std::vector<Node*>> &byFile ) {
+    if (!node->GetNodeObj() && names.count(node->GetName())) {
+        byFile[ResolvedFileName(node->GetName())].push_back(node);
+    }
+    for (int i = 0; i < node->GetNumChild(); i++) {
+        collectNodes(node->GetChild(i), names, byFile);
+    }
+}
+
+void LoadDeferredMeshes( Node &rootNode, std::vector<std::string> const &deferred, LoadPipeline &pipeline, std::vector<TriObj*> &meshes ) {
+    if (deferred.empty()) return;
+    std::unordered_set<std::string> names(deferred.begin(), deferred.end());
+    std::unordered_map<std::string, std::vector<Node*>> byFile;
+    collectNodes(&rootNode, names, byFile);
+
+    // one mesh and one tree per resolved file name, every deferred mesh is loaded with the
+    // same options, so the file alone identifies it
+    for (auto &f : byFile) {
+        // the nodes outlive the pipeline, which only runs while the scene loads
+        std::vector<Node*> nodes = f.second;
+        char const *file = nodes[0]->GetName();
+        struct stat st;
+        size_t cost = stat(file, &st) == 0 ? size_t(st.st_size) : 0;
+
+        TriObj *mesh = new TriObj();
+        meshes.push_back(mesh);
+        pipeline.Add("mesh", file, cost, [mesh, file]() {
+            if (mesh->Load(file)) return true;
+            fprintf(stderr, "Cannot load mesh %s\n", file);
+            return false;
+        });
+        pipeline.AddFinish([mesh, nodes]() {
+            if (mesh->NF() == 0) return;
+            for (Node *node : nodes) node->SetNodeObj(mesh);
+        });
+    }
+}
@@ -1,16 +1,37 @@
 #include "materials.h"
+#include "blinneval.h"
+#include "mipmap.h"
 #include "raytracer.h"
 #include "lights.h"
+#include "fastmath.h"
 
 #include <iostream>
 
 bool MtlPhong::GenerateSample( SamplerInfo const &sInfo, Vec3f &dir, Info &si ) const {}
 void MtlPhong::GetSampleInfo ( SamplerInfo const &sInfo, Vec3f const &dir, Info &si ) const {};
 
-bool MtlBlinn::GenerateSample( SamplerInfo const &sInfo, Vec3f &dir, Info &si ) const {
-    float dPow = Diffuse().Eval(sInfo.UVW()).Max();
-    float rPow = Specular().Eval(sInfo.UVW()).Max();
-    float tPow = Refraction().Eval(sInfo.UVW()).Max();
+// evaluation cache of the shading point this thread is working on
+static thread_local BlinnEval cachedEval;
+static thread_local MtlBlinn const *cachedMtl = nullptr;
+static thread_local Vec3f cachedUVW;
+static thread_local float cachedFootprint = 0;
+static thread_local unsigned long long lookups = 0;
+
+void BlinnEval::Compute( MtlBlinn const &mtl, Vec3f const &uvw, float footprint ) {
+    diffuse = EvalFiltered(mtl.Diffuse(), uvw, footprint);
+    specular = EvalFiltered(mtl.Specular(), uvw, footprint);
+    refraction = EvalFiltered(mtl.Refraction(), uvw, footprint);
+    emission = EvalFiltered(mtl.Emission(), uvw, footprint);
+    gloss = mtl.Glossiness().Eval(uvw);
+    lookups += 5;
+
+    if (isnan(emission.r)) {
+        emission = Color().Black();
+    }
+
+    dPow = diffuse.Max();
+    rPow = specular.Max();
+    tPow = refraction.Max();
 
     float sum = dPow + rPow + tPow;
     if (sum >= 1) {
@@ -18,6 +39,29 @@ bool MtlBlinn::GenerateSample( SamplerInfo const &sInfo, Vec3f &dir, Info &si )
         rPow /= 2.0f * sum;
         tPow /= 2.0f * sum;
     }
+}
+
+BlinnEval const& GetBlinnEval( MtlBlinn const &mtl, Vec3f const &uvw ) {
+    // textures only depend on the material, the texture coordinate and the path's footprint
+    float footprint = GetTextureFootprint();
+    if ( cachedMtl != &mtl || cachedUVW != uvw || cachedFootprint != footprint ) {
+        cachedEval.Compute(mtl, uvw, footprint);
+        cachedMtl = &mtl;
+        cachedUVW = uvw;
+        cachedFootprint = footprint;
+    }
+    return cachedEval;
+}
+
+void InvalidateBlinnEval() { cachedMtl = nullptr; }
+
+unsigned long long BlinnEvalLookups() { return lookups; }
+
+bool MtlBlinn::GenerateSample( SamplerInfo const &sInfo, Vec3f &dir, Info &si ) const {
+    BlinnEval const &e = GetBlinnEval(*this, sInfo.UVW());
+    float dPow = e.dPow;
+    float rPow = e.rPow;
+    float tPow = e.tPow;
 
     float roll = sInfo.RandomFloat();
     if ( roll < dPow ) {
@@ -28,15 +72,17 @@ bool MtlBlinn::GenerateSample( SamplerInfo const &sInfo, Vec3f &dir, Info &si )
         Vec3f u, v;
         sInfo.N().GetOrthonormals(u, v);
 
-        float phi = sInfo.RandomFloat() * 2 * M_PI;
-        float cosTheta = sqrt(1 - sInfo.RandomFloat());
-        float sinTheta = sqrt(1 - pow(cosTheta, 2));
+        float phi = sInfo.RandomFloat() * FAST_TWO_PI;
+        float cosTheta = sqrtf(1 - sInfo.RandomFloat());
+        float sinTheta = sqrtf(1 - cosTheta * cosTheta);
+        float sinPhi, cosPhi;
+        SinCos(phi, sinPhi, cosPhi);
         
-        dir = sInfo.N()*cosTheta + u*sinTheta*cos(phi) + v*sinTheta*sin(phi);
+        dir = sInfo.N()*cosTheta + u*sinTheta*cosPhi + v*sinTheta*sinPhi;
 
         // set this photon's probablity
-        si.prob = dPow * cosTheta / M_PI;
-        si.mult = cosTheta * Diffuse().Eval(sInfo.UVW()) / M_PI;
+        si.prob = dPow * cosTheta * FAST_INV_PI;
+        si.mult = cosTheta * e.diffuse * FAST_INV_PI;
         return true;
     }
 
@@ -56,12 +102,20 @@ bool MtlBlinn::GenerateSample( SamplerInfo const &sInfo, Vec3f &dir, Info &si )
     norm.Normalize();
     Vec3f u, v;
     norm.GetOrthonormals(u, v);
-    float gloss = Glossiness().Eval(sInfo.UVW());
-    float cosTheta = pow(1 - sInfo.RandomFloat(), 1.0f / (gloss + 1.0f));
-    float sinTheta = sqrt(1 - (cosTheta * cosTheta));
-    float phi = sInfo.RandomFloat() * 2 * M_PI;
-
-    Vec3f half = norm * cosTheta + u * sinTheta * cos(phi) + v * sinTheta * sin(phi);
+    float gloss = e.gloss;
+    float lobeSample = 1 - sInfo.RandomFloat();
+    float cosTheta = powf(lobeSample, 1.0f / (gloss + 1.0f));
+    float sinTheta = sqrtf(1 - (cosTheta * cosTheta));
+    float phi = sInfo.RandomFloat() * FAST_TWO_PI;
+    float sinPhi, cosPhi;
+    SinCos(phi, sinPhi, cosPhi);
+
+    Vec3f half = norm * cosTheta + u * sinTheta * cosPhi + v * sinTheta * sinPhi;
+
+    // the half vector was sampled from the lobe, so its powers follow from the sample
+    // itself: cosTheta^(gloss+1) is lobeSample and norm.Dot(half)^gloss is lobeSample / cosTheta
+    float specCons = (gloss + 2) * (FAST_INV_PI / 8);
+    float lobe = cosTheta > 0 ? lobeSample / cosTheta : 0;
     
     if ( roll < dPow + rPow ) {
         si.lobe = Lobe::SPECULAR;
@@ -71,7 +125,7 @@ bool MtlBlinn::GenerateSample( SamplerInfo const &sInfo, Vec3f &dir, Info &si )
         dir = rDir;
 
         // set this photon's probablity
-        si.prob = rPow * (gloss + 1) / (2 * M_PI) * pow(cosTheta, gloss+1) / (4);
+        si.prob = rPow * (gloss + 1) * (FAST_INV_PI / 2) * lobeSample / (4);
 
         float cosOut = rDir.Dot(norm);
         if (cosOut < 0) {
@@ -80,8 +134,7 @@ bool MtlBlinn::GenerateSample( SamplerInfo const &sInfo, Vec3f &dir, Info &si )
         }
 
         // set this photon's bsdf*geometry term
-        float specCons = (Glossiness().Eval(sInfo.UVW()) + 2) / (8 * M_PI);
-        Color f_spec = pow(norm.Dot(half), gloss) * Specular().Eval(sInfo.UVW()) * specCons / cosOut;
+        Color f_spec = lobe * e.specular * specCons / cosOut;
         si.mult = cosOut * f_spec;// / si.prob;
 
         return true;
@@ -90,10 +143,10 @@ bool MtlBlinn::GenerateSample( SamplerInfo const &sInfo, Vec3f &dir, Info &si )
         si.lobe = Lobe::TRANSMISSION;
 
         float k_cosTheta = sInfo.V().Dot(half);
-        float cosPhi_2 = 1 - (pow(eta, 2) * (1 - pow(k_cosTheta, 2)));
+        float cosPhi_2 = 1 - (eta * eta * (1 - k_cosTheta * k_cosTheta));
 
         // set this photon's probablity
-        si.prob = tPow * (gloss + 1) / (2 * M_PI) * pow(cosTheta, gloss+1) / 4;
+        si.prob = tPow * (gloss + 1) * (FAST_INV_PI / 2) * lobeSample / 4;
 
         if (half.Dot(sInfo.V()) < 0){
             dir = Vec3f(0.0f);
@@ -106,21 +159,17 @@ bool MtlBlinn::GenerateSample( SamplerInfo const &sInfo, Vec3f &dir, Info &si )
         }
 
         // get the transmission direction
-        dir = (-eta * sInfo.V()) - (sqrt(cosPhi_2) - (eta * k_cosTheta)) * half;
+        dir = (-eta * sInfo.V()) - (sqrtf(cosPhi_2) - (eta * k_cosTheta)) * half;
         float cosOut = abs(norm.Dot(dir));
 
         // set this photon's bsdf*geometry term
-        float specCons = (Glossiness().Eval(sInfo.UVW()) + 2) / (8 * M_PI);
-        Color f_trans = pow(norm.Dot(half), gloss) * Refraction().Eval(sInfo.UVW()) * specCons / cosOut;
+        Color f_trans = lobe * e.refraction * specCons / cosOut;
         si.mult = cosOut * f_trans;
         return true;
     }
     si.prob = 1.0f - (dPow + rPow + tPow);
 
-    Color emit = Emission().Eval(sInfo.UVW());
-    if (isnan(emit.r)) {
-            emit = Color().Black();
-    }
+    Color emit = e.emission;
     if (!emit.IsBlack()) {si.mult = emit; dir = sInfo.N(); return false;}
 
     dir = Vec3f(0.0f);
@@ -128,16 +177,10 @@ bool MtlBlinn::GenerateSample( SamplerInfo const &sInfo, Vec3f &dir, Info &si )
     return false;
 }
 void MtlBlinn::GetSampleInfo ( SamplerInfo const &sInfo, Vec3f const &dir, Info &si ) const {
-    float dPow = Diffuse().Eval(sInfo.UVW()).Max();
-    float rPow = Specular().Eval(sInfo.UVW()).Max();
-    float tPow = Refraction().Eval(sInfo.UVW()).Max();
-
-    float sum = dPow + rPow + tPow;
-    if (sum >= 1) {
-        dPow /= 2.0f * sum;
-        rPow /= 2.0f * sum;
-        tPow /= 2.0f * sum;
-    }
+    BlinnEval const &e = GetBlinnEval(*this, sInfo.UVW());
+    float dPow = e.dPow;
+    float rPow = e.rPow;
+    float tPow = e.tPow;
 
     si.prob = 0.0f;
     si.mult = Color().Black();
@@ -150,20 +193,21 @@ void MtlBlinn::GetSampleInfo ( SamplerInfo const &sInfo, Vec3f const &dir, Info
 
         // diffuse
         if (cosOut > 0) {
-            si.mult += cosOut * Diffuse().Eval(sInfo.UVW()) / M_PI;
-            si.prob += dPow / M_PI;
+            si.mult += cosOut * e.diffuse * FAST_INV_PI;
+            si.prob += dPow * FAST_INV_PI;
         }
 
         // specular
         if (cosOut < 0) norm *= -1;
-        float gloss = Glossiness().Eval(sInfo.UVW());
-        float specCons = (gloss + 2) / (8 * M_PI);
+        float gloss = e.gloss;
+        float specCons = (gloss + 2) * (FAST_INV_PI / 8);
 
         Vec3f half = (sInfo.V() + dir).GetNormalized();
         float geoTerm = norm.Dot(half);
+        float lobe = powf(geoTerm, gloss);
 
-        si.mult += pow(norm.Dot(half), gloss) * Specular().Eval(sInfo.UVW()) * specCons;
-        si.prob += (gloss + 1) * pow(geoTerm, gloss) * rPow;
+        si.mult += lobe * e.specular * specCons;
+        si.prob += (gloss + 1) * lobe * rPow;
     }
 
     else {
@@ -176,17 +220,18 @@ void MtlBlinn::GetSampleInfo ( SamplerInfo const &sInfo, Vec3f const &dir, Info
             norm *= -1;
         }
 
-        float gloss = Glossiness().Eval(sInfo.UVW());
-        float specCons = (gloss + 2) / (8 * M_PI);
+        float gloss = e.gloss;
+        float specCons = (gloss + 2) * (FAST_INV_PI / 8);
 
         Vec3f half = (dir + eta * sInfo.V()).GetNormalized();
         float geoTerm = half.Dot(norm);
+        float lobe = powf(geoTerm, gloss);
 
-        si.mult += pow(geoTerm, gloss) * Refraction().Eval(sInfo.UVW()) * specCons;
-        si.prob += (gloss + 1) * pow(geoTerm, gloss) * tPow;
+        si.mult += lobe * e.refraction * specCons;
+        si.prob += (gloss + 1) * lobe * tPow;
     }
 
-    Color emit = Emission().Eval(sInfo.UVW());
+    Color emit = e.emission;
     si.mult += emit;
     if (!emit.IsBlack()) si.prob += 1 - (dPow + rPow + tPow);
 };
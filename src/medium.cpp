@@ -0,0 +1,283 @@
+#include "medium.h"
+#include "instancing.h"
+#include "trace.h"
+
+#include <iostream>
+#include <cstring>
+#include <cmath>
+
+bool DensityGrid::Load( char const *filename ) {
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) {
+        fprintf(stderr, "Cannot open density grid %s\n", filename);
+        return false;
+    }
+
+    int res[3];
+    if (fread(res, sizeof(int), 3, fp) != 3 || res[0] <= 0 || res[1] <= 0 || res[2] <= 0) {
+        fprintf(stderr, "Invalid density grid header in %s\n", filename);
+        fclose(fp);
+        return false;
+    }
+    nx = res[0];
+    ny = res[1];
+    nz = res[2];
+
+    size_t count = size_t(nx) * ny * nz;
+    density.resize(count);
+    size_t read = fread(density.data(), sizeof(float), count, fp);
+    fclose(fp);
+    if (read != count) {
+        fprintf(stderr, "Density grid %s is truncated (%zu of %zu voxels)\n", filename, read, count);
+        density.clear();
+        return false;
+    }
+
+    maxDensity = 0.0f;
+    for (float d : density) {
+        if (d > maxDensity) maxDensity = d;
+    }
+    return true;
+}
+
+float DensityGrid::Lookup( Vec3f const &uvw ) const {
+    if (uvw.x < 0 || uvw.y < 0 || uvw.z < 0 || uvw.x > 1 || uvw.y > 1 || uvw.z > 1) {
+        return 0.0f;
+    }
+
+    // voxel centers sit at (i + 0.5) / n
+    float x = uvw.x * nx - 0.5f;
+    float y = uvw.y * ny - 0.5f;
+    float z = uvw.z * nz - 0.5f;
+    int x0 = Max(0, Min(nx - 1, int(floorf(x))));
+    int y0 = Max(0, Min(ny - 1, int(floorf(y))));
+    int z0 = Max(0, Min(nz - 1, int(floorf(z))));
+    int x1 = Min(nx - 1, x0 + 1);
+    int y1 = Min(ny - 1, y0 + 1);
+    int z1 = Min(nz - 1, z0 + 1);
+    float fx = Max(0.0f, Min(1.0f, x - x0));
+    float fy = Max(0.0f, Min(1.0f, y - y0));
+    float fz = Max(0.0f, Min(1.0f, z - z0));
+
+    auto at = [this](int i, int j, int k) { return density[(size_t(k) * ny + j) * nx + i]; };
+    float c00 = at(x0, y0, z0) * (1 - fx) + at(x1, y0, z0) * fx;
+    float c10 = at(x0, y1, z0) * (1 - fx) + at(x1, y1, z0) * fx;
+    float c01 = at(x0, y0, z1) * (1 - fx) + at(x1, y0, z1) * fx;
+    float c11 = at(x0, y1, z1) * (1 - fx) + at(x1, y1, z1) * fx;
+    float c0 = c00 * (1 - fy) + c10 * fy;
+    float c1 = c01 * (1 - fy) + c11 * fy;
+    return c0 * (1 - fz) + c1 * fz;
+}
+
+//----------------------------------------------------------------
+
+// read a float attribute, leaving the value untouched if it is missing
+static void readFloat( tinyxml2::XMLElement const *element, char const *child, float &value ) {
+    tinyxml2::XMLElement const *e = element->FirstChildElement(child);
+    if (e) e->QueryFloatAttribute("value", &value);
+}
+
+static void readVec3( tinyxml2::XMLElement const *element, Vec3f &v ) {
+    element->QueryFloatAttribute("x", &v.x);
+    element->QueryFloatAttribute("y", &v.y);
+    element->QueryFloatAttribute("z", &v.z);
+}
+
+// transform a box into the coordinate system of the node's parent
+static Box toParentCoords( Node const *node, Box const &box ) {
+    Box result;
+    result.Init();
+    if (box.IsEmpty()) return result;
+    for (int i = 0; i < 8; i++) {
+        Vec3f corner((i & 1) ? box.pmax.x : box.pmin.x,
+                     (i & 2) ? box.pmax.y : box.pmin.y,
+                     (i & 4) ? box.pmax.z : box.pmin.z);
+        result += node->TransformFrom(corner);
+    }
+    return result;
+}
+
+// bounding box of a node and all of its descendents in its parent's coordinates
+static Box subtreeBounds( Node const *node ) {
+    Box box;
+    box.Init();
+    if (node->GetNodeObj()) box += node->GetNodeObj()->GetBoundBox();
+    for (int i = 0; i < node->GetNumChild(); i++) {
+        box += subtreeBounds(node->GetChild(i));
+    }
+    return toParentCoords(node, box);
+}
+
+// find the node with the given name and compute its world space bounds
+static bool findNode( Node const *node, char const *name, Node const *&found, Box &box ) {
+    if (strcmp(node->GetName(), name) == 0) {
+        found = node;
+        box = subtreeBounds(node);
+        return true;
+    }
+    for (int i = 0; i < node->GetNumChild(); i++) {
+        if (findNode(node->GetChild(i), name, found, box)) {
+            box = toParentCoords(node, box);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Medium::Load( tinyxml2::XMLElement const *element, Node const &rootNode ) {
+    char const *n = element->Attribute("name");
+    name = n ? n : "";
+
+    readFloat(element, "absorption", sig_a);
+    readFloat(element, "scattering", sig_s);
+    readFloat(element, "density", densityScale);
+    if (SigmaT() <= 0) {
+        fprintf(stderr, "Medium [%s] has no absorption or scattering\n", GetName());
+        return false;
+    }
+
+    // extent: an explicit box, the interior of an object, or the whole scene
+    tinyxml2::XMLElement const *boxElem = element->FirstChildElement("box");
+    char const *objName = element->Attribute("object");
+    if (boxElem) {
+        extent = BOX;
+        tinyxml2::XMLElement const *e;
+        if ((e = boxElem->FirstChildElement("min"))) readVec3(e, bounds.pmin);
+        if ((e = boxElem->FirstChildElement("max"))) readVec3(e, bounds.pmax);
+    }
+    else if (objName) {
+        if (!findNode(&rootNode, objName, node, bounds)) {
+            fprintf(stderr, "Medium [%s] refers to unknown object %s\n", GetName(), objName);
+            return false;
+        }
+        if (node->GetNodeObj()) {
+            extent = INTERIOR;
+        }
+        else {
+            // a group node has no surface of its own, so fill its bounding box instead
+            extent = BOX;
+            node = nullptr;
+        }
+    }
+
+    char const *type = element->Attribute("type");
+    if (type && strcmp(type, "grid") == 0) {
+        char const *file = element->Attribute("file");
+        if (extent == UNBOUNDED || !file) {
+            fprintf(stderr, "Grid medium [%s] needs a file and a box or object extent\n", GetName());
+            return false;
+        }
+        grid = new DensityGrid();
+        if (!grid->Load(file)) return false;
+    }
+    return true;
+}
+
+bool Medium::Overlap( Ray const &ray, HitInfo const &hInfo, bool hit, float &t0, float &t1 ) const {
+    t0 = 0.0f;
+    t1 = hit ? hInfo.z : BIGFLOAT;
+
+    switch (extent) {
+    case UNBOUNDED:
+        return true;
+    case INTERIOR:
+        // the segment is inside the object exactly when it ends on the object's back face
+        return hit && hInfo.node == node && !hInfo.front;
+    case BOX:
+        for (int i = 0; i < 3; i++) {
+            // a ray parallel to a slab is inside it everywhere or nowhere, and dividing by
+            // the zero direction would give NaN for an origin on one of its planes
+            if (ray.dir[i] == 0) {
+                if (ray.p[i] < bounds.pmin[i] || ray.p[i] > bounds.pmax[i]) return false;
+                continue;
+            }
+            float invDir = 1.0f / ray.dir[i];
+            float tNear = (bounds.pmin[i] - ray.p[i]) * invDir;
+            float tFar = (bounds.pmax[i] - ray.p[i]) * invDir;
+            if (tNear > tFar) Swap(tNear, tFar);
+            t0 = Max(t0, tNear);
+            t1 = Min(t1, tFar);
+        }
+        return t0 < t1;
+    }
+    return false;
+}
+
+float Medium::InteriorTransmittance( Instance const &boundary, Ray const &ray, float t_max, SamplerInfo const &sInfo ) const {
+    // a closed surface is crossed a few times at most, the limit only guards against open meshes
+    int const maxCrossings = 16;
+    Ray r = boundary.ToObjectCoords(ray);
+    float T = 1.0f;
+    float t = 0.0f;
+    for (int i = 0; i < maxCrossings && t < t_max && T > 0; i++) {
+        // the object space direction is not normalized, so hit distances are ray parameters
+        HitInfo h;
+        h.Init();
+        if (!boundary.obj->IntersectRay(Ray(r.p + t * r.dir, r.dir), h, HIT_FRONT_AND_BACK)) break;
+        float tHit = t + h.z;
+        // leaving through a back face means the ray was inside since the previous hit
+        if (!h.front) T *= Transmittance(ray, t, Min(tHit, t_max), sInfo);
+        t = tHit;
+    }
+    return T;
+}
+
+float Medium::densityAt( Vec3f const &p ) const {
+    return grid->Lookup((p - bounds.pmin) / (bounds.pmax - bounds.pmin));
+}
+
+bool Medium::SampleCollision( Ray const &ray, float t0, float t1, SamplerInfo const &sInfo, float &t ) const {
+    // majorant per unit of ray parameter
+    float maxDensity = grid ? grid->MaxDensity() : 1.0f;
+    float majorant = SigmaT() * densityScale * maxDensity * ray.dir.Length();
+    if (majorant <= 0) return false;
+
+    t = t0;
+    while (true) {
+        t -= logf(1.0f - sInfo.RandomFloat()) / majorant;
+        if (t >= t1) return false;
+        // a homogeneous medium only has real collisions
+        if (!grid) return true;
+        if (sInfo.RandomFloat() * maxDensity < densityAt(ray.p + t * ray.dir)) return true;
+    }
+}
+
+float Medium::Transmittance( Ray const &ray, float t0, float t1, SamplerInfo const &sInfo ) const {
+    float maxDensity = grid ? grid->MaxDensity() : 1.0f;
+    float majorant = SigmaT() * densityScale * maxDensity * ray.dir.Length();
+    if (!grid) return expf(-majorant * (t1 - t0));
+    if (majorant <= 0) return 1.0f;
+
+    float T = 1.0f;
+    float t = t0;
+    while (true) {
+        t -= logf(1.0f - sInfo.RandomFloat()) / majorant;
+        if (t >= t1) break;
+        T *= 1.0f - densityAt(ray.p + t * ray.dir) / maxDensity;
+
+        // russian roulette once the estimate gets small
+        if (T < 0.1f) {
+            if (sInfo.RandomFloat() < 0.5f) return 0.0f;
+            T *= 2.0f;
+        }
+    }
+    return T;
+}
+
+//----------------------------------------------------------------
+
+bool LoadMedia( tinyxml2::XMLElement const *sceneElem, Node const &rootNode, std::vector<Medium*> &media ) {
+    TRACE_SCOPE("LoadMedia");
+    if (!sceneElem) return true;
+
+    for (tinyxml2::XMLElement const *e = sceneElem->FirstChildElement("medium"); e; e = e->NextSiblingElement("medium")) {
+        Medium *medium = new Medium();
+        if (!medium->Load(e, rootNode)) {
+            delete medium;
+            continue;
+        }
+        fprintf(stdout, "Medium [%s] %s\n", medium->GetName(), medium->IsHomogeneous() ? "homogeneous" : "grid");
+        media.push_back(medium);
+    }
+    return true;
+}
@@ -0,0 +1,484 @@
+#include "mipmap.h"
+#include "materials.h"
+#include "lodepng.h"
+#include "trace.h"
+#include "renderstats.h"
+#include "lazyload.h"
+#include "loadpipeline.h"
+
+#include <iostream>
+#include <cstring>
+#include <strings.h>
+#include <cmath>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <unordered_set>
+#include <chrono>
+#include <memory>
+#include <sys/stat.h>
+
+// directory holding decoded pyramids, named by the hash of their source image
+#define TEXTURE_CACHE_DIR ".texcache"
+#define TEXTURE_CACHE_VERSION 1
+
+// header of a cached pyramid, the texels of all levels follow at DATA_OFFSET
+struct MipCacheHeader
+{
+    char magic[4];          // "TMIP"
+    uint32_t version;
+    uint64_t sourceHash;    // hash of the image file the pyramid was built from
+    uint32_t width, height;
+    uint32_t tileSize;
+    uint32_t numLevels;
+    uint64_t texelCount;
+};
+static const size_t DATA_OFFSET = 64;
+
+static inline uint32_t packTexel( float r, float g, float b, float a ) {
+    auto q = [](float v) { return uint32_t(Max(0.0f, Min(255.0f, v + 0.5f))); };
+    return q(r) | (q(g) << 8) | (q(b) << 16) | (q(a) << 24);
+}
+
+static inline Color unpackTexel( uint32_t t ) {
+    return Color(float(t & 0xFF), float((t >> 8) & 0xFF), float((t >> 16) & 0xFF)) / 255.0f;
+}
+
+bool TiledMipMap::LoadFile( char const *filename ) {
+    TRACE_SCOPE("MIP map load");
+    auto start = std::chrono::steady_clock::now();
+    name = filename;
+
+    MappedFile source;
+    if (!source.Open(filename)) {
+        fprintf(stderr, "Cannot open texture %s\n", filename);
+        return false;
+    }
+    uint64_t hash = HashBytes(source.Data(), source.Size());
+    char cacheFile[64];
+    snprintf(cacheFile, sizeof(cacheFile), TEXTURE_CACHE_DIR "/%016llx.mip", (unsigned long long)hash);
+
+    fromCache = loadCache(cacheFile, hash);
+    if (!fromCache) {
+        std::vector<unsigned char> rgba;
+        unsigned width, height;
+        unsigned error;
+        {
+            TRACE_SCOPE("PNG decode");
+            error = lodepng::decode(rgba, width, height, reinterpret_cast<unsigned char const*>(source.Data()), source.Size(), LCT_RGBA, 8);
+        }
+        if (error) {
+            fprintf(stderr, "Cannot load texture %s: %s\n", filename, lodepng_error_text(error));
+            return false;
+        }
+        Build(rgba.data(), int(width), int(height));
+        saveCache(cacheFile, hash);
+    }
+
+    loadSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return true;
+}
+
+bool TiledMipMap::loadCache( char const *cacheFile, uint64_t hash ) {
+    if (!cache.Open(cacheFile)) return false;
+
+    MipCacheHeader header;
+    bool valid = cache.Size() >= DATA_OFFSET;
+    if (valid) {
+        memcpy(&header, cache.Data(), sizeof(header));
+        valid = memcmp(header.magic, "TMIP", 4) == 0 && header.version == TEXTURE_CACHE_VERSION &&
+                header.sourceHash == hash && header.tileSize == TILE_SIZE;
+    }
+    // the level layout is recomputed, so it must match the stored texel count
+    if (valid) {
+        size_t count = layout(int(header.width), int(header.height));
+        valid = count == header.texelCount && int(header.numLevels) == NumLevels() &&
+                cache.Size() >= DATA_OFFSET + count * sizeof(uint32_t);
+    }
+    if (!valid) {
+        fprintf(stderr, "Ignoring stale texture cache %s\n", cacheFile);
+        cache.Close();
+        levels.clear();
+        return false;
+    }
+
+    storage.clear();
+    texels = reinterpret_cast<uint32_t const*>(cache.Data() + DATA_OFFSET);
+    return true;
+}
+
+void TiledMipMap::saveCache( char const *cacheFile, uint64_t hash ) const {
+    mkdir(TEXTURE_CACHE_DIR, 0755);
+
+    // write under a name of this process and call, so that other processes never map a
+    // partial file, and two textures with the same contents, which share a cache file, can
+    // be written by two load tasks at once
+    static std::atomic<unsigned int> tmpFileCount(0);
+    char tmpFile[96];
+    snprintf(tmpFile, sizeof(tmpFile), "%s.%d.%u", cacheFile, int(getpid()), tmpFileCount++);
+    FILE *fp = fopen(tmpFile, "wb");
+    if (!fp) {
+        fprintf(stderr, "Cannot write texture cache %s\n", tmpFile);
+        return;
+    }
+
+    MipCacheHeader header;
+    memcpy(header.magic, "TMIP", 4);
+    header.version = TEXTURE_CACHE_VERSION;
+    header.sourceHash = hash;
+    header.width = GetWidth();
+    header.height = GetHeight();
+    header.tileSize = TILE_SIZE;
+    header.numLevels = NumLevels();
+    header.texelCount = TexelCount();
+    char block[DATA_OFFSET] = {};
+    memcpy(block, &header, sizeof(header));
+
+    bool ok = fwrite(block, 1, DATA_OFFSET, fp) == DATA_OFFSET &&
+              fwrite(texels, sizeof(uint32_t), TexelCount(), fp) == TexelCount();
+    ok = fclose(fp) == 0 && ok;
+    if (!ok || rename(tmpFile, cacheFile) != 0) {
+        fprintf(stderr, "Cannot write texture cache %s\n", cacheFile);
+        remove(tmpFile);
+    }
+}
+
+size_t TiledMipMap::layout( int width, int height ) {
+    levels.clear();
+    size_t offset = 0;
+    for (int w = width, h = height; ; w = Max(1, w / 2), h = Max(1, h / 2)) {
+        Level level;
+        level.width = w;
+        level.height = h;
+        level.tilesX = (w + TILE_SIZE - 1) / TILE_SIZE;
+        level.tilesY = (h + TILE_SIZE - 1) / TILE_SIZE;
+        level.offset = offset;
+        offset += size_t(level.tilesX) * level.tilesY * TILE_TEXELS;
+        levels.push_back(level);
+        if ((w == 1 && h == 1) || int(levels.size()) == MAX_LEVELS) break;
+    }
+    return offset;
+}
+
+void TiledMipMap::Build( unsigned char const *rgba, int width, int height ) {
+    cache.Close();
+    storage.assign(layout(width, height), 0);
+    texels = storage.data();
+
+    // each level is filtered from the previous one in row order, then copied into its tiles
+    std::vector<uint32_t> rows(rgba ? size_t(width) * height : 0);
+    for (size_t i = 0; i < rows.size(); i++) {
+        rows[i] = packTexel(rgba[4*i], rgba[4*i+1], rgba[4*i+2], rgba[4*i+3]);
+    }
+    for (size_t l = 0; l < levels.size(); l++) {
+        Level const &level = levels[l];
+        if (l > 0) {
+            Level const &prev = levels[l-1];
+            std::vector<uint32_t> next(size_t(level.width) * level.height);
+            for (int y = 0; y < level.height; y++) {
+                for (int x = 0; x < level.width; x++) {
+                    // box filter over the 2x2 (or narrower) block of the previous level
+                    float sum[4] = { 0, 0, 0, 0 };
+                    int n = 0;
+                    for (int j = 2*y; j < Min(2*y + 2, prev.height); j++) {
+                        for (int i = 2*x; i < Min(2*x + 2, prev.width); i++) {
+                            uint32_t t = rows[size_t(j) * prev.width + i];
+                            for (int c = 0; c < 4; c++) sum[c] += float((t >> (8*c)) & 0xFF);
+                            n++;
+                        }
+                    }
+                    next[size_t(y) * level.width + x] = packTexel(sum[0]/n, sum[1]/n, sum[2]/n, sum[3]/n);
+                }
+            }
+            rows.swap(next);
+        }
+        for (int y = 0; y < level.height; y++) {
+            for (int x = 0; x < level.width; x++) {
+                size_t tile = size_t(y / TILE_SIZE) * level.tilesX + (x / TILE_SIZE);
+                size_t inTile = (y % TILE_SIZE) * TILE_SIZE + (x % TILE_SIZE);
+                storage[level.offset + tile * TILE_TEXELS + inTile] = rows[size_t(y) * level.width + x];
+            }
+        }
+    }
+}
+
+inline uint32_t TiledMipMap::texel( Level const &level, int x, int y ) const {
+    size_t tile = size_t(y / TILE_SIZE) * level.tilesX + (x / TILE_SIZE);
+    return texels[level.offset + tile * TILE_TEXELS + (y % TILE_SIZE) * TILE_SIZE + (x % TILE_SIZE)];
+}
+
+//----------------------------------------------------------------
+
+// lookups per texture and level, one fixed size table per thread so that counting is free
+// of contention and the report never reads a table that is growing; textures past the
+// table are not counted
+static const int COUNTED_TEXTURES = 64;
+struct LookupStats
+{
+    unsigned long long lookups[COUNTED_TEXTURES][TiledMipMap::MAX_LEVELS] = {};
+};
+
+#if RENDER_STATS
+static std::mutex statsMutex;
+static std::vector<LookupStats*> threadStats;
+
+static LookupStats& localStats() {
+    static thread_local LookupStats *stats = nullptr;
+    if (!stats) {
+        stats = new LookupStats();
+        std::lock_guard<std::mutex> lock(statsMutex);
+        threadStats.push_back(stats);
+    }
+    return *stats;
+}
+
+static inline void countLookup( int id, int level ) {
+    if (id < COUNTED_TEXTURES) localStats().lookups[id][level]++;
+}
+#else
+static inline void countLookup( int, int ) {}
+#endif
+
+//----------------------------------------------------------------
+
+Color TiledMipMap::bilinear( int l, float u, float v ) const {
+    Level const &level = levels[l];
+    countLookup(id, l);
+
+    // same texel placement and wrapping as the framework's image textures
+    u -= int(u);
+    if (u < 0) u += 1;
+    v -= int(v);
+    if (v < 0) v += 1;
+    float x = level.width * u;
+    float y = level.height * v;
+    int ix = Min(int(x), level.width - 1);
+    int iy = Min(int(y), level.height - 1);
+    float fx = x - ix;
+    float fy = y - iy;
+    int ixp = ix + 1 < level.width ? ix + 1 : 0;
+    int iyp = iy + 1 < level.height ? iy + 1 : 0;
+
+    return unpackTexel(texel(level, ix,  iy )) * ((1 - fx) * (1 - fy)) +
+           unpackTexel(texel(level, ixp, iy )) * (fx * (1 - fy)) +
+           unpackTexel(texel(level, ix,  iyp)) * ((1 - fx) * fy) +
+           unpackTexel(texel(level, ixp, iyp)) * (fx * fy);
+}
+
+Color TiledMipMap::Eval( Vec3f const &uvw, float footprint ) const {
+    if (levels.empty()) return Color(0, 0, 0);
+
+    // level whose texels are as wide as the footprint
+    float lod = footprint > 0 ? log2f(footprint * Max(GetWidth(), GetHeight())) : 0;
+    int last = NumLevels() - 1;
+    if (lod <= 0) return bilinear(0, uvw.x, uvw.y);
+    if (lod >= last) return bilinear(last, uvw.x, uvw.y);
+
+    int l = int(lod);
+    float t = lod - l;
+    return bilinear(l, uvw.x, uvw.y) * (1 - t) + bilinear(l + 1, uvw.x, uvw.y) * t;
+}
+
+//----------------------------------------------------------------
+
+// a pyramid built when a lookup first needs it, with <lazyload>
+class LazyMipMap : public LazyItem
+{
+private:
+    std::string filename;
+    int id;
+
+public:
+    LazyMipMap( char const *file, int i ) : filename(file), id(i) {}
+    ~LazyMipMap() { release(); }
+
+    char const* GetName() const override { return filename.c_str(); }
+    int GetID() const { return id; }
+    TiledMipMap const* Get() const { return static_cast<TiledMipMap const*>(acquire()); }
+
+protected:
+    void* load( size_t &dataBytes ) const override {
+        TRACE_SCOPE("LazyMipMap load");
+        TiledMipMap *mip = new TiledMipMap();
+        if (!mip->LoadFile(filename.c_str())) {
+            delete mip;
+            return nullptr;
+        }
+        mip->SetID(id);
+        dataBytes = mip->MemoryBytes();
+        return mip;
+    }
+    void unload( void *d ) const override { delete static_cast<TiledMipMap*>(d); }
+};
+
+struct MipMapRef
+{
+    TiledMipMap const *mip;     // the pyramid, or null when it is lazy
+    LazyMipMap const *lazy;
+};
+
+static std::vector<TiledMipMap*> mipmaps;
+static std::vector<LazyMipMap*> lazyMipMaps;
+static std::unordered_map<Texture const*, MipMapRef> byTexture;
+
+static thread_local float pathFootprint = 0;
+
+void SetTextureFootprint( float footprint ) { pathFootprint = footprint; }
+float GetTextureFootprint() { return pathFootprint; }
+
+static bool isImageFile( char const *name ) {
+    size_t len = strlen(name);
+    return len > 4 && strcasecmp(name + len - 4, ".png") == 0;
+}
+
+// the pyramid of a texture map's image, sharing pyramids between textures of the same file;
+// new pyramids are built later and added to files with the image they are built from
+static void addTexture( TextureMap const *map, std::vector<char const*> &files ) {
+    if (!map || !map->GetTexture()) return;
+    Texture const *texture = map->GetTexture();
+    if (byTexture.count(texture) || !isImageFile(texture->GetName())) return;
+
+    // the pyramids are not loaded yet, so their files are known by the textures using them
+    for (auto const &t : byTexture) {
+        if (strcmp(t.first->GetName(), texture->GetName()) == 0) {
+            byTexture[texture] = t.second;
+            return;
+        }
+    }
+    int id = int(mipmaps.size() + lazyMipMaps.size());
+    if (IsLazyLoading()) {
+        LazyMipMap *lazy = new LazyMipMap(texture->GetName(), id);
+        lazyMipMaps.push_back(lazy);
+        byTexture[texture] = { nullptr, lazy };
+        return;
+    }
+    TiledMipMap *mip = new TiledMipMap();
+    mip->SetID(id);
+    mipmaps.push_back(mip);
+    files.push_back(texture->GetName());
+    byTexture[texture] = { mip, nullptr };
+}
+
+// drop the pyramids whose image could not be loaded and number the rest again
+static void dropFailedMipMaps( std::vector<char> const &loaded ) {
+    std::unordered_set<TiledMipMap const*> failed;
+    size_t kept = 0;
+    for (size_t i = 0; i < mipmaps.size(); i++) {
+        if (loaded[i]) mipmaps[kept++] = mipmaps[i];
+        else failed.insert(mipmaps[i]);
+    }
+    if (failed.empty()) return;
+    mipmaps.resize(kept);
+    for (auto it = byTexture.begin(); it != byTexture.end();) {
+        if (it->second.mip && failed.count(it->second.mip)) it = byTexture.erase(it);
+        else ++it;
+    }
+    for (TiledMipMap const *f : failed) delete f;
+    int id = 0;
+    for (TiledMipMap *m : mipmaps) m->SetID(id++);
+}
+
+void BuildMipMaps( Scene const &scene, LoadPipeline &pipeline ) {
+    TRACE_SCOPE("BuildMipMaps");
+    for (TiledMipMap *m : mipmaps) delete m;
+    mipmaps.clear();
+    for (LazyMipMap *m : lazyMipMaps) delete m;
+    lazyMipMaps.clear();
+    byTexture.clear();
+
+    std::vector<char const*> files;
+
+    for (Material const *m : scene.materials) {
+        MtlBlinn const *mtl = dynamic_cast<MtlBlinn const*>(m);
+        if (!mtl) continue;
+        addTexture(mtl->Diffuse().GetTexture(), files);
+        addTexture(mtl->Specular().GetTexture(), files);
+        addTexture(mtl->Refraction().GetTexture(), files);
+        addTexture(mtl->Emission().GetTexture(), files);
+    }
+    if (mipmaps.empty()) return;
+
+    // the pyramids are decoded and built concurrently with the other assets of the scene,
+    // the textures outlive the pipeline so their file names can be kept
+    std::shared_ptr<std::vector<char>> loaded = std::make_shared<std::vector<char>>(mipmaps.size(), 0);
+    for (size_t i = 0; i < mipmaps.size(); i++) {
+        TiledMipMap *mip = mipmaps[i];
+        char const *file = files[i];
+        struct stat st;
+        size_t cost = stat(file, &st) == 0 ? size_t(st.st_size) : 0;
+        pipeline.Add("texture", file, cost, [mip, file, loaded, i]() {
+            (*loaded)[i] = mip->LoadFile(file);
+            return bool((*loaded)[i]);
+        });
+    }
+    pipeline.AddFinish([loaded]() {
+        dropFailedMipMaps(*loaded);
+        for (TiledMipMap const *m : mipmaps) {
+            fprintf(stdout, "Texture %s: %dx%d, %d levels of %dx%d tiles, %.2f MB, %s in %.1f ms\n", m->GetName(),
+                    m->GetWidth(), m->GetHeight(), m->NumLevels(), TiledMipMap::TILE_SIZE, TiledMipMap::TILE_SIZE,
+                    m->MemoryBytes() / (1024.0 * 1024.0), m->IsFromCache() ? "mapped from cache" : "decoded",
+                    m->LoadSeconds() * 1000.0);
+        }
+    });
+}
+
+TiledMipMap const* FindMipMap( Texture const *texture ) {
+    auto it = byTexture.find(texture);
+    if (it == byTexture.end()) return nullptr;
+    return it->second.lazy ? it->second.lazy->Get() : it->second.mip;
+}
+
+Color EvalFiltered( TexturedColor const &color, Vec3f const &uvw, float footprint ) {
+    TextureMap const *map = color.GetTexture();
+    if (!map) return color.GetColor();
+    TiledMipMap const *mip = FindMipMap(map->GetTexture());
+    if (!mip) return color.Eval(uvw);
+
+    // the texture map's transformation also scales the footprint
+    if (footprint > 0) {
+        footprint *= (map->TransformTo(Vec3f(1, 1, 0)) - map->TransformTo(Vec3f(0, 0, 0))).Length() * 0.70710678f;
+    }
+    return color.GetColor() * mip->Eval(map->TransformTo(uvw), footprint);
+}
+
+void PrintMipMapReport() {
+    // lazy pyramids that are not loaded at the end of the render are left out
+    std::vector<TiledMipMap const*> report(mipmaps.begin(), mipmaps.end());
+    for (LazyMipMap const *m : lazyMipMaps) {
+        if (m->IsLoaded()) report.push_back(m->Get());
+    }
+    if (report.empty()) return;
+
+    // sum the tables of all threads
+    LookupStats total;
+#if RENDER_STATS
+    {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        for (LookupStats const *stats : threadStats) {
+            for (int t = 0; t < COUNTED_TEXTURES; t++) {
+                for (int l = 0; l < TiledMipMap::MAX_LEVELS; l++) total.lookups[t][l] += stats->lookups[t][l];
+            }
+        }
+    }
+#endif
+
+    fprintf(stdout, "Texture lookups:\n");
+    for (TiledMipMap const *m : report) {
+        unsigned long long const *levelLookups = m->GetID() < COUNTED_TEXTURES ? total.lookups[m->GetID()] : nullptr;
+        unsigned long long sum = 0;
+        for (int l = 0; levelLookups && l < m->NumLevels(); l++) sum += levelLookups[l];
+
+        // each bilinear lookup reads four texels, which share a tile unless they straddle its edge
+        double texelBytes = double(sum) * 4 * sizeof(uint32_t);
+        fprintf(stdout, "  %s: %.2f MB resident, %llu lookups, %.2f MB texels read\n", m->GetName(),
+                m->MemoryBytes() / (1024.0 * 1024.0), sum, texelBytes / (1024.0 * 1024.0));
+        if (sum == 0) continue;
+        fprintf(stdout, "   ");
+        for (int l = 0; l < m->NumLevels(); l++) {
+            if (levelLookups[l] == 0) continue;
+            TiledMipMap::Level const &level = m->GetLevel(l);
+            fprintf(stdout, " L%d(%dx%d) %.1f%%", l, level.width, level.height, 100.0 * levelLookups[l] / sum);
+        }
+        fprintf(stdout, "\n");
+    }
+}
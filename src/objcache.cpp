@@ -0,0 +1,431 @@
+#include "objcache.h"
+#include "mappedfile.h"
+#include "trace.h"
+#include "cyTriMesh.h"
+#include "cyBVH.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <sys/stat.h>
+
+namespace {
+
+char const *CACHE_EXTENSION = ".cymesh";
+const uint32_t CACHE_VERSION = 3;
+
+// sections of a cache file, each one starts at a 64 byte boundary
+enum { CACHE_V, CACHE_VT, CACHE_VN, CACHE_F, CACHE_FT, CACHE_FN, CACHE_MCFC, CACHE_STRINGS, CACHE_BVH_NODES, CACHE_BVH_ELEMENTS, CACHE_SECTIONS };
+
+struct CacheHeader
+{
+    char     magic[4];          // "CYOB"
+    uint32_t version;
+    uint64_t sourceHash;        // hash of the OBJ file contents
+    uint64_t sourceSize;        // size and modification time in nanoseconds of the OBJ file,
+    uint64_t sourceTime;        // which tell an unchanged file without hashing it
+    uint32_t nv, nf, nvn, nvt, nm;
+    uint32_t loadMtl;
+    uint32_t numMtlLibs;        // the string section holds the mtllib names followed by the material names
+    uint32_t bvhMaxElements;    // zero if no BVH is stored
+    uint32_t bvhNodeSize;
+    uint32_t bvhNumNodes;
+    uint32_t bvhNumElements;
+    uint32_t reserved;
+    uint64_t offset[CACHE_SECTIONS];
+    uint64_t size  [CACHE_SECTIONS];
+};
+
+size_t alignSection( size_t n ) { return (n + 63) & ~size_t(63); }
+
+// FNV-1a style hash over 8-byte words, the tail is hashed byte by byte
+uint64_t hashObjText( char const *data, size_t size ) {
+    uint64_t hash = 14695981039346656037ULL;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t w;
+        memcpy(&w, data + i, 8);
+        hash = (hash ^ w) * 1099511628211ULL;
+        hash ^= hash >> 29;
+    }
+    for (; i < size; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// the size and modification time of a file, false if it cannot be read
+bool fileStamp( char const *filename, uint64_t &size, uint64_t &time ) {
+    struct stat st;
+    if (stat(filename, &st) != 0) return false;
+    size = uint64_t(st.st_size);
+    time = uint64_t(st.st_mtim.tv_sec) * 1000000000ULL + uint64_t(st.st_mtim.tv_nsec);
+    return true;
+}
+
+// the header of a mapped cache file, null if the file is not a cache or its sections do not fit
+CacheHeader const* validHeader( MappedFile const &file ) {
+    if (file.Size() < sizeof(CacheHeader)) return nullptr;
+    CacheHeader const &h = *reinterpret_cast<CacheHeader const*>(file.Data());
+    if (memcmp(h.magic, "CYOB", 4) != 0 || h.version != CACHE_VERSION) return nullptr;
+    for (int i = 0; i < CACHE_SECTIONS; i++) {
+        if (h.size[i] > 0 && (h.offset[i] % 64 != 0 || h.offset[i] + h.size[i] > file.Size())) return nullptr;
+    }
+    bool sizes = h.size[CACHE_V] == h.nv * sizeof(cy::Vec3f) && h.size[CACHE_F] == h.nf * sizeof(cy::TriMesh::TriFace)
+              && h.size[CACHE_VT] == h.nvt * sizeof(cy::Vec3f) && h.size[CACHE_FT] == (h.nvt > 0 ? h.nf : 0) * sizeof(cy::TriMesh::TriFace)
+              && h.size[CACHE_VN] == h.nvn * sizeof(cy::Vec3f) && h.size[CACHE_FN] == (h.nvn > 0 ? h.nf : 0) * sizeof(cy::TriMesh::TriFace)
+              && h.size[CACHE_MCFC] == h.nm * sizeof(int);
+    return sizes ? &h : nullptr;
+}
+
+// what the load of a mesh leaves for the hooks of its trees, which read the stored tree or
+// write the cache file once the first tree is built; an entry stays until the same address
+// loads another mesh, so every tree over a mesh, not only the first, can be read from the file
+struct MeshSource
+{
+    std::string cacheFile;
+    uint64_t sourceHash = 0;
+    uint64_t sourceSize = 0, sourceTime = 0;
+    bool loadMtl = true;
+    std::vector<std::string> mtlLibs;   // mtllib file names
+    std::vector<std::string> mtlNames;  // material names in material index order
+    unsigned int nv = 0, nf = 0;
+    cy::Vec3f const *vertices = nullptr;    // tells a reloaded mesh from a new one at the same address
+    bool written = false;                   // the file was written since the mesh was loaded
+};
+
+std::mutex sourcesMutex;
+std::unordered_map<cy::TriMesh const*, MeshSource> sources;
+std::atomic<unsigned int> tmpFileCount(0);
+
+cy::Vec3f const* vertexArray( cy::TriMesh const &mesh ) { return mesh.NV() > 0 ? &mesh.V(0) : nullptr; }
+
+bool isSourceOf( MeshSource const &s, cy::TriMesh const &mesh ) {
+    return s.nv == mesh.NV() && s.nf == mesh.NF() && s.vertices == vertexArray(mesh);
+}
+
+// copies the source of a mesh, false if the mesh has none or is not the one that was loaded
+bool findSource( cy::TriMesh const *mesh, MeshSource &s ) {
+    std::lock_guard<std::mutex> lock(sourcesMutex);
+    auto it = sources.find(mesh);
+    if (it == sources.end() || !isSourceOf(it->second, *mesh)) return false;
+    s = it->second;
+    return true;
+}
+
+void putSource( cy::TriMesh const *mesh, MeshSource &&s ) {
+    std::lock_guard<std::mutex> lock(sourcesMutex);
+    sources[mesh] = std::move(s);
+}
+
+void forgetSource( cy::TriMesh const *mesh ) {
+    std::lock_guard<std::mutex> lock(sourcesMutex);
+    sources.erase(mesh);
+}
+
+// true if the section holds exactly the given array
+bool sameSection( MappedFile const &file, CacheHeader const &h, int section, void const *data, size_t size ) {
+    return h.size[section] == size && (size == 0 || memcmp(file.Data() + h.offset[section], data, size) == 0);
+}
+
+void readSection( MappedFile const &file, CacheHeader const &h, int section, void *to ) {
+    if (h.size[section] > 0) memcpy(to, file.Data() + h.offset[section], h.size[section]);
+}
+
+// the arrays are copied out of the mapping: cy::TriMesh and cy::BVH own their arrays and
+// free them, so they cannot point into a mapped file without changing the vendored classes;
+// the copy still skips parsing, normal computation and the tree build
+bool readMesh( cy::TriMesh &mesh, MeshSource &p ) {
+    MappedFile file;
+    if (!file.Open(p.cacheFile.c_str())) return false;
+    CacheHeader const *h = validHeader(file);
+    if (!h || h->sourceHash != p.sourceHash || h->loadMtl != (p.loadMtl ? 1u : 0u)) return false;
+
+    // the string section holds null terminated names
+    char const *str = file.Data() + h->offset[CACHE_STRINGS];
+    char const *strEnd = str + h->size[CACHE_STRINGS];
+    for (unsigned int i = 0; i < h->numMtlLibs + h->nm; i++) {
+        char const *e = static_cast<char const*>(memchr(str, '\0', strEnd - str));
+        if (!e) return false;
+        if (i < h->numMtlLibs) p.mtlLibs.push_back(str);
+        else p.mtlNames.push_back(str);
+        str = e + 1;
+    }
+
+    mesh.SetNumVertex(h->nv);
+    mesh.SetNumFaces(h->nf);
+    mesh.SetNumTexVerts(h->nvt);
+    mesh.SetNumNormals(h->nvn);
+    mesh.SetNumMtls(h->nm);
+    if (h->nv > 0) readSection(file, *h, CACHE_V, &mesh.V(0));
+    if (h->nf > 0) readSection(file, *h, CACHE_F, &mesh.F(0));
+    if (h->nvt > 0) {
+        readSection(file, *h, CACHE_VT, &mesh.VT(0));
+        readSection(file, *h, CACHE_FT, &mesh.FT(0));
+    }
+    if (h->nvn > 0) {
+        readSection(file, *h, CACHE_VN, &mesh.VN(0));
+        readSection(file, *h, CACHE_FN, &mesh.FN(0));
+    }
+    int const *mcfc = reinterpret_cast<int const*>(file.Data() + h->offset[CACHE_MCFC]);
+    for (unsigned int i = 0; i < h->nm; i++) mesh.SetMaterialCumulativeFaceCount(int(i), mcfc[i]);
+    return true;
+}
+
+void writeCache( cy::TriMesh const &mesh, MeshSource const &p, cy::BVHTriMesh const &bvh, unsigned int maxElementsPerNode ) {
+    TRACE_SCOPE("OBJ cache write");
+    std::string strings;
+    for (std::string const &s : p.mtlLibs) { strings += s; strings += '\0'; }
+    for (std::string const &s : p.mtlNames) { strings += s; strings += '\0'; }
+    std::vector<int> mcfc(mesh.NM());
+    for (unsigned int i = 0; i < mesh.NM(); i++) mcfc[i] = mesh.GetMaterialFirstFace(int(i)) + mesh.GetMaterialFaceCount(int(i));
+
+    CacheHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, "CYOB", 4);
+    h.version = CACHE_VERSION;
+    h.sourceHash = p.sourceHash;
+    h.sourceSize = p.sourceSize;
+    h.sourceTime = p.sourceTime;
+    h.nv = mesh.NV();  h.nf = mesh.NF();  h.nvn = mesh.NVN();  h.nvt = mesh.NVT();  h.nm = mesh.NM();
+    h.loadMtl = p.loadMtl ? 1 : 0;
+    h.numMtlLibs = uint32_t(p.mtlLibs.size());
+    h.bvhMaxElements = maxElementsPerNode;
+    h.bvhNodeSize = uint32_t(cy::BVH::NodeSize());
+    h.bvhNumNodes = bvh.GetNumNodes();
+    h.bvhNumElements = bvh.GetNumElements();
+    bool hasF = h.nf > 0;
+    void const *data[CACHE_SECTIONS] = {
+        h.nv > 0 ? &mesh.V(0) : nullptr, h.nvt > 0 ? &mesh.VT(0) : nullptr, h.nvn > 0 ? &mesh.VN(0) : nullptr,
+        hasF ? &mesh.F(0) : nullptr, hasF && h.nvt > 0 ? &mesh.FT(0) : nullptr, hasF && h.nvn > 0 ? &mesh.FN(0) : nullptr,
+        mcfc.data(), strings.data(), bvh.GetNodeData(), bvh.GetElementData() };
+    h.size[CACHE_V ] = sizeof(cy::Vec3f) * h.nv;
+    h.size[CACHE_VT] = sizeof(cy::Vec3f) * h.nvt;
+    h.size[CACHE_VN] = sizeof(cy::Vec3f) * h.nvn;
+    h.size[CACHE_F ] = sizeof(cy::TriMesh::TriFace) * h.nf;
+    h.size[CACHE_FT] = h.nvt > 0 ? sizeof(cy::TriMesh::TriFace) * h.nf : 0;
+    h.size[CACHE_FN] = h.nvn > 0 ? sizeof(cy::TriMesh::TriFace) * h.nf : 0;
+    h.size[CACHE_MCFC] = sizeof(int) * h.nm;
+    h.size[CACHE_STRINGS] = strings.size();
+    h.size[CACHE_BVH_NODES] = cy::BVH::NodeSize() * h.bvhNumNodes;
+    h.size[CACHE_BVH_ELEMENTS] = sizeof(unsigned int) * h.bvhNumElements;
+    size_t offset = alignSection(sizeof(h));
+    for (int i = 0; i < CACHE_SECTIONS; i++) {
+        h.offset[i] = offset;
+        offset = alignSection(offset + h.size[i]);
+    }
+
+    // write under a name of this process and call, so that a partial file is never read
+    // and concurrent loads of the same file do not write into each other's file
+    char tmpFile[1024];
+    snprintf(tmpFile, sizeof(tmpFile), "%s.%d.%u", p.cacheFile.c_str(), int(getpid()), tmpFileCount++);
+    FILE *fp = fopen(tmpFile, "wb");
+    if (!fp) return;
+    bool ok = fwrite(&h, sizeof(h), 1, fp) == 1;
+    static char const zeros[64] = {};
+    size_t pos = sizeof(h);
+    for (int i = 0; ok && i < CACHE_SECTIONS; i++) {
+        if (h.size[i] == 0) continue;
+        ok = fwrite(zeros, 1, h.offset[i] - pos, fp) == h.offset[i] - pos && fwrite(data[i], 1, h.size[i], fp) == h.size[i];
+        pos = h.offset[i] + h.size[i];
+    }
+    ok = fclose(fp) == 0 && ok;
+    if (!ok || rename(tmpFile, p.cacheFile.c_str()) != 0) remove(tmpFile);
+}
+
+// the vendored classes have no trace scopes of their own, so the hooks put the parse of
+// each file and the build of each tree on the timeline
+bool cacheEnabled = false;
+thread_local uint64_t parseStart = 0;
+thread_local uint64_t buildStart = 0;
+
+uint64_t traceStart() {
+#if RENDER_TRACE
+    return TraceNow();
+#else
+    return 0;
+#endif
+}
+
+void traceEnd( char const *name, uint64_t start ) {
+#if RENDER_TRACE
+    TraceRecord(name, start, TraceNow());
+#else
+    (void)name; (void)start;
+#endif
+}
+
+// cy::TriMesh hooks
+
+bool loadMesh( cy::TriMesh &mesh, char const *filename, bool loadMtl, std::ostream *outStream ) {
+    parseStart = traceStart();
+    if (!cacheEnabled) return false;
+    TRACE_SCOPE("OBJ cache read");
+    MeshSource p;
+    p.cacheFile = std::string(filename) + CACHE_EXTENSION;
+    p.loadMtl = loadMtl;
+    MappedFile obj;
+    if (!fileStamp(filename, p.sourceSize, p.sourceTime) || !obj.Open(filename)) {
+        forgetSource(&mesh);
+        return false;
+    }
+    p.sourceHash = hashObjText(obj.Data(), obj.Size());
+    obj.Close();
+    bool read = readMesh(mesh, p);
+    if (read && loadMtl) mesh.LoadMtlFiles(filename, p.mtlLibs, p.mtlNames, outStream);
+    if (!read) {
+        p.mtlLibs.clear();
+        p.mtlNames.clear();
+    }
+    // a parsed mesh gets its names and arrays when parsing is done
+    p.nv = mesh.NV();
+    p.nf = mesh.NF();
+    p.vertices = vertexArray(mesh);
+    putSource(&mesh, std::move(p));
+    return read;
+}
+
+void parsedMesh( cy::TriMesh const &mesh, char const *, bool, std::vector<std::string> const &mtlLibs, std::vector<std::string> const &mtlNames ) {
+    traceEnd("OBJ parse", parseStart);
+    if (!cacheEnabled) return;
+    std::lock_guard<std::mutex> lock(sourcesMutex);
+    auto it = sources.find(&mesh);
+    if (it == sources.end()) return;
+    it->second.mtlLibs = mtlLibs;
+    it->second.mtlNames = mtlNames;
+    it->second.nv = mesh.NV();
+    it->second.nf = mesh.NF();
+    it->second.vertices = vertexArray(mesh);
+}
+
+// the parser threads of a file loaded on this thread, zero for one per core
+thread_local unsigned int parseThreads = 0;
+
+void parallelFor( unsigned int count, void (*func)(unsigned int i, void *data), void *data ) {
+    unsigned int threads = parseThreads > 0 ? parseThreads : std::thread::hardware_concurrency();
+    if (threads > count) threads = count;
+    std::atomic<unsigned int> next(0);
+    auto work = [&]() {
+        for (unsigned int i = next++; i < count; i = next++) {
+            TRACE_SCOPE("OBJ chunk");
+            func(i, data);
+        }
+    };
+    std::vector<std::thread> workers;
+    for (unsigned int t = 1; t < threads; t++) workers.emplace_back(work);
+    work();
+    for (std::thread &t : workers) t.join();
+}
+
+// the tree last built or read for each mesh, so that the packet tracer can walk the tree
+// of a TriObj instead of building its own
+std::mutex treesMutex;
+std::unordered_map<cy::TriMesh const*, cy::BVHTriMesh const*> trees;
+
+void putTree( cy::TriMesh const *mesh, cy::BVHTriMesh const &bvh ) {
+    std::lock_guard<std::mutex> lock(treesMutex);
+    trees[mesh] = &bvh;
+}
+
+// cy::BVHTriMesh hooks
+
+bool loadTree( cy::BVHTriMesh &bvh, cy::TriMesh const *mesh, unsigned int maxElementsPerNode ) {
+    buildStart = traceStart();
+    if (!cacheEnabled) return false;
+    MeshSource s;
+    if (!findSource(mesh, s)) return false;
+    MappedFile file;
+    CacheHeader const *h = file.Open(s.cacheFile.c_str()) ? validHeader(file) : nullptr;
+    if (!h || h->sourceHash != s.sourceHash || h->bvhNumNodes == 0 || h->bvhMaxElements != maxElementsPerNode
+           || h->bvhNodeSize != cy::BVH::NodeSize() || h->bvhNumElements != mesh->NF()
+           || h->size[CACHE_BVH_NODES] != cy::BVH::NodeSize() * h->bvhNumNodes
+           || h->size[CACHE_BVH_ELEMENTS] != sizeof(unsigned int) * h->bvhNumElements) return false;
+    // the stored tree only fits a mesh whose vertices and faces were not changed since loading
+    if (!sameSection(file, *h, CACHE_V, vertexArray(*mesh), sizeof(cy::Vec3f) * mesh->NV())
+            || !sameSection(file, *h, CACHE_F, mesh->NF() > 0 ? &mesh->F(0) : nullptr, sizeof(cy::TriMesh::TriFace) * mesh->NF())) return false;
+    bvh.SetRawData(file.Data() + h->offset[CACHE_BVH_NODES], h->bvhNumNodes,
+                   reinterpret_cast<unsigned int const*>(file.Data() + h->offset[CACHE_BVH_ELEMENTS]), h->bvhNumElements);
+    putTree(mesh, bvh);
+    return true;
+}
+
+void builtTree( cy::BVHTriMesh const &bvh, cy::TriMesh const *mesh, unsigned int maxElementsPerNode ) {
+    traceEnd("BVH build", buildStart);
+    putTree(mesh, bvh);
+    if (!cacheEnabled) return;
+    // the file is written with the first tree built for the mesh, the whole file at once
+    MeshSource s;
+    {
+        std::lock_guard<std::mutex> lock(sourcesMutex);
+        auto it = sources.find(mesh);
+        if (it == sources.end() || it->second.written || !isSourceOf(it->second, *mesh)) return;
+        it->second.written = true;
+        s = it->second;
+    }
+    writeCache(*mesh, s, bvh, maxElementsPerNode);
+}
+
+}
+
+void SetObjLoadHooks( bool useCache ) {
+    cy::TriMesh::LoadHooks &meshHooks = cy::TriMesh::Hooks();
+    meshHooks.parallelFor = parallelFor;
+    meshHooks.maxChunks = std::thread::hardware_concurrency();
+    meshHooks.load = loadMesh;
+    meshHooks.parsed = parsedMesh;
+    cy::BVHTriMesh::BuildHooks &treeHooks = cy::BVHTriMesh::Hooks();
+    treeHooks.load = loadTree;
+    treeHooks.built = builtTree;
+    cacheEnabled = useCache;
+    {
+        // the meshes of an earlier scene are gone
+        std::lock_guard<std::mutex> lock(treesMutex);
+        trees.clear();
+    }
+    if (!useCache) {
+        std::lock_guard<std::mutex> lock(sourcesMutex);
+        sources.clear();
+    }
+}
+
+cy::BVHTriMesh const* ObjMeshTree( cy::TriMesh const *mesh ) {
+    std::lock_guard<std::mutex> lock(treesMutex);
+    auto it = trees.find(mesh);
+    if (it == trees.end() || it->second->GetNumElements() != mesh->NF()) return nullptr;
+    return it->second;
+}
+
+void SetObjParseThreads( unsigned int threads ) {
+    parseThreads = threads;
+}
+
+bool ObjCacheBounds( char const *filename, cy::Vec3f &boundMin, cy::Vec3f &boundMax ) {
+    std::string cacheFile = std::string(filename) + CACHE_EXTENSION;
+    uint64_t size, time;
+    if (!fileStamp(filename, size, time)) return false;
+    MappedFile file;
+    if (!file.Open(cacheFile.c_str())) return false;
+    CacheHeader const *h = validHeader(file);
+    if (!h || h->nv == 0) return false;
+    // a file with another size or time may still be unchanged, when it was copied or checked
+    // out again, so only its hash tells whether the stored vertices are still its own
+    if (h->sourceSize != size || h->sourceTime != time) {
+        MappedFile obj;
+        if (!obj.Open(filename) || hashObjText(obj.Data(), obj.Size()) != h->sourceHash) return false;
+    }
+    cy::Vec3f const *vert = reinterpret_cast<cy::Vec3f const*>(file.Data() + h->offset[CACHE_V]);
+    boundMin = boundMax = vert[0];
+    for (unsigned int i = 1; i < h->nv; i++) {
+        for (int j = 0; j < 3; j++) {
+            if (boundMin[j] > vert[i][j]) boundMin[j] = vert[i][j];
+            if (boundMax[j] < vert[i][j]) boundMax[j] = vert[i][j];
+        }
+    }
+    return true;
+}
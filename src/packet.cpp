@@ -0,0 +1,165 @@
+#include "packet.h"
+#include "objects.h"
+#include "tinyxml2.h"
+#include "trace.h"
+#include "cpudispatch.h"
+#include "objcache.h"
+
+#include <iostream>
+
+uint32_t PacketBoxMask( RayPacket const &p, float const *b, float const *tMax ) {
+    // a fixed number of lanes and the mask gathered afterwards let the slab tests compile
+    // to one loop of vector instructions for each instruction set
+    int32_t crosses[PACKET_MAX_SIZE];
+    for (int i = 0; i < PACKET_MAX_SIZE; i++) {
+        float tx0 = (b[0] - p.ox[i]) * p.ix[i], tx1 = (b[3] - p.ox[i]) * p.ix[i];
+        float ty0 = (b[1] - p.oy[i]) * p.iy[i], ty1 = (b[4] - p.oy[i]) * p.iy[i];
+        float tz0 = (b[2] - p.oz[i]) * p.iz[i], tz1 = (b[5] - p.oz[i]) * p.iz[i];
+        float tNear = std::max(std::max(std::min(tx0, tx1), std::min(ty0, ty1)), std::min(tz0, tz1));
+        float tFar = std::min(std::min(std::max(tx0, tx1), std::max(ty0, ty1)), std::max(tz0, tz1));
+        crosses[i] = (tNear <= tFar) & (tFar >= 0) & (tNear < tMax[i]);
+    }
+    uint32_t mask = 0;
+    for (int i = 0; i < PACKET_MAX_SIZE; i++) mask |= uint32_t(crosses[i]) << i;
+    return mask;
+}
+
+void PacketFrustum::Init( RayPacket const &p, uint32_t active ) {
+    coherent = active != 0;
+    for (int a = 0; a < 3; a++) {
+        oMin[a] = iMin[a] = BIGFLOAT;
+        oMax[a] = iMax[a] = -BIGFLOAT;
+    }
+    float const *o[3] = { p.ox, p.oy, p.oz };
+    float const *d[3] = { p.dx, p.dy, p.dz };
+    float const *inv[3] = { p.ix, p.iy, p.iz };
+    for (uint32_t m = active; m; m &= m - 1) {
+        int i = __builtin_ctz(m);
+        for (int a = 0; a < 3; a++) {
+            oMin[a] = Min(oMin[a], o[a][i]);
+            oMax[a] = Max(oMax[a], o[a][i]);
+            iMin[a] = Min(iMin[a], inv[a][i]);
+            iMax[a] = Max(iMax[a], inv[a][i]);
+        }
+    }
+    // the interval bounds only hold when no direction component changes sign or is zero
+    for (uint32_t m = active; m && coherent; m &= m - 1) {
+        int i = __builtin_ctz(m);
+        for (int a = 0; a < 3; a++) {
+            if (d[a][i] == 0 || (d[a][i] > 0) != (iMin[a] > 0)) coherent = false;
+        }
+    }
+}
+
+bool PacketFrustum::Misses( float const *bounds, float tMax ) const {
+    // interval arithmetic on (plane - origin) * inverse direction gives the earliest entry
+    // and the latest exit of any ray of the packet on each axis
+    float entry = -BIGFLOAT, exit = BIGFLOAT;
+    for (int a = 0; a < 3; a++) {
+        bool positive = iMin[a] > 0;
+        float nearPlane = positive ? bounds[a] : bounds[a + 3];
+        float farPlane = positive ? bounds[a + 3] : bounds[a];
+        float n0 = (nearPlane - oMax[a]) * iMin[a], n1 = (nearPlane - oMax[a]) * iMax[a];
+        float n2 = (nearPlane - oMin[a]) * iMin[a], n3 = (nearPlane - oMin[a]) * iMax[a];
+        float f0 = (farPlane - oMax[a]) * iMin[a], f1 = (farPlane - oMax[a]) * iMax[a];
+        float f2 = (farPlane - oMin[a]) * iMin[a], f3 = (farPlane - oMin[a]) * iMax[a];
+        entry = Max(entry, Min(Min(n0, n1), Min(n2, n3)));
+        exit = Min(exit, Max(Max(f0, f1), Max(f2, f3)));
+    }
+    return entry > exit || exit < 0 || entry >= tMax;
+}
+
+// the packet traversal of the two kinds of meshes, compiled with the box and triangle
+// tests for each instruction set
+CPU_DISPATCH static uint32_t tracePacket( cy::BVH const &bvh, TriMeshTriangles const &tris, RayPacket const &packet,
+                                          uint32_t active, HitInfo *hits, int hitSide ) {
+    return PacketTraversal<TriMeshTriangles>(bvh, tris, packet, hits, hitSide).Trace(active);
+}
+
+CPU_DISPATCH static uint32_t tracePacket( cy::BVH const &bvh, CompactTriangles const &tris, RayPacket const &packet,
+                                          uint32_t active, HitInfo *hits, int hitSide ) {
+    return PacketTraversal<CompactTriangles>(bvh, tris, packet, hits, hitSide).Trace(active);
+}
+
+bool PacketTracer::LoadSettings( tinyxml2::XMLElement const *sceneElem ) {
+    if (!sceneElem) return false;
+
+    tinyxml2::XMLElement const *e = sceneElem->FirstChildElement("packets");
+    if (!e) return true;
+    size = 8;
+    e->QueryIntAttribute("size", &size);
+    if (size != 0 && size != 4 && size != 8 && size != 16) {
+        fprintf(stderr, "Packet size must be 4, 8 or 16, using 8\n");
+        size = 8;
+    }
+    return true;
+}
+
+void PacketTracer::Build( std::vector<Instance> const &instances ) {
+    TRACE_SCOPE("PacketTracer::Build");
+    targets.clear();
+    if (!IsEnabled()) return;
+
+    for (Instance const &inst : instances) {
+        Target t;
+        t.inst = &inst;
+        if (CompactMesh const *compact = dynamic_cast<CompactMesh const*>(inst.obj)) {
+            t.compact = compact;
+            t.bvh = &compact->GetBVH();
+        }
+        else if (TriObj const *mesh = dynamic_cast<TriObj const*>(inst.obj)) {
+            // TriObj keeps its tree private, the load hooks tell where it is; a mesh
+            // without one is traced a ray at a time
+            cy::TriMesh const *triMesh = mesh;
+            if (cy::BVHTriMesh const *bvh = ObjMeshTree(triMesh)) {
+                t.triMesh = triMesh;
+                t.bvh = bvh;
+            }
+        }
+        targets.push_back(t);
+    }
+    fprintf(stdout, "Packet tracing camera rays in packets of %d\n", size);
+}
+
+uint32_t PacketTracer::Trace( RayPacket const &packet, uint32_t active, HitInfo *hits, int hitSide ) const {
+    Target const *hitTarget[PACKET_MAX_SIZE] = {};
+    uint32_t hitMask = 0;
+
+    RayPacket local;
+    local.size = packet.size;
+    for (Target const &t : targets) {
+        Instance const &inst = *t.inst;
+        for (int i = 0; i < packet.size; i++) {
+            Ray r = inst.ToObjectCoords(packet.Get(i));
+            local.Set(i, r.p, r.dir);
+        }
+        // unused lanes never cross a box
+        for (int i = packet.size; i < PACKET_MAX_SIZE; i++) local.Set(i, Vec3f(0, 0, 0), Vec3f(1, 1, 1));
+
+        uint32_t mask = 0;
+        if (t.compact) {
+            CompactTriangles tris{ t.compact };
+            mask = tracePacket(*t.bvh, tris, local, active, hits, hitSide);
+        }
+        else if (t.triMesh) {
+            TriMeshTriangles tris{ t.triMesh };
+            mask = tracePacket(*t.bvh, tris, local, active, hits, hitSide);
+        }
+        else {
+            for (uint32_t m = active; m; m &= m - 1) {
+                int i = __builtin_ctz(m);
+                if (inst.obj->IntersectRay(local.Get(i), hits[i], hitSide)) mask |= 1u << i;
+            }
+        }
+        for (uint32_t m = mask; m; m &= m - 1) hitTarget[__builtin_ctz(m)] = &t;
+        hitMask |= mask;
+    }
+
+    // the closest hits are moved to world space once
+    for (uint32_t m = hitMask; m; m &= m - 1) {
+        int i = __builtin_ctz(m);
+        hits[i].node = hitTarget[i]->inst->node;
+        hitTarget[i]->inst->FromObjectCoords(hits[i]);
+    }
+    return hitMask;
+}
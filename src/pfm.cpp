@@ -0,0 +1,50 @@
+#include "pfm.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+
+bool SavePFM( char const *filename, int width, int height, float const *rgb ) {
+    FILE *f = fopen(filename, "wb");
+    if (!f) {
+        fprintf(stderr, "Cannot write %s\n", filename);
+        return false;
+    }
+    // a negative scale marks little endian data
+    fprintf(f, "PF\n%d %d\n-1.0\n", width, height);
+    bool ok = true;
+    for (int y = height - 1; y >= 0 && ok; y--) {
+        ok = fwrite(rgb + size_t(y) * width * 3, sizeof(float), size_t(width) * 3, f) == size_t(width) * 3;
+    }
+    fclose(f);
+    return ok;
+}
+
+bool LoadPFM( char const *filename, int &width, int &height, std::vector<float> &rgb ) {
+    FILE *f = fopen(filename, "rb");
+    if (!f) return false;
+    char magic[3] = {};
+    float scale = 0;
+    bool ok = fscanf(f, "%2s %d %d %f", magic, &width, &height, &scale) == 4 && strcmp(magic, "PF") == 0 && width > 0 && height > 0;
+    // exactly one whitespace character ends the header
+    ok = ok && fgetc(f) != EOF;
+    if (ok) {
+        rgb.resize(size_t(width) * height * 3);
+        for (int y = height - 1; y >= 0 && ok; y--) {
+            ok = fread(&rgb[size_t(y) * width * 3], sizeof(float), size_t(width) * 3, f) == size_t(width) * 3;
+        }
+    }
+    fclose(f);
+    if (!ok) return false;
+
+    // the files written here are little endian, which is what the renderer runs on
+    if (scale > 0) {
+        for (float &v : rgb) {
+            uint32_t bits;
+            memcpy(&bits, &v, 4);
+            bits = __builtin_bswap32(bits);
+            memcpy(&v, &bits, 4);
+        }
+    }
+    return true;
+}
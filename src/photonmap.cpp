@@ -0,0 +1,176 @@
+#include "photonmap.h"
+#include "renderstats.h"
+#include "tinyxml2.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <iostream>
+
+void Photon::SetDirection( Vec3f const &dir ) {
+    Vec3f d = dir.GetNormalized();
+    int t = int(acosf(Max(-1.0f, Min(1.0f, d.z))) * (256.0f / float(M_PI)));
+    int p = int(atan2f(d.y, d.x) * (256.0f / (2.0f * float(M_PI)))) + 128;
+    theta = (unsigned char) Max(0, Min(255, t));
+    phi = (unsigned char) Max(0, Min(255, p));
+}
+
+Vec3f Photon::GetDirection() const {
+    float t = (theta + 0.5f) * (float(M_PI) / 256.0f);
+    float p = (phi - 128 + 0.5f) * (2.0f * float(M_PI) / 256.0f);
+    return Vec3f(sinf(t) * cosf(p), sinf(t) * sinf(p), cosf(t));
+}
+
+//----------------------------------------------------------------
+
+bool PhotonMap::LoadSettings( tinyxml2::XMLElement const *sceneElem ) {
+    if (!sceneElem) return false;
+
+    tinyxml2::XMLElement const *e = sceneElem->FirstChildElement("photonmap");
+    if (!e) return true;
+    e->QueryIntAttribute("photons", &emitCount);
+    e->QueryIntAttribute("gather", &gatherCount);
+    e->QueryFloatAttribute("radius", &gatherRadius);
+    if (gatherCount < 1) gatherCount = 1;
+    return true;
+}
+
+// size of the left subtree of a left-balanced tree with n nodes
+static int leftSubtreeSize( int n ) {
+    if (n <= 1) return 0;
+    int full = 1;
+    while (full * 2 <= n) full *= 2;    // nodes on the last complete level
+    int last = n - (full - 1);          // nodes on the partially filled level
+    return (full / 2 - 1) + Min(last, full / 2);
+}
+
+void PhotonMap::balance( std::vector<Photon*> &list, int index, int start, int end, int depth ) {
+    // split along the axis where this segment is widest
+    Vec3f bmin = list[start]->pos;
+    Vec3f bmax = list[start]->pos;
+    for (int i = start + 1; i <= end; i++) {
+        for (int a = 0; a < 3; a++) {
+            bmin[a] = Min(bmin[a], list[i]->pos[a]);
+            bmax[a] = Max(bmax[a], list[i]->pos[a]);
+        }
+    }
+    Vec3f ext = bmax - bmin;
+    int axis = (ext.x >= ext.y && ext.x >= ext.z) ? 0 : (ext.y >= ext.z ? 1 : 2);
+
+    int median = start + leftSubtreeSize(end - start + 1);
+    std::nth_element(list.begin() + start, list.begin() + median, list.begin() + end + 1,
+        [axis](Photon const *a, Photon const *b) { return a->pos[axis] < b->pos[axis]; });
+
+    photons[index] = *list[median];
+    photons[index].plane = short(axis);
+
+    // subtrees write to disjoint parts of the heap, so the top levels are balanced in parallel
+    bool hasLeft = median > start;
+    bool hasRight = median < end;
+    if (depth < 3 && hasLeft && hasRight) {
+        std::thread left(&PhotonMap::balance, this, std::ref(list), 2 * index, start, median - 1, depth + 1);
+        balance(list, 2 * index + 1, median + 1, end, depth + 1);
+        left.join();
+        return;
+    }
+    if (hasLeft) balance(list, 2 * index, start, median - 1, depth + 1);
+    if (hasRight) balance(list, 2 * index + 1, median + 1, end, depth + 1);
+}
+
+void PhotonMap::Build( std::vector<std::vector<Photon>> &threadPhotons, double emitTime ) {
+    auto start = std::chrono::steady_clock::now();
+    emitSeconds = emitTime;
+
+    size_t total = 0;
+    for (auto const &tp : threadPhotons) total += tp.size();
+
+    std::vector<Photon*> list;
+    list.reserve(total);
+    for (auto &tp : threadPhotons) {
+        for (Photon &p : tp) list.push_back(&p);
+    }
+
+    numPhotons = int(total);
+    photons.clear();
+    photons.shrink_to_fit();
+    photons.resize(numPhotons + 1);
+    if (numPhotons > 0) balance(list, 1, 0, numPhotons - 1, 0);
+
+    buildSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void PhotonMap::locate( Vec3f const &p, int index, PhotonQuery &query ) const {
+    Photon const &ph = photons[index];
+
+    // visit the near side first and the far side only if the search sphere crosses the plane
+    int first = 2 * index;
+    if (first <= numPhotons) {
+        float delta = p[ph.plane] - ph.pos[ph.plane];
+        int nearChild = delta < 0 ? first : first + 1;
+        int farChild = delta < 0 ? first + 1 : first;
+        if (nearChild <= numPhotons) locate(p, nearChild, query);
+        if (farChild <= numPhotons && delta * delta < query.maxDist2) locate(p, farChild, query);
+    }
+
+    float d2 = (ph.pos - p).LengthSquared();
+    if (d2 >= query.maxDist2) return;
+
+    if (query.found < query.k) {
+        // sift up into the max-heap
+        int i = query.found++;
+        while (i > 0) {
+            int parent = (i - 1) / 2;
+            if (query.dist2[parent] >= d2) break;
+            query.list[i] = query.list[parent];
+            query.dist2[i] = query.dist2[parent];
+            i = parent;
+        }
+        query.list[i] = &ph;
+        query.dist2[i] = d2;
+        if (query.found == query.k) query.maxDist2 = query.dist2[0];
+        return;
+    }
+
+    // replace the farthest photon and sift down
+    int i = 0;
+    while (true) {
+        int child = 2 * i + 1;
+        if (child >= query.k) break;
+        if (child + 1 < query.k && query.dist2[child + 1] > query.dist2[child]) child++;
+        if (query.dist2[child] <= d2) break;
+        query.list[i] = query.list[child];
+        query.dist2[i] = query.dist2[child];
+        i = child;
+    }
+    query.list[i] = &ph;
+    query.dist2[i] = d2;
+    query.maxDist2 = query.dist2[0];
+}
+
+void PhotonMap::Gather( Vec3f const &p, PhotonQuery &query ) const {
+#if RENDER_STATS
+    auto start = std::chrono::steady_clock::now();
+#endif
+    if (numPhotons > 0) locate(p, 1, query);
+#if RENDER_STATS
+    // counted per thread like the other render statistics
+    CountStat(STAT_PHOTON_QUERIES);
+    CountStat(STAT_PHOTONS_GATHERED, query.found);
+    CountStat(STAT_PHOTON_GATHER_NS, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+#endif
+}
+
+void PhotonMap::PrintStats() const {
+    fprintf(stdout, "Photon map: %d photons stored (%.2f MB)\n", numPhotons, MemoryBytes() / (1024.0 * 1024.0));
+    fprintf(stdout, "    emission  %.3f s\n", emitSeconds);
+    fprintf(stdout, "    kd-tree   %.3f s\n", buildSeconds);
+#if RENDER_STATS
+    RenderStats stats = TotalRenderStats();
+    unsigned long long q = stats.counters[STAT_PHOTON_QUERIES];
+    unsigned long long ns = stats.counters[STAT_PHOTON_GATHER_NS];
+    if (q > 0) {
+        fprintf(stdout, "    gathering %.3f s over %llu queries (%.1f photons, %.2f us each)\n",
+            ns * 1e-9, q, double(stats.counters[STAT_PHOTONS_GATHERED]) / q, ns * 1e-3 / q);
+    }
+#endif
+}
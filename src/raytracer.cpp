@@ -1,15 +1,107 @@
 #include "raytracer.h"
 
+#include "materials.h"
+#include "blinneval.h"
+#include "mipmap.h"
+#include "instancing.h"
+#include "compactmesh.h"
+#include "wavefront.h"
+#include "fastmath.h"
+#include "dispatch.h"
+#include "renderstats.h"
+#include "trace.h"
+#include "lazyload.h"
+#include "loadpipeline.h"
+#include "objcache.h"
+#include "tinyxml2.h"
+
 #include <thread>
+#include <chrono>
 #include <iostream>
 #include <limits.h>
 
 #define BIG_INT INT_MAX-1
 
+// paths are cut off after this many bounces
+#define BOUNCE_LIMIT 2000
+
+// pixels per trace event of a render thread
+#define TRACE_PIXEL_RUN 64
+
+// photons are emitted in this many chunks, each from its own seed, so the photon map is
+// the same for any number of threads
+#define PHOTON_CHUNKS 64
+
+// texture footprint, as a fraction of the texture, of a path after a diffuse bounce
+#define DIFFUSE_FOOTPRINT (1.0f / 64.0f)
+
+// footprint of a path after scattering into a direction sampled with the given density,
+// the wider the lobe the coarser the texture levels its next hit can use
+static float scatteredFootprint( float footprint, float prob ) {
+    float spread = prob > 1 ? 1 / sqrtf(prob) : 1;
+    return Max(footprint, spread * DIFFUSE_FOOTPRINT);
+}
+
 bool Raytracer::LoadScene( char const *sceneFilename ) {
-    if (!Renderer::LoadScene(sceneFilename)) {
+    TraceThreadName("main");
+    TRACE_SCOPE("Raytracer::LoadScene");
+    unsigned long long loadAllocations = HeapAllocations();
+    // OBJ files are parsed on several threads and kept as binary copies, see src/objcache.cpp
+    SetObjLoadHooks(true);
+    // the elements this tracer adds to the scene format are all read from one parse of the
+    // file, kept until the scene is loaded; the deferred copy below only drops the types of
+    // OBJ objects, which none of the settings read
+    tinyxml2::XMLDocument doc;
+    tinyxml2::XMLElement const *sceneElem = nullptr;
+    bool parsed;
+    {
+        TRACE_SCOPE("XML load");
+        parsed = doc.LoadFile(sceneFilename) == tinyxml2::XML_SUCCESS;
+    }
+    if (parsed) {
+        tinyxml2::XMLElement const *xml = doc.FirstChildElement("xml");
+        sceneElem = xml ? xml->FirstChildElement("scene") : nullptr;
+    }
+    // the scene loader sees the OBJ objects as plain nodes, and each OBJ file is loaded once
+    // after it, as a task of the pipeline, or with <lazyload> when a ray first reaches it
+    LoadPipeline pipeline;
+    pipeline.LoadSettings(sceneElem, threadCount());
+    LoadLazySettings(sceneElem);
+    std::vector<std::string> deferred;
+    std::string deferredScene;
+    deferredScene = WriteDeferredScene(doc, sceneFilename, deferred);
+    bool loaded;
+    {
+        TRACE_SCOPE("scene loader");
+        loaded = Renderer::LoadScene(deferredScene.empty() ? sceneFilename : deferredScene.c_str());
+    }
+    if (!deferredScene.empty()) remove(deferredScene.c_str());
+    if (!loaded) {
         return false;
     }
+    if (IsLazyLoading()) AttachLazyMeshes(scene.rootNode, deferred, lazyMeshes);
+    else LoadDeferredMeshes(scene.rootNode, deferred, pipeline, loadedMeshes);
+    // image textures are read through tiled pyramids, built together with the meshes
+    BuildMipMaps(scene, pipeline);
+    pipeline.Run();
+    pipeline.PrintReport();
+
+    // nodes that load the same OBJ file share the one mesh loaded for it
+    CountMeshInstances(scene.rootNode);
+    // large meshes can be stored quantized, see the <compactmesh> element
+    CompactMeshes(sceneElem, scene.rootNode, compactMeshes, loadedMeshes);
+    // compose the node transforms once so rays skip the scene graph
+    BuildInstances(scene.rootNode, instances);
+    // and group them by object type so intersections are called without the vtable
+    instanceLists.Build(instances);
+    lightLists.Build(scene.lights);
+    // camera rays can be traced in packets, see the <packets> element
+    packets.LoadSettings(sceneElem);
+    packets.Build(instances);
+    // paths can be traced in batches, see the <wavefront> element
+    wavefront.LoadSettings(sceneElem);
+    LoadRenderStatsSettings(sceneElem);
+    costMap.LoadSettings(sceneElem);
 
     // determine the camera parameters
     int width = renderImage.GetWidth();
@@ -28,6 +120,24 @@ bool Raytracer::LoadScene( char const *sceneFilename ) {
     // set the number of pixels
     numPixels = width * height;
 
+    // participating media are an extension of the scene format, so read them separately
+    LoadMedia(sceneElem, scene.rootNode, media);
+    for (Medium const* m : media) {
+        for (Instance const &inst : instances) {
+            if (m->InteriorNode() && inst.node == m->InteriorNode()) mediumBoundaries.push_back(&inst);
+        }
+    }
+    pMap->LoadSettings(sceneElem);
+
+#if RENDER_ALLOC_STATS
+    fprintf(stdout, "Scene loaded with %llu heap allocations, %.1f MB peak resident\n",
+            HeapAllocations() - loadAllocations, PeakMemoryBytes() / 1048576.0);
+#else
+    (void)loadAllocations;
+#if RENDER_STATS
+    fprintf(stdout, "Scene loaded, %.1f MB peak resident\n", PeakMemoryBytes() / 1048576.0);
+#endif
+#endif
     return true;
 }
 
@@ -59,116 +169,94 @@ Ray Raytracer::CameraRay( int i, int j, int sampleNum, float pixelOffset, float
 
 
 bool Raytracer::TraceRay( Ray const &ray, HitInfo &hInfo, int hitSide ) const {
+    StatTimerScope timer(TIMER_INTERSECT);
+    CountStat(STAT_RAYS);
+
     // check if the ray intersects any objects in the scene
-    bool hitObj = SearchTree(ray, hInfo, hitSide, &scene.rootNode);
+    bool hitObj = SearchInstances(ray, hInfo, hitSide);
 
     // check if the ray intersects any of the lights in the scene
-    bool hitLight = false;
-    for (Light* light : this->scene.lights) {
-        if (!light->IsRenderable()) { continue; }
+    bool hitLight = traceLights(ray, hInfo, hitSide);
 
-        if ( light->IntersectRay(ray, hInfo, hitSide) ) {
-            hitLight = true;
-            hInfo.node = nullptr;
-            hInfo.isLight = true;
-            hInfo.light = light;
-        }
+    return (hitObj || hitLight);
+}
+
+uint32_t Raytracer::TraceRayPacket( RayPacket const &packet, HitInfo *hits, int hitSide ) const {
+    StatTimerScope timer(TIMER_INTERSECT);
+    CountStat(STAT_RAYS, packet.size);
+    uint32_t hitMask = packets.Trace(packet, packet.FullMask(), hits, hitSide);
+
+    // lights are few, so they are tested one ray at a time
+    for (int i = 0; i < packet.size; i++) {
+        if ( traceLights(packet.Get(i), hits[i], hitSide) ) { hitMask |= 1u << i; }
     }
+    return hitMask;
+}
 
-    return (hitObj || hitLight);
+bool Raytracer::traceLights( Ray const &ray, HitInfo &hInfo, int hitSide ) const {
+    bool hitLight = false;
+    lightLists.ForEachList([&]( std::vector<Light*> const &lights, auto intersect ) {
+        for (Light* light : lights) {
+            if ( intersect(light, ray, hInfo, hitSide) ) {
+                hitLight = true;
+                hInfo.node = nullptr;
+                hInfo.isLight = true;
+                hInfo.light = light;
+            }
+        }
+    });
+    return hitLight;
 }
 
 bool Raytracer::ShadowTraceRay( Ray const &ray, HitInfo &hInfo, int hitSide, float t_max ) const {
+    StatTimerScope timer(TIMER_INTERSECT);
+    CountStat(STAT_SHADOW_RAYS);
+
     // check if the shadow ray intersects any objects in the scene
-    bool hitObj = ShadowSearch(ray, hInfo, &scene.rootNode, t_max);
+    bool hitObj = ShadowSearch(ray, hInfo, t_max);
 
     // check if the shadow ray intersects any of the lights in the scene
-    bool hitLight = false;
-    for (Light* light : this->scene.lights) {
-        if (!light->IsRenderable()) { continue; }
-
-        if ( light->IntersectRay(ray, hInfo, hitSide) ) {
-            hitLight = true;
-            hInfo.node = nullptr;
-            hInfo.isLight = true;
-            hInfo.light = light;
-        }
-    }
+    bool hitLight = traceLights(ray, hInfo, hitSide);
 
     return (hitObj || hitLight);
 }
 
-bool Raytracer::SearchTree( Ray const &ray, HitInfo &hInfo, int hitSide, Node const *node ) const {
-    // tracks if this node or any of it's descendents are the hit node
-    bool descHit = false;
-
-    // put ray in local coords
-    Ray localRay =  node->ToNodeCoords(ray);
-
-    // check for intersections
-    const Object *obj = node->GetNodeObj();
-    if (obj)
-    {
-        // check for hit
-        bool isHit = node->GetNodeObj()->IntersectRay(localRay, hInfo, hitSide);
-        if (isHit)
-        {
-            // set what node we hit
-            hInfo.node = node;
-            descHit = true;
-        }
-    }
-
-    // continue checking the children
-    for ( int i=0; i<node->GetNumChild(); i++ ) 
-    {
-        // using localRay bc transformations stack
-        if ( SearchTree(localRay, hInfo, hitSide, node->GetChild(i)) )
-        {
-            descHit = true;
+bool Raytracer::SearchInstances( Ray const &ray, HitInfo &hInfo, int hitSide ) const {
+    // the closest hit is moved to world space once, after all instances are tested
+    Instance const *hitInst = nullptr;
+    instanceLists.ForEachList([&]( std::vector<Instance> const &list, auto intersect ) {
+        for (Instance const &inst : list) {
+            if (intersect(inst, inst.ToObjectCoords(ray), hInfo, hitSide)) {
+                hitInst = &inst;
+            }
         }
-    }
+    });
 
-    if (descHit)
-    {
-        // put our hit info into this node's coordinate system
-        node->FromNodeCoords(hInfo);
+    if (hitInst) {
+        hInfo.node = hitInst->node;
+        hitInst->FromObjectCoords(hInfo);
     }
-    return descHit;
+    return hitInst != nullptr;
 }
 
-bool Raytracer::ShadowSearch( Ray const &ray, HitInfo &hInfo, Node const *node, float t_max ) const {
-    // put ray in local coords
-    Ray localRay =  node->ToNodeCoords(ray);
-
-    // check for intersections
-    const Object *obj = node->GetNodeObj();
-    if (obj)
-    {
-        // check for hit
-        bool isHit = node->GetNodeObj()->IntersectRay(localRay, hInfo, HIT_FRONT_AND_BACK);
-        if (isHit && hInfo.z < t_max)
-        {
-            // we're done!
-            return true;
-        }
-    }
-
-    // continue checking the children
-    for ( int i=0; i<node->GetNumChild(); i++ ) 
-    {
-        // using localRay bc transformations stack
-        if ( ShadowSearch(localRay, hInfo, node->GetChild(i), t_max) )
-        {
-            return true;
+bool Raytracer::ShadowSearch( Ray const &ray, HitInfo &hInfo, float t_max ) const {
+    bool hit = false;
+    instanceLists.ForEachList([&]( std::vector<Instance> const &list, auto intersect ) {
+        for (size_t i = 0; i < list.size() && !hit; i++) {
+            Instance const &inst = list[i];
+            if (!mediumBoundaries.empty() && isMediumBoundary(inst)) continue;
+            if (intersect(inst, inst.ToObjectCoords(ray), hInfo, HIT_FRONT_AND_BACK) && hInfo.z < t_max) {
+                // we're done! media that fill an object need to know which one was hit
+                hInfo.node = inst.node;
+                hit = true;
+            }
         }
-    }
-
-    return false;
+    });
+    return hit;
 }
 
 Color Raytracer::tracePath(Ray ray, SamplerInfo sInfo, HitInfo& hInfo, int bounce) {
-    if ( bounce >= 2000 ) {
+    if ( bounce >= BOUNCE_LIMIT ) {
         // return when we've reached the maximum number of bounces
         return Color().Black();
     }
@@ -177,6 +265,12 @@ Color Raytracer::tracePath(Ray ray, SamplerInfo sInfo, HitInfo& hInfo, int bounc
     hInfo.Init();
     bool hit = TraceRay(ray, hInfo, HIT_FRONT_AND_BACK);
 
+    return continuePath(ray, sInfo, hInfo, hit, bounce);
+}
+
+Color Raytracer::continuePath( Ray const &ray, SamplerInfo sInfo, HitInfo& hInfo, bool hit, int bounce ) {
+    StatTimerScope timer(TIMER_SHADE);
+    CountStat(STAT_PATH_SEGMENTS);
     sInfo.SetHit(ray, hInfo);
 
     // if we've hit nothing, the hit distance is effectively infinity
@@ -184,30 +278,22 @@ Color Raytracer::tracePath(Ray ray, SamplerInfo sInfo, HitInfo& hInfo, int bounc
         hInfo.z = BIGFLOAT;
     }
 
-    // sampling time t
-    float roll = sInfo.RandomFloat();
-    float tRand = -log(1-roll) / sig_t;
+    // sample a collision with the participating media, skipped entirely when the scene has none
+    float tScatter = BIGFLOAT;
+    Medium const* medium = media.empty() ? nullptr : sampleMedia(ray, hInfo, hit, sInfo, tScatter);
 
-    // if our time sample is less than the hit "time" (aka distance)
-    if ( tRand < hInfo.z ) {
-        if ( roll < (sig_a / sig_t) ) { // russian roulette absorption/emmision
+    // if we collide with a medium before reaching the hit "time" (aka distance)
+    if ( medium ) {
+        if ( sInfo.RandomFloat() < medium->AbsorptionProb() ) { // russian roulette absorption/emmision
             // treating "absorption" as emision of the background color
-            if ( bounce == 0 && !hit ) {
-                Vec3f uvw(float(sInfo.X())/renderImage.GetWidth(), float(sInfo.Y())/renderImage.GetHeight(), 0.5);
-                return scene.background.Eval(uvw);
-            }
-            else if ( !hit ) {
-                return scene.environment.EvalEnvironment(ray.dir);
+            if ( !hit ) {
+                return missColor(ray, sInfo, bounce);
             }
             return Color().Black();
         }
 
-        // probability and transmittance of this time sample
-        float pdf = exp(-sig_t * tRand) * sig_t;
-        float transmittance = exp(-sig_t * tRand);
-
         // calculate the point we're scattering from
-        Vec3f p = ray.p + tRand * ray.dir;
+        Vec3f p = ray.p + tScatter * ray.dir;
 
         Color lightSampColor = Color().Black();
 
@@ -221,25 +307,26 @@ Color Raytracer::tracePath(Ray ray, SamplerInfo sInfo, HitInfo& hInfo, int bounc
         DirSampler::Info lInfo;
         lInfo.SetVoid();
 
-        bool sample = light->GenerateSample(lSampInfo, lDir, lInfo);
+        bool sample = SampleLight(light, lSampInfo, lDir, lInfo);
         if ( sample ) { // if we get a non-zero sample
             // adjust the samples probability
             lInfo.prob /= lightsRenderable.size();
 
             // check if this sample is in shadow
             shadowInfo.Init();
-            bool shadowHit = ShadowTraceRay(Ray(p, lDir), shadowInfo, HIT_FRONT_AND_BACK, 1.0);
+            Ray shadowRay(p, lDir);
+            bool shadowHit = ShadowTraceRay(shadowRay, shadowInfo, HIT_FRONT_AND_BACK, 1.0);
+            CountStat(STAT_NEE_SAMPLES);
 
             // get color value from the light sample
             if ( (shadowHit && shadowInfo.isLight && shadowInfo.light == light) ) {
-                // there's nothing between the light we sampled and the point
-                float l_transmit = exp(-sig_t * shadowInfo.z * lDir.Length());
-                float l_pdf = exp(-sig_t * shadowInfo.z * lDir.Length());
-                
+                CountStat(STAT_NEE_VISIBLE);
+                // there's nothing between the light we sampled and the point but the media
+                float l_transmit = mediaTransmittance(shadowRay, shadowInfo, shadowHit, sInfo);
+
                 // multiple importance sampling weight calculation
-                lightSampColor = l_transmit / l_pdf * lInfo.mult;
-                float lightToPhase = 1 / (4 * M_PI) * l_pdf;
-                lightSampColor *= lightToPhase;
+                float lightToPhase = FAST_INV_4PI * l_transmit;
+                lightSampColor = lInfo.mult * lightToPhase;
 
                 float w = (lInfo.prob * lInfo.prob) / ( (lInfo.prob * lInfo.prob) + (lightToPhase * lightToPhase) );
                 lightSampColor *= w;
@@ -248,23 +335,23 @@ Color Raytracer::tracePath(Ray ray, SamplerInfo sInfo, HitInfo& hInfo, int bounc
 
         // sample the phase function to get a new direction
         float cosTheta = (2 * sInfo.RandomFloat()) - 1;
-        float sinTheta = sqrt(1 - pow(cosTheta, 2));
-        float phi = 2 * M_PI * sInfo.RandomFloat();
-        Vec3f dirNew(sinTheta*cos(phi), sinTheta*sin(phi), cosTheta);
+        float sinTheta = sqrtf(1 - cosTheta * cosTheta);
+        float phi = FAST_TWO_PI * sInfo.RandomFloat();
+        float sinPhi, cosPhi;
+        SinCos(phi, sinPhi, cosPhi);
+        Vec3f dirNew(sinTheta*cosPhi, sinTheta*sinPhi, cosTheta);
 
         // and recurse
+        float footprint = GetTextureFootprint();
+        SetTextureFootprint(scatteredFootprint(footprint, FAST_INV_4PI));
         Color samp2 = tracePath(Ray(p, dirNew), sInfo, hInfo, bounce+1);
+        SetTextureFootprint(footprint);
         float w2 = 0.5;
 
-        Color total = ( samp2 * w2 ) + lightSampColor;
-
-        return transmittance / pdf * sig_s * total;
+        // surviving the absorption roulette already accounts for the scattering albedo
+        return ( samp2 * w2 ) + lightSampColor;
     }
     else if ( hit ) {   // if we don't scatter before hitting a surface
-        // get the probability and transmittance of this hit
-        float pdf = exp(-sig_t * hInfo.z);
-        float transmittance = exp(-sig_t * hInfo.z);
-
         // if we hit a light
         if ( hInfo.isLight ) {
             if ( bounce == 0 ) { hInfo.light->Radiance(sInfo); }
@@ -272,10 +359,14 @@ Color Raytracer::tracePath(Ray ray, SamplerInfo sInfo, HitInfo& hInfo, int bounc
         }
         else {
             // if we hit a surface, we need to sample it's brdf and the lights as in typical path tracing
-            return transmittance / pdf * materialSample(ray, sInfo, hInfo, bounce);
+            return materialSample(ray, sInfo, hInfo, bounce);
         }
     }
 
+    return missColor(ray, sInfo, bounce);
+}
+
+Color Raytracer::missColor( Ray const &ray, SamplerInfo const &sInfo, int bounce ) const {
     if ( bounce == 0 ) {
         Vec3f uvw(float(sInfo.X())/renderImage.GetWidth(), float(sInfo.Y())/renderImage.GetHeight(), 0.5);
         return scene.background.Eval(uvw);
@@ -283,6 +374,50 @@ Color Raytracer::tracePath(Ray ray, SamplerInfo sInfo, HitInfo& hInfo, int bounc
     return scene.environment.EvalEnvironment(ray.dir);
 }
 
+Medium const* Raytracer::sampleMedia( Ray const &ray, HitInfo const &hInfo, bool hit, SamplerInfo const &sInfo, float &t ) const {
+    Medium const* nearest = nullptr;
+    t = hit ? hInfo.z : BIGFLOAT;
+
+    // overlapping media are independent collision processes, so the nearest sample wins
+    for (Medium const* m : media) {
+        float t0, t1, tm;
+        if ( !m->Overlap(ray, hInfo, hit, t0, t1) ) { continue; }
+        if ( m->SampleCollision(ray, t0, Min(t1, t), sInfo, tm) ) {
+            t = tm;
+            nearest = m;
+        }
+    }
+    return nearest;
+}
+
+float Raytracer::mediaTransmittance( Ray const &ray, HitInfo const &hInfo, bool hit, SamplerInfo const &sInfo ) const {
+    float transmittance = 1.0f;
+    for (Medium const* m : media) {
+        if ( m->InteriorNode() ) {
+            // a shadow ray passes through the object's surface, so its segments inside the
+            // object are found along the ray up to the light
+            for (Instance const* inst : mediumBoundaries) {
+                if ( inst->node != m->InteriorNode() ) { continue; }
+                transmittance *= m->InteriorTransmittance(*inst, ray, hit ? hInfo.z : BIGFLOAT, sInfo);
+            }
+        }
+        else {
+            float t0, t1;
+            if ( !m->Overlap(ray, hInfo, hit, t0, t1) ) { continue; }
+            transmittance *= m->Transmittance(ray, t0, t1, sInfo);
+        }
+        if ( transmittance <= 0 ) { break; }
+    }
+    return transmittance;
+}
+
+bool Raytracer::isMediumBoundary( Instance const &inst ) const {
+    for (Instance const* b : mediumBoundaries) {
+        if ( b->node == inst.node ) { return true; }
+    }
+    return false;
+}
+
 Color Raytracer::materialSample( Ray ray, SamplerInfo sInfo, HitInfo& hInfo, int bounce ) {
     // get a random light to sample
     Light* light = this->randomLight(sInfo);
@@ -292,7 +427,7 @@ Color Raytracer::materialSample( Ray ray, SamplerInfo sInfo, HitInfo& hInfo, int
     Vec3f mDir;
     DirSampler::Info mInfo;
     mInfo.SetVoid();
-    bool sample = hInfo.node->GetMaterial()->GenerateSample(sInfo, mDir, mInfo);
+    bool sample = SampleMaterial(hInfo.node->GetMaterial(), sInfo, mDir, mInfo);
     if ( !sample ) {
         return mInfo.mult;
     }
@@ -306,23 +441,13 @@ Color Raytracer::materialSample( Ray ray, SamplerInfo sInfo, HitInfo& hInfo, int
     Color matColor = mInfo.mult / mInfo.prob;
     DirSampler::Info matToL;
     matToL.SetVoid();
-    light->GetSampleInfo(sInfo, mDir, matToL);
-
-    HitInfo giInfo;
-    giInfo.Init();
-    Color gi = Color().Black();
-    if (matToL.prob == 0 && !mDir.IsZero()) {
-        // continue tracing paths until we hit a light, run out of bounces, or the light is russian-roulette "absorbed"
-        gi = tracePath(Ray(sInfo.P(), mDir), sInfo, giInfo, bounce+1);
-        matColor *= gi;
-    }
-    bounce = startBounce;
+    LightSampleInfo(light, sInfo, mDir, matToL);
 
     // sample the random light
     Vec3f lDir;
     DirSampler::Info lInfo;
     lInfo.SetVoid();
-    bool lightSample = light->GenerateSample(sInfo, lDir, lInfo);
+    bool lightSample = SampleLight(light, sInfo, lDir, lInfo);
     lInfo.prob /= lightsRenderable.size();
 
     Color lightColor = Color().Black();
@@ -333,9 +458,17 @@ Color Raytracer::materialSample( Ray ray, SamplerInfo sInfo, HitInfo& hInfo, int
         // check if our sample is actually in shadow
         bool shadowHit = ShadowTraceRay(Ray(sInfo.P(), lDir), shadowInfo, HIT_FRONT_AND_BACK, 1.0f);
         bool hitSelf = (shadowHit && shadowInfo.isLight && shadowInfo.light == light);
+        CountStat(STAT_NEE_SAMPLES);
         if ( shadowHit && !hitSelf ) {
             lInfo.mult = Color().Black();
         }
+        else {
+            CountStat(STAT_NEE_VISIBLE);
+            // the light reached through media is dimmed the same as along the material's sample
+            if ( hitSelf && !media.empty() ) {
+                lInfo.mult *= mediaTransmittance(Ray(sInfo.P(), lDir), shadowInfo, shadowHit, sInfo);
+            }
+        }
 
         lDir.Normalize();
 
@@ -343,7 +476,7 @@ Color Raytracer::materialSample( Ray ray, SamplerInfo sInfo, HitInfo& hInfo, int
         lightColor = lInfo.mult / lInfo.prob;
         DirSampler::Info lToMat;
         lToMat.SetVoid();
-        hInfo.node->GetMaterial()->GetSampleInfo(sInfo, lDir, lToMat);
+        MaterialSampleInfo(hInfo.node->GetMaterial(), sInfo, lDir, lToMat);
 
         if ( lToMat.prob > 0 ) {
             lightColor *= lToMat.mult;
@@ -359,13 +492,34 @@ Color Raytracer::materialSample( Ray ray, SamplerInfo sInfo, HitInfo& hInfo, int
         }
     }
     
+    // caustics seen directly by the camera come from the photon map
+    Color caustics = Color().Black();
+    if ( startBounce == 0 && !pMap->IsEmpty() ) {
+        caustics = causticRadiance(sInfo, hInfo);
+    }
+
+    // everything evaluated at this shading point is done before recursing,
+    // so the material's texture lookups are shared between its sampling calls
+    HitInfo giInfo;
+    giInfo.Init();
+    Color gi = Color().Black();
+    if (matToL.prob == 0 && !mDir.IsZero()) {
+        // continue tracing paths until we hit a light, run out of bounces, or the light is russian-roulette "absorbed"
+        float footprint = GetTextureFootprint();
+        SetTextureFootprint(scatteredFootprint(footprint, mInfo.prob));
+        gi = tracePath(Ray(sInfo.P(), mDir), sInfo, giInfo, bounce+1);
+        SetTextureFootprint(footprint);
+        matColor *= gi;
+    }
+    bounce = startBounce;
+
     float m1 = mInfo.prob * mInfo.prob;
     float m2 = matToL.prob * matToL.prob;
 
     float wMat =   m1 / (m1 + m2);
 
     // MIS combination of our light and material samples
-    Color total = lightColor + matColor * wMat;
+    Color total = lightColor + matColor * wMat + caustics;
     return total;
 }
 
@@ -374,21 +528,88 @@ Color Raytracer::samplePixel( float pixelOffset, float dofOffset, int sampleNum,
     Ray ray = CameraRay(sInfo.X(), sInfo.Y(), sampleNum, pixelOffset, dofOffset);
     Color total = Color().Black();
 
-    // trace a path starting with that ray
-    total = tracePath(ray, sInfo, hInfo);
+    // trace the camera ray on its own so its cost can be compared with packets
+#if RENDER_STATS
+    auto start = std::chrono::steady_clock::now();
+#endif
+    hInfo.Init();
+    bool hit = TraceRay(ray, hInfo, HIT_FRONT_AND_BACK);
+#if RENDER_STATS
+    CountStat(STAT_CAMERA_RAY_NS, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+#endif
+
+    // trace a path starting with that ray, camera rays read the finest texture level
+    SetTextureFootprint(0);
+    total = continuePath(ray, sInfo, hInfo, hit, 0);
     z = hInfo.z;
     return total;
 }
 
+// seed of the random numbers of one sample of a pixel, a sample of -1 seeds the offsets shared
+// by all samples of the pixel; the random numbers of a sample are then the same whichever thread
+// renders the pixel, so images do not depend on the thread count or on scheduling
+static int sampleSeed( int pixel, int sample ) {
+    // splitmix64 finalizer
+    uint64_t h = (uint64_t(uint32_t(pixel)) << 32) | uint32_t(sample + 1);
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebull;
+    h ^= h >> 31;
+    return int(h & 0x7fffffff);
+}
+
+Color Raytracer::samplePacket( float pixelOffset, float dofOffset, int firstSample, int count, SamplerInfo& sInfo, RNG& rng, float& zMin ) {
+    // the samples of one pixel start from nearly the same point in nearly the same direction
+    Ray rays[PACKET_MAX_SIZE];
+    HitInfo hits[PACKET_MAX_SIZE];
+    RayPacket packet;
+    packet.size = count;
+    for (int k = 0; k < count; k++) {
+        rays[k] = CameraRay(sInfo.X(), sInfo.Y(), firstSample + k, pixelOffset, dofOffset);
+        packet.Set(k, rays[k].p, rays[k].dir);
+        hits[k].Init();
+    }
+
+#if RENDER_STATS
+    auto start = std::chrono::steady_clock::now();
+#endif
+    uint32_t hitMask = TraceRayPacket(packet, hits, HIT_FRONT_AND_BACK);
+#if RENDER_STATS
+    CountStat(STAT_CAMERA_RAY_NS, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+#endif
+
+    // shading continues one path at a time
+    Color total = Color().Black();
+    for (int k = 0; k < count; k++) {
+        sInfo.SetPixelSample(firstSample + k);
+        rng = RNG(sampleSeed(sInfo.Y() * renderImage.GetWidth() + sInfo.X(), firstSample + k));
+        SetTextureFootprint(0);
+        total += continuePath(rays[k], sInfo, hits[k], (hitMask >> k) & 1, 0);
+        if (hits[k].z < zMin) zMin = hits[k].z;
+    }
+    return total;
+}
+
 Light* Raytracer::randomLight(SamplerInfo const &sInfo) {
     int myRand = sInfo.RandomInt() % lightsRenderable.size();
     return lightsRenderable[myRand];
 }
 
 void Raytracer::RenderPixels() {
+    if (wavefront.IsEnabled()) {
+        renderWavefront();
+        return;
+    }
+
+    TraceThreadName("render");
+    TraceRun pixelRun("pixels", TRACE_PIXEL_RUN);
+    // lazily loaded meshes and textures this thread uses stay loaded until it pins again
+    LazyPin lazyPin;
+
     int index = next++;
     HitInfo info;
-    RNG rng(index);
+    RNG rng(sampleSeed(index, -1));
     SamplerInfo sInfo(rng);
 
     int width = renderImage.GetWidth();
@@ -398,6 +619,12 @@ void Raytracer::RenderPixels() {
         int i = index % width;
         int j = index / width;
         sInfo.SetPixel(i, j);
+        lazyPin.Pin();
+
+        auto pixelStart = std::chrono::steady_clock::now();
+        uint32_t pixelRays = costMap.IsEnabled() ? threadRayCount() : 0;
+
+        rng = RNG(sampleSeed(index, -1));
 
         // antialiasing offset for this pixel
         float pixOffset = rng.RandomFloat();
@@ -411,34 +638,333 @@ void Raytracer::RenderPixels() {
         int sampNum;
 
         // sample the pixel the given number of times
-        for (sampNum = 0; sampNum < sampleMax; ++sampNum) {
-            sInfo.SetPixelSample(sampNum);
-            float z = 0;
-            Color sample = samplePixel( pixOffset, dofOffset, sampNum, info, sInfo, z );
-            if (z < z_min) z_min = z;
+        if (packets.IsEnabled()) {
+            for (sampNum = 0; sampNum < sampleMax; sampNum += packets.Size()) {
+                S1 += samplePacket( pixOffset, dofOffset, sampNum, Min(packets.Size(), sampleMax - sampNum), sInfo, rng, z_min );
+            }
+            sampNum = sampleMax;
+        }
+        else {
+            for (sampNum = 0; sampNum < sampleMax; ++sampNum) {
+                sInfo.SetPixelSample(sampNum);
+                rng = RNG(sampleSeed(index, sampNum));
+                float z = 0;
+                Color sample = samplePixel( pixOffset, dofOffset, sampNum, info, sInfo, z );
+                if (z < z_min) z_min = z;
+
+                S1 += sample;
+            }
+        }
+        if (costMap.IsEnabled()) {
+            float pixelSeconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - pixelStart).count();
+            costMap.Record(index, pixelSeconds, threadRayCount() - pixelRays);
+        }
 
-            S1 += sample;
+        if (finishPixel(index, S1, z_min, sampNum)) {
+            return;
         }
+        pixelRun.Step();
 
-        Color color = S1 / float(sampNum + 1);
-        if (camera.sRGB) {
-            color = color.Linear2sRGB();
+        index = next++;
+    }
+}
+
+bool Raytracer::finishPixel( int index, Color const &sum, float zMin, int sampNum ) {
+    cameraRays += sampNum;
+    CountStat(STAT_CAMERA_RAYS, sampNum);
+
+    Color color = sum / float(sampNum + 1);
+    radiance[index] = color;
+    if (camera.sRGB) {
+        color = color.Linear2sRGB();
+    }
+
+    renderImage.GetPixels()[index] = Color24(color);
+    renderImage.GetZBuffer()[index] = zMin;
+    renderImage.GetSampleCount()[index] = sampNum;
+
+    // update number of rendered pixels
+    renderImage.IncrementNumRenderPixel(1);
+
+    if (renderImage.IsRenderDone()) {
+        // only one thread should ever get here, and it should be the last one
+        if ( pMap->IsEnabled() ) { pMap->PrintStats(); }
+        PrintMipMapReport();
+        PrintLazyLoadStats();
+        printCameraRayStats();
+        printPathStats();
+        PrintRenderStats(std::chrono::duration<double>(std::chrono::steady_clock::now() - renderStart).count(), threadCount());
+        if ( costMap.IsEnabled() ) { costMap.Save(); }
+        isRendering = false;
+        return true;
+    }
+    return false;
+}
+
+void Raytracer::renderWavefront() {
+    TraceThreadName("render");
+    // a batch holds every sample of a run of consecutive pixels
+    int batchPixels = Max(1, wavefront.Paths() / sampleMax);
+    int first = next.fetch_add(batchPixels);
+    RNG rng(sampleSeed(first, -1));
+    SamplerInfo sInfo(rng);
+    int width = renderImage.GetWidth();
+
+    // the buffers are reused by every batch of this thread
+    PathStates paths;
+    ShadowQueue shadows;
+    std::vector<int> active;
+    std::vector<uint64_t> keys;
+    std::vector<Color> pixelSum(batchPixels);
+    std::vector<float> pixelZ(batchPixels);
+    LazyPin lazyPin;
+
+    while (first < numPixels) {
+        int count = Min(batchPixels, numPixels - first);
+        lazyPin.Pin();
+        auto batchStart = std::chrono::steady_clock::now();
+        uint32_t batchRays = costMap.IsEnabled() ? threadRayCount() : 0;
+
+        // batches always cover the same pixels, so one seed per batch keeps the image
+        // independent of the threads; the paths of a batch are shaded in a fixed order
+        rng = RNG(sampleSeed(first, -1));
+
+        // generate the camera rays
+        paths.Resize(count * sampleMax);
+        active.clear();
+        for (int k = 0; k < count; k++) {
+            int index = first + k;
+            float pixOffset = rng.RandomFloat();
+            float dofOffset = rng.RandomFloat();
+            pixelSum[k] = Color().Black();
+            pixelZ[k] = BIGFLOAT;
+            for (int s = 0; s < sampleMax; s++) {
+                int p = k * sampleMax + s;
+                Ray ray = CameraRay(index % width, index / width, s, pixOffset, dofOffset);
+                paths.origin[p] = ray.p;
+                paths.dir[p] = ray.dir;
+                paths.throughput[p] = Color(1, 1, 1);
+                paths.radiance[p] = Color().Black();
+                paths.footprint[p] = 0;
+                paths.bounce[p] = 0;
+                paths.pixel[p] = index;
+                paths.sample[p] = s;
+                active.push_back(p);
+            }
         }
 
-        renderImage.GetPixels()[index] = Color24(color);
-        renderImage.GetZBuffer()[index] = z_min;
-        renderImage.GetSampleCount()[index] = sampNum;
+        // every stage runs over all active paths before the next one starts
+        while (!active.empty()) {
+            if (wavefront.SortRays()) { SortByDirection(active, paths, keys); }
+            extendPaths(paths, active);
+
+            for (int p : active) {
+                if (paths.bounce[p] == 0 && paths.hitSomething[p]) {
+                    int k = paths.pixel[p] - first;
+                    pixelZ[k] = Min(pixelZ[k], paths.hit[p].z);
+                }
+            }
 
-        // update number of rendered pixels
-        renderImage.IncrementNumRenderPixel(1);
+            if (wavefront.SortRays()) { SortByMaterial(active, paths, keys); }
+            shadows.Clear();
+            size_t alive = 0;
+            {
+                TRACE_SCOPE("shade paths");
+                for (size_t k = 0; k < active.size(); k++) {
+                    if (shadePath(active[k], paths, shadows, sInfo)) { active[alive++] = active[k]; }
+                }
+            }
+            active.resize(alive);
 
-        if (renderImage.IsRenderDone()) {
-            // only one thread should ever get here, and it should be the last one
-            isRendering = false;
-            return;
+            traceShadows(paths, shadows, sInfo);
         }
 
-        index = next++;
+        // accumulate the finished paths into their pixels
+        for (int p = 0; p < paths.Size(); p++) {
+            pixelSum[paths.pixel[p] - first] += paths.radiance[p];
+        }
+
+        // the stages interleave the paths of the whole batch, so its pixels share the cost evenly
+        if (costMap.IsEnabled()) {
+            float batchSeconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - batchStart).count();
+            uint32_t rays = threadRayCount() - batchRays;
+            for (int k = 0; k < count; k++) costMap.Record(first + k, batchSeconds / count, rays / count);
+        }
+        for (int k = 0; k < count; k++) {
+            if (finishPixel(first + k, pixelSum[k], pixelZ[k], sampleMax)) {
+                return;
+            }
+        }
+
+        first = next.fetch_add(batchPixels);
+    }
+}
+
+void Raytracer::extendPaths( PathStates &paths, std::vector<int> const &active ) const {
+    TRACE_SCOPE("extend paths");
+    for (int p : active) {
+        paths.hit[p].Init();
+        paths.hitSomething[p] = TraceRay(Ray(paths.origin[p], paths.dir[p]), paths.hit[p], HIT_FRONT_AND_BACK);
+    }
+}
+
+bool Raytracer::shadePath( int p, PathStates &paths, ShadowQueue &shadows, SamplerInfo &sInfo ) {
+    // the same estimator as continuePath and materialSample, with the recursion replaced
+    // by the path throughput and the shadow rays deferred to the shadow stage
+    StatTimerScope timer(TIMER_SHADE);
+    CountStat(STAT_PATH_SEGMENTS);
+    Ray ray(paths.origin[p], paths.dir[p]);
+    HitInfo &hInfo = paths.hit[p];
+    bool hit = paths.hitSomething[p];
+    int bounce = paths.bounce[p];
+    Color &throughput = paths.throughput[p];
+    Color &radiance = paths.radiance[p];
+
+    int width = renderImage.GetWidth();
+    sInfo.SetPixel(paths.pixel[p] % width, paths.pixel[p] / width);
+    sInfo.SetPixelSample(paths.sample[p]);
+    sInfo.SetHit(ray, hInfo);
+    SetTextureFootprint(paths.footprint[p]);
+
+    // if we've hit nothing, the hit distance is effectively infinity
+    if ( !hit ) {
+        hInfo.z = BIGFLOAT;
+    }
+
+    float tScatter = BIGFLOAT;
+    Medium const* medium = media.empty() ? nullptr : sampleMedia(ray, hInfo, hit, sInfo, tScatter);
+
+    Vec3f nextP, nextDir;
+    float nextFootprint;
+    if ( medium ) {
+        if ( sInfo.RandomFloat() < medium->AbsorptionProb() ) {
+            if ( !hit ) { radiance += throughput * missColor(ray, sInfo, bounce); }
+            return false;
+        }
+
+        Vec3f pnt = ray.p + tScatter * ray.dir;
+
+        // sample the lights from the scattering point
+        HitInfo shadowInfo(hInfo);
+        shadowInfo.p = pnt;
+        SamplerInfo lSampInfo(sInfo);
+        lSampInfo.SetHit(ray, shadowInfo);
+        Light* light = this->randomLight(sInfo);
+        Vec3f lDir;
+        DirSampler::Info lInfo;
+        lInfo.SetVoid();
+        if ( SampleLight(light, lSampInfo, lDir, lInfo) ) {
+            lInfo.prob /= lightsRenderable.size();
+            if ( lInfo.prob > 0 ) { shadows.Push(p, pnt, lDir, light, throughput * lInfo.mult, lInfo.prob); }
+        }
+
+        // sample the phase function to get a new direction
+        float cosTheta = (2 * sInfo.RandomFloat()) - 1;
+        float sinTheta = sqrtf(1 - cosTheta * cosTheta);
+        float phi = FAST_TWO_PI * sInfo.RandomFloat();
+        float sinPhi, cosPhi;
+        SinCos(phi, sinPhi, cosPhi);
+        throughput *= 0.5f;
+        nextP = pnt;
+        nextDir = Vec3f(sinTheta*cosPhi, sinTheta*sinPhi, cosTheta);
+        nextFootprint = scatteredFootprint(paths.footprint[p], FAST_INV_4PI);
+    }
+    else if ( !hit ) {
+        radiance += throughput * missColor(ray, sInfo, bounce);
+        return false;
+    }
+    else if ( hInfo.isLight ) {
+        if ( bounce == 0 ) { hInfo.light->Radiance(sInfo); }
+        return false;
+    }
+    else {
+        Material const* mtl = hInfo.node->GetMaterial();
+        Light* light = this->randomLight(sInfo);
+
+        // sample the material's brdf
+        Vec3f mDir;
+        DirSampler::Info mInfo;
+        mInfo.SetVoid();
+        if ( !SampleMaterial(mtl, sInfo, mDir, mInfo) ) {
+            radiance += throughput * mInfo.mult;
+            return false;
+        }
+        if ( mInfo.lobe == DirSampler::SPECULAR && mDir.Dot(sInfo.GN()) < 0 ) {
+            mInfo.mult = Color().Black();
+        }
+        Color matColor = mInfo.mult / mInfo.prob;
+        DirSampler::Info matToL;
+        matToL.SetVoid();
+        LightSampleInfo(light, sInfo, mDir, matToL);
+
+        // sample the light, its shadow ray is traced in the shadow stage
+        Vec3f lDir;
+        DirSampler::Info lInfo;
+        lInfo.SetVoid();
+        bool lightSample = SampleLight(light, sInfo, lDir, lInfo);
+        lInfo.prob /= lightsRenderable.size();
+        if ( lightSample && lInfo.prob > 0 ) {
+            DirSampler::Info lToMat;
+            lToMat.SetVoid();
+            MaterialSampleInfo(mtl, sInfo, lDir.GetNormalized(), lToMat);
+            if ( lToMat.prob > 0 ) {
+                float l1 = lInfo.prob * lInfo.prob;
+                float l2 = lToMat.prob * lToMat.prob;
+                Color lightColor = lInfo.mult / lInfo.prob * lToMat.mult * (l1 / (l1 + l2));
+                shadows.Push(p, sInfo.P(), lDir, light, throughput * lightColor);
+            }
+        }
+
+        // caustics seen directly by the camera come from the photon map
+        if ( bounce == 0 && !pMap->IsEmpty() ) {
+            radiance += throughput * causticRadiance(sInfo, hInfo);
+        }
+
+        float m1 = mInfo.prob * mInfo.prob;
+        float m2 = matToL.prob * matToL.prob;
+        float wMat = m1 / (m1 + m2);
+        if ( matToL.prob != 0 || mDir.IsZero() ) {
+            radiance += throughput * matColor * wMat;
+            return false;
+        }
+        throughput *= matColor * wMat;
+        nextP = sInfo.P();
+        nextDir = mDir;
+        nextFootprint = scatteredFootprint(paths.footprint[p], mInfo.prob);
+    }
+
+    paths.origin[p] = nextP;
+    paths.dir[p] = nextDir;
+    paths.footprint[p] = nextFootprint;
+    paths.bounce[p] = bounce + 1;
+    return bounce + 1 < BOUNCE_LIMIT;
+}
+
+void Raytracer::traceShadows( PathStates &paths, ShadowQueue const &shadows, SamplerInfo &sInfo ) const {
+    TRACE_SCOPE("trace shadows");
+    for (int s = 0; s < shadows.Size(); s++) {
+        HitInfo shadowInfo;
+        shadowInfo.Init();
+        Ray shadowRay(shadows.origin[s], shadows.dir[s]);
+        bool shadowHit = ShadowTraceRay(shadowRay, shadowInfo, HIT_FRONT_AND_BACK, 1.0f);
+        bool reachesLight = shadowHit && shadowInfo.isLight && shadowInfo.light == shadows.light[s];
+        CountStat(STAT_NEE_SAMPLES);
+
+        if ( shadows.lightProb[s] > 0 ) {
+            // a sample from inside a medium is weighted by the transmittance to the light
+            if ( !reachesLight ) { continue; }
+            CountStat(STAT_NEE_VISIBLE);
+            float l_transmit = mediaTransmittance(shadowRay, shadowInfo, shadowHit, sInfo);
+            float lightToPhase = FAST_INV_4PI * l_transmit;
+            float l2 = shadows.lightProb[s] * shadows.lightProb[s];
+            float w = l2 / (l2 + lightToPhase * lightToPhase);
+            paths.radiance[shadows.path[s]] += shadows.contribution[s] * lightToPhase * w;
+        }
+        else if ( !shadowHit || reachesLight ) {
+            CountStat(STAT_NEE_VISIBLE);
+            float l_transmit = reachesLight && !media.empty() ? mediaTransmittance(shadowRay, shadowInfo, shadowHit, sInfo) : 1.0f;
+            paths.radiance[shadows.path[s]] += shadows.contribution[s] * l_transmit;
+        }
     }
 }
 
@@ -449,13 +975,17 @@ void Raytracer::BeginRender() {
         }
     }
 
+    if ( pMap->IsEnabled() ) {
+        BuildPhotonMap();
+    }
+    radiance.assign(size_t(renderImage.GetWidth()) * renderImage.GetHeight(), Color().Black());
+    if ( costMap.IsEnabled() ) { costMap.Init(renderImage.GetWidth(), renderImage.GetHeight()); }
+    renderStart = std::chrono::steady_clock::now();
+    ResetRenderStats();
+
     std::vector<std::thread> threads;
 
-    int n = std::thread::hardware_concurrency() / 2;
-    if (n == 0) n = 8;
-#ifndef NDEBUG
-    n = 1;
-#endif
+    int n = threadCount();
     fprintf(stdout, "Rendering with %d threads\n", n);
 
     isRendering = true;
@@ -470,6 +1000,196 @@ void Raytracer::BeginRender() {
     }
 }
 
+void Raytracer::printCameraRayStats() const {
+#if RENDER_STATS
+    RenderStats stats = TotalRenderStats();
+    double seconds = stats.counters[STAT_CAMERA_RAY_NS] * 1e-9;
+    if ( seconds <= 0 ) { return; }
+    char mode[32];
+    if ( packets.IsEnabled() ) { snprintf(mode, sizeof(mode), "packets of %d", packets.Size()); }
+    else { snprintf(mode, sizeof(mode), "single rays"); }
+    fprintf(stdout, "Camera rays: %llu in %.2f thread seconds, %.2f Mrays/s per thread (%s)\n",
+            (unsigned long long)cameraRays, seconds, cameraRays / seconds * 1e-6, mode);
+#endif
+}
+
+void Raytracer::printPathStats() const {
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - renderStart).count();
+    if ( seconds <= 0 ) { return; }
+    char mode[48];
+    if ( wavefront.IsEnabled() ) { snprintf(mode, sizeof(mode), "wavefront, %d paths per thread", wavefront.Paths()); }
+    else { snprintf(mode, sizeof(mode), "recursive"); }
+    fprintf(stdout, "Paths: %llu in %.2f seconds, %.3f Mpaths/s (%s)\n",
+            (unsigned long long)cameraRays, seconds, cameraRays / seconds * 1e-6, mode);
+}
+
+uint32_t Raytracer::threadRayCount() const {
+    // kept by the render statistics, so rays read as zero when they are compiled out
+    RenderStats const &stats = ThreadRenderStats();
+    return uint32_t(stats.counters[STAT_RAYS] + stats.counters[STAT_SHADOW_RAYS]);
+}
+
+int Raytracer::threadCount() const {
+    int n = std::thread::hardware_concurrency() / 2;
+    if (n == 0) n = 8;
+#ifndef NDEBUG
+    n = 1;
+#endif
+    return n;
+}
+
+void Raytracer::BuildPhotonMap() const {
+    TRACE_SCOPE("BuildPhotonMap");
+    if ( lightsRenderable.empty() ) { return; }
+    auto start = std::chrono::steady_clock::now();
+
+    // the threads take chunks of the photons in turn, each chunk is stored in its own list
+    int n = threadCount();
+    int total = pMap->EmitCount();
+    std::vector<std::vector<Photon>> chunkPhotons(PHOTON_CHUNKS);
+    // every chunk emits from the same light centers, found once
+    std::vector<Vec3f> centers;
+    lightCenters(centers);
+    std::atomic<int> nextChunk(0);
+    std::vector<std::thread> threads;
+    for ( int i = 0; i < n; i++ ) {
+        threads.emplace_back([&]() {
+            for ( int c = nextChunk++; c < PHOTON_CHUNKS; c = nextChunk++ ) {
+                int count = total / PHOTON_CHUNKS + (c < total % PHOTON_CHUNKS ? 1 : 0);
+                emitPhotons(c, count, centers, chunkPhotons[c]);
+            }
+        });
+    }
+    for ( auto& t : threads ) {
+        t.join();
+    }
+
+    double emitTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    pMap->Build(chunkPhotons, emitTime);
+    pMap->PrintStats();
+}
+
+void Raytracer::lightCenters( std::vector<Vec3f> &centers ) const {
+    RNG rng(1);
+    SamplerInfo sInfo(rng);
+
+    // the lights only expose their sampling interface, so estimate their centers by sampling them
+    centers.resize(lightsRenderable.size());
+    Vec3f references[7] = { Vec3f(0, 0, 0), Vec3f(1e3f, 0, 0), Vec3f(-1e3f, 0, 0), Vec3f(0, 1e3f, 0),
+                            Vec3f(0, -1e3f, 0), Vec3f(0, 0, 1e3f), Vec3f(0, 0, -1e3f) };
+    for ( size_t l = 0; l < lightsRenderable.size(); l++ ) {
+        Vec3f sum(0, 0, 0);
+        int found = 0;
+        for ( int r = 0; r < 7 && found == 0; r++ ) {
+            HitInfo refInfo;
+            refInfo.Init();
+            refInfo.p = references[r];
+            sInfo.SetHit(Ray(references[r], Vec3f(0, 0, 1)), refInfo);
+            for ( int k = 0; k < 16; k++ ) {
+                Vec3f lDir;
+                DirSampler::Info lInfo;
+                lInfo.SetVoid();
+                if ( lightsRenderable[l]->GenerateSample(sInfo, lDir, lInfo) ) {
+                    sum += references[r] + lDir;
+                    found++;
+                }
+            }
+        }
+        centers[l] = found > 0 ? sum / float(found) : Vec3f(0, 0, 0);
+    }
+}
+
+void Raytracer::emitPhotons( int seed, int count, std::vector<Vec3f> const &centers, std::vector<Photon> &stored ) const {
+    TRACE_SCOPE("emitPhotons");
+    RNG rng(seed * 7919 + 1);
+    SamplerInfo sInfo(rng);
+
+    // each photon carries an equal share of the total flux of all lights
+    float fluxScale = 4 * M_PI * lightsRenderable.size() / pMap->EmitCount();
+
+    LazyPin lazyPin;
+    for ( int i = 0; i < count; i++ ) {
+        lazyPin.Pin();
+        int l = sInfo.RandomInt() % lightsRenderable.size();
+        Light const* light = lightsRenderable[l];
+
+        // uniform emission direction
+        float z = 1 - 2 * sInfo.RandomFloat();
+        float r = sqrt(Max(0.0f, 1 - z * z));
+        float phi = FAST_TWO_PI * sInfo.RandomFloat();
+        float sinPhi, cosPhi;
+        SinCos(phi, sinPhi, cosPhi);
+        Vec3f dir(r * cosPhi, r * sinPhi, z);
+
+        // sampling the light from far along the emission direction gives a point on the
+        // light's disk facing that direction, and the sample energy gives back the intensity
+        Vec3f farPoint = centers[l] + dir * 1e3f;
+        HitInfo hInfo;
+        hInfo.Init();
+        hInfo.p = farPoint;
+        sInfo.SetHit(Ray(farPoint, -dir), hInfo);
+        Vec3f lDir;
+        DirSampler::Info lInfo;
+        lInfo.SetVoid();
+        if ( !light->GenerateSample(sInfo, lDir, lInfo) ) { continue; }   // outside of a spot light's cone
+
+        Color power = lInfo.mult * lDir.LengthSquared() * fluxScale;
+        Ray ray(farPoint + lDir, dir);
+        bool specular = false;
+
+        for ( int bounce = 0; bounce < 16; bounce++ ) {
+            hInfo.Init();
+            if ( !TraceRay(ray, hInfo, HIT_FRONT_AND_BACK) || hInfo.isLight ) { break; }
+            Material const* mtl = hInfo.node->GetMaterial();
+            if ( !mtl ) { break; }
+
+            // caustic photons have reached this surface through at least one specular bounce
+            if ( specular ) {
+                Photon p;
+                p.pos = hInfo.p;
+                p.power = power;
+                p.plane = 0;
+                p.SetDirection(-ray.dir);
+                stored.push_back(p);
+            }
+
+            sInfo.SetHit(ray, hInfo);
+            Vec3f newDir;
+            DirSampler::Info mInfo;
+            mInfo.SetVoid();
+            if ( !mtl->GenerateSample(sInfo, newDir, mInfo) || mInfo.prob <= 0 ) { break; }
+            if ( mInfo.lobe == DirSampler::DIFFUSE ) { break; }
+
+            power *= mInfo.mult / mInfo.prob;
+            specular = true;
+            ray = Ray(hInfo.p, newDir);
+        }
+    }
+}
+
+Color Raytracer::causticRadiance( SamplerInfo const &sInfo, HitInfo const &hInfo ) const {
+    // only the diffuse lobe is estimated from photons
+    MtlBlinn const* mtl = dynamic_cast<MtlBlinn const*>(hInfo.node->GetMaterial());
+    if ( !mtl ) { return Color().Black(); }
+    Color kd = GetBlinnEval(*mtl, sInfo.UVW()).diffuse;
+    if ( kd.IsBlack() ) { return Color().Black(); }
+
+    static thread_local PhotonQuery query;
+    query.Init(pMap->GatherCount(), pMap->GatherRadius());
+    pMap->Gather(sInfo.P(), query);
+    if ( query.found == 0 ) { return Color().Black(); }
+
+    // only photons arriving on the viewer's side of the surface contribute
+    float side = sInfo.V().Dot(sInfo.N());
+    Color flux = Color().Black();
+    for ( int i = 0; i < query.found; i++ ) {
+        if ( query.list[i]->GetDirection().Dot(sInfo.N()) * side > 0 ) {
+            flux += query.list[i]->power;
+        }
+    }
+    return kd * flux / float(M_PI * M_PI * query.maxDist2);
+}
+
 void Raytracer::StopRender () {
 
 }
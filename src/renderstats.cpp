@@ -0,0 +1,160 @@
+#include "renderstats.h"
+#include "tinyxml2.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+
+static char const *counterNames[STAT_COUNTER_COUNT] = {
+    "camera_rays", "rays", "shadow_rays", "bvh_nodes", "triangles", "path_segments", "nee_samples", "nee_visible",
+    "photon_queries", "photons_gathered", "photon_gather_ns", "camera_ray_ns"
+};
+static char const *timerNames[TIMER_COUNT] = { "other", "intersect", "shade", "lights" };
+
+static std::mutex statsMutex;
+static std::vector<RenderStats*> threadStats;
+
+// file the report is written to, none unless the scene asks for it
+static std::string jsonFile;
+
+static std::atomic<unsigned long long> heapAllocations(0);
+static unsigned long long renderStartAllocations = 0;
+
+#if RENDER_ALLOC_STATS
+// counts the new expressions of the whole program, the default array and nothrow forms
+// call this one; over-aligned types use their own form and are not counted. The default
+// operator delete frees what malloc returned
+void* operator new( size_t size ) {
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    if (size == 0) size = 1;
+    for (;;) {
+        if (void *p = malloc(size)) return p;
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) throw std::bad_alloc();
+        handler();
+    }
+}
+#endif
+
+unsigned long long HeapAllocations() {
+    return heapAllocations.load(std::memory_order_relaxed);
+}
+
+size_t PeakMemoryBytes() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+    return size_t(usage.ru_maxrss) * 1024;     // kilobytes on Linux
+}
+
+void RenderStats::Add( RenderStats const &s ) {
+    for (int c = 0; c < STAT_COUNTER_COUNT; c++) counters[c] += s.counters[c];
+    for (int t = 0; t < TIMER_COUNT; t++) nanoseconds[t] += s.nanoseconds[t];
+}
+
+RenderStats* RegisterRenderStats() {
+    // never freed, the sums still read the counters of threads that have finished
+    RenderStats *stats = new RenderStats();
+    std::lock_guard<std::mutex> lock(statsMutex);
+    threadStats.push_back(stats);
+    return stats;
+}
+
+RenderStats TotalRenderStats() {
+    RenderStats total;
+    std::lock_guard<std::mutex> lock(statsMutex);
+    for (RenderStats const *stats : threadStats) total.Add(*stats);
+    return total;
+}
+
+void ResetRenderStats() {
+    renderStartAllocations = HeapAllocations();
+    std::lock_guard<std::mutex> lock(statsMutex);
+    for (RenderStats *stats : threadStats) {
+        *stats = RenderStats();
+    }
+}
+
+bool LoadRenderStatsSettings( tinyxml2::XMLElement const *sceneElem ) {
+    jsonFile.clear();
+    if (!sceneElem) return false;
+
+    tinyxml2::XMLElement const *e = sceneElem->FirstChildElement("renderstats");
+    if (!e) return true;
+    char const *file = e->Attribute("json");
+    jsonFile = file ? file : "render_stats.json";
+    return true;
+}
+
+static double ratio( unsigned long long a, unsigned long long b ) {
+    return b ? double(a) / double(b) : 0.0;
+}
+
+static void writeJson( RenderStats const &total, double renderSeconds, int threads ) {
+    FILE *f = fopen(jsonFile.c_str(), "w");
+    if (!f) {
+        fprintf(stderr, "Cannot write render statistics to %s\n", jsonFile.c_str());
+        return;
+    }
+    unsigned long long const *c = total.counters;
+    fprintf(f, "{\n  \"seconds\": %.6f,\n  \"threads\": %d,\n  \"counters\": {\n", renderSeconds, threads);
+    for (int i = 0; i < STAT_COUNTER_COUNT; i++) {
+        fprintf(f, "    \"%s\": %llu%s\n", counterNames[i], c[i], i + 1 < STAT_COUNTER_COUNT ? "," : "");
+    }
+    fprintf(f, "  },\n  \"thread_seconds\": {\n");
+    for (int i = 0; i < TIMER_COUNT; i++) {
+        fprintf(f, "    \"%s\": %.6f%s\n", timerNames[i], total.nanoseconds[i] * 1e-9, i + 1 < TIMER_COUNT ? "," : "");
+    }
+    fprintf(f, "  },\n");
+    fprintf(f, "  \"path_length\": %.4f,\n", ratio(c[STAT_PATH_SEGMENTS], c[STAT_CAMERA_RAYS]));
+    fprintf(f, "  \"nodes_per_ray\": %.4f,\n", ratio(c[STAT_BVH_NODES], c[STAT_RAYS] + c[STAT_SHADOW_RAYS]));
+    fprintf(f, "  \"triangles_per_ray\": %.4f,\n", ratio(c[STAT_TRIANGLES], c[STAT_RAYS] + c[STAT_SHADOW_RAYS]));
+    fprintf(f, "  \"nee_visible_fraction\": %.4f,\n", ratio(c[STAT_NEE_VISIBLE], c[STAT_NEE_SAMPLES]));
+#if RENDER_ALLOC_STATS
+    fprintf(f, "  \"heap_allocations\": %llu,\n", HeapAllocations() - renderStartAllocations);
+#endif
+    fprintf(f, "  \"peak_memory_mb\": %.1f\n}\n", PeakMemoryBytes() / 1048576.0);
+    fclose(f);
+}
+
+void PrintRenderStats( double renderSeconds, int threads ) {
+#if RENDER_STATS
+    // the calling thread's time since its last category switch is not in its counters yet
+    { StatTimerScope flush(TIMER_OTHER); }
+
+    RenderStats total = TotalRenderStats();
+
+    unsigned long long const *c = total.counters;
+    unsigned long long rays = c[STAT_RAYS] + c[STAT_SHADOW_RAYS];
+    fprintf(stdout, "Render statistics (%d threads, %.2f seconds):\n", threads, renderSeconds);
+    fprintf(stdout, "  rays: %llu camera, %llu closest hit, %llu shadow, %.2f Mrays/s\n",
+            c[STAT_CAMERA_RAYS], c[STAT_RAYS], c[STAT_SHADOW_RAYS], renderSeconds > 0 ? rays / renderSeconds * 1e-6 : 0.0);
+    fprintf(stdout, "  traversal: %.1f nodes and %.1f triangles per ray\n",
+            ratio(c[STAT_BVH_NODES], rays), ratio(c[STAT_TRIANGLES], rays));
+    fprintf(stdout, "  paths: %.2f segments on average, %llu of %llu light samples unoccluded (%.1f%%)\n",
+            ratio(c[STAT_PATH_SEGMENTS], c[STAT_CAMERA_RAYS]), c[STAT_NEE_VISIBLE], c[STAT_NEE_SAMPLES],
+            100.0 * ratio(c[STAT_NEE_VISIBLE], c[STAT_NEE_SAMPLES]));
+
+    unsigned long long timeSum = 0;
+    for (int t = 0; t < TIMER_COUNT; t++) timeSum += total.nanoseconds[t];
+    fprintf(stdout, "  thread time:");
+    for (int t = 0; t < TIMER_COUNT; t++) {
+        fprintf(stdout, " %s %.2fs (%.1f%%)", timerNames[t], total.nanoseconds[t] * 1e-9, 100.0 * ratio(total.nanoseconds[t], timeSum));
+    }
+    fprintf(stdout, "\n");
+#if RENDER_ALLOC_STATS
+    fprintf(stdout, "  memory: %llu heap allocations while rendering, %.1f MB peak resident\n",
+            HeapAllocations() - renderStartAllocations, PeakMemoryBytes() / 1048576.0);
+#else
+    fprintf(stdout, "  memory: %.1f MB peak resident\n", PeakMemoryBytes() / 1048576.0);
+#endif
+
+    if (!jsonFile.empty()) writeJson(total, renderSeconds, threads);
+#else
+    (void)renderSeconds; (void)threads;
+#endif
+}
@@ -0,0 +1,63 @@
+#include "trace.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+
+static std::mutex traceMutex;
+static std::vector<TraceBuffer*> traceBuffers;
+
+// names are string literals from the code, so only quotes and backslashes need escaping
+static void writeName( FILE *f, char const *name ) {
+    for (char const *c = name; *c; c++) {
+        if (*c == '"' || *c == '\\') fputc('\\', f);
+        fputc(*c, f);
+    }
+}
+
+static void writeTrace() {
+    char const *file = getenv("RENDER_TRACE_FILE");
+    if (!file || !*file) file = "trace.json";
+    FILE *f = fopen(file, "w");
+    if (!f) {
+        fprintf(stderr, "Cannot write trace to %s\n", file);
+        return;
+    }
+
+    // the buffers are read without stopping their threads, which are all done rendering
+    // by the time the program exits
+    std::lock_guard<std::mutex> lock(traceMutex);
+    size_t count = 0;
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    for (TraceBuffer const *b : traceBuffers) {
+        fprintf(f, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"", first ? "" : ",\n", b->id);
+        if (b->threadName) writeName(f, b->threadName);
+        else fprintf(f, "thread %d", b->id);
+        fprintf(f, "\"}}");
+        first = false;
+
+        size_t n = b->events.size();
+        for (size_t i = 0; i < n; i++) {
+            TraceEvent const &e = b->events[i];
+            fprintf(f, ",\n{\"ph\":\"X\",\"name\":\"");
+            writeName(f, e.name);
+            fprintf(f, "\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", b->id, e.start * 1e-3, e.duration * 1e-3);
+        }
+        count += n;
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+    fprintf(stdout, "Wrote %zu trace events to %s\n", count, file);
+}
+
+TraceBuffer* RegisterTraceBuffer() {
+    // never freed, the buffers of finished threads are written at exit too
+    TraceBuffer *buffer = new TraceBuffer();
+    buffer->events.reserve(1024);
+    std::lock_guard<std::mutex> lock(traceMutex);
+    if (traceBuffers.empty()) atexit(writeTrace);
+    buffer->id = int(traceBuffers.size()) + 1;
+    traceBuffers.push_back(buffer);
+    return buffer;
+}
@@ -0,0 +1,90 @@
+#include "wavefront.h"
+#include "tinyxml2.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <iostream>
+
+void PathStates::Resize( int n ) {
+    origin.resize(n);
+    dir.resize(n);
+    hit.resize(n);
+    hitSomething.resize(n);
+    throughput.resize(n);
+    radiance.resize(n);
+    footprint.resize(n);
+    bounce.resize(n);
+    pixel.resize(n);
+    sample.resize(n);
+}
+
+void ShadowQueue::Clear() {
+    origin.clear();
+    dir.clear();
+    light.clear();
+    contribution.clear();
+    lightProb.clear();
+    path.clear();
+}
+
+void ShadowQueue::Push( int p, Vec3f const &o, Vec3f const &d, Light const *l, Color const &c, float prob ) {
+    origin.push_back(o);
+    dir.push_back(d);
+    light.push_back(l);
+    contribution.push_back(c);
+    lightProb.push_back(prob);
+    path.push_back(p);
+}
+
+bool Wavefront::LoadSettings( tinyxml2::XMLElement const *sceneElem ) {
+    if (!sceneElem) return false;
+
+    tinyxml2::XMLElement const *e = sceneElem->FirstChildElement("wavefront");
+    if (!e) return true;
+    paths = 16384;
+    e->QueryIntAttribute("paths", &paths);
+    e->QueryBoolAttribute("sort", &sortRays);
+    if (paths < 0) paths = 0;
+    return true;
+}
+
+// sort the indices by the upper 32 bits of their keys, the lower bits hold the index itself
+static void sortByKeys( std::vector<int> &active, std::vector<uint64_t> &keys ) {
+    std::sort(keys.begin(), keys.end());
+    for (size_t k = 0; k < keys.size(); k++) active[k] = int(keys[k] & 0xFFFFFFFFu);
+}
+
+void SortByDirection( std::vector<int> &active, PathStates const &states, std::vector<uint64_t> &keys ) {
+    TRACE_SCOPE("sort by direction");
+    keys.resize(active.size());
+    for (size_t k = 0; k < active.size(); k++) {
+        Vec3f d = states.dir[active[k]].GetNormalized();
+        // octant first, so rays that cross boxes from the same sides stay together,
+        // then the direction quantized to 8 bits per component
+        uint32_t octant = (d.x < 0) | (d.y < 0) << 1 | (d.z < 0) << 2;
+        uint32_t qx = uint32_t((d.x * 0.5f + 0.5f) * 255.0f);
+        uint32_t qy = uint32_t((d.y * 0.5f + 0.5f) * 255.0f);
+        uint32_t qz = uint32_t((d.z * 0.5f + 0.5f) * 255.0f);
+        uint64_t key = octant << 24 | qx << 16 | qy << 8 | qz;
+        keys[k] = key << 32 | uint32_t(active[k]);
+    }
+    sortByKeys(active, keys);
+}
+
+void SortByMaterial( std::vector<int> &active, PathStates const &states, std::vector<uint64_t> &keys ) {
+    TRACE_SCOPE("sort by material");
+    keys.resize(active.size());
+    for (size_t k = 0; k < active.size(); k++) {
+        int p = active[k];
+        HitInfo const &h = states.hit[p];
+        // misses first, then light hits, then surfaces grouped by material; distinct
+        // materials sharing a key only cost coherence
+        uint64_t key = 0;
+        if (states.hitSomething[p]) {
+            if (h.isLight) key = 1;
+            else key = uint32_t(uintptr_t(h.node->GetMaterial()) >> 4) | 2u;
+        }
+        keys[k] = key << 32 | uint32_t(p);
+    }
+    sortByKeys(active, keys);
+}